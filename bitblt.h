@@ -107,7 +107,14 @@ void rot_270 (Bitmap *src);  /* transpose + flip_v */
 void reverse_bits (uint8_t *p, int byte_count);
 
 
-void bitblt_write_g4 (Bitmap *bitmap, FILE *f);
+/* The G4 encoder passes its output to the callback a block at a time. */
+typedef void (*bitblt_write_callback) (void *app_data,
+				       const uint8_t *data,
+				       uint32_t len);
+
+void bitblt_write_g4 (Bitmap *bitmap,
+		      bitblt_write_callback write,
+		      void *app_data);
 
 
 /* frees original! */
@@ -117,3 +124,100 @@ Bitmap *resize_bitmap (Bitmap *src,
 
 /* "in place" rotation */
 void rotate_bitmap (Bitmap *src, int rotation);
+
+
+/* in-place morphological operators, using the 3x3 square neighborhood;
+   return false if buffers can't be allocated */
+bool erode_bitmap (Bitmap *bitmap);
+bool dilate_bitmap (Bitmap *bitmap);
+bool open_bitmap (Bitmap *bitmap);   /* erode + dilate */
+bool close_bitmap (Bitmap *bitmap);  /* dilate + erode */
+
+/* remove isolated black pixels, and fill isolated white ones */
+bool despeckle_bitmap (Bitmap *bitmap);
+
+/* black pixels in the first rows of the bitmap */
+uint64_t count_black_pixels (Bitmap *bitmap, uint32_t rows);
+
+/* number of color changes along the rows, including to and from the
+   white margins; G4 coding costs grow with it */
+uint64_t count_transitions (Bitmap *bitmap);
+
+
+/* Bounds of the content within the solid black borders that scanners
+   leave at the edges of a page.  If there are no borders, or there is
+   nothing but border, the bounds are those of the bitmap. */
+bool find_content_rect (Bitmap *bitmap, Rect *content);
+
+/* make everything outside the rect white */
+void whiten_outside_rect (Bitmap *bitmap, Rect *content);
+
+/* both of the above; the size of the bitmap is unchanged */
+bool trim_borders (Bitmap *bitmap, Rect *content);
+
+
+/* Skew of the text lines in degrees, positive if they slope down to
+   the right, or 0 if it can't be measured.  Up to 5 degrees is found. */
+double find_skew (Bitmap *bitmap);
+
+/* in-place rotation by a small angle, clockwise on the page if positive,
+   done with three shears; the size is unchanged */
+bool shear_rotate_bitmap (Bitmap *bitmap, double degrees);
+
+/* find the skew, and rotate to correct it if it's significant */
+bool deskew_bitmap (Bitmap *bitmap, double *skew);
+
+
+/* "in place" reduction by a factor of 2 or 4 in each direction - will
+   allocate new memory and free old.  A cell of factor * factor pixels
+   becomes black if at least level of its pixels are, or if level is
+   0, if at least half are. */
+bool reduce_bitmap (Bitmap *src, int factor, int level);
+
+/* as above, but returns a new bitmap and leaves the original */
+Bitmap *reduced_bitmap (Bitmap *src, int factor, int level);
+
+
+/* Conversion of rows of 8-bit grayscale samples, in which 0 is black,
+   to a bitmap in which black pixels are set. */
+typedef struct Thresholder Thresholder;
+
+/* accumulate the counts of sample values into histogram [256] */
+void gray_histogram (uint32_t *histogram, uint8_t *samples, uint32_t count);
+
+/* Otsu's method, returns the level below which samples are black */
+int otsu_threshold (uint32_t *histogram);
+
+/* Samples below level are black.  If radius is nonzero, Sauvola's
+   local threshold over a square window of 2 * radius + 1 samples is
+   used instead, except where the window has too little contrast. */
+Thresholder *create_thresholder (Bitmap *bitmap, int level, int radius);
+void free_thresholder (Thresholder *t);
+
+/* Rows are the width of the bitmap, and are supplied top to bottom in
+   bands of any size.  Only 2 * radius + 2 rows are held at once. */
+void threshold_rows (Thresholder *t, uint8_t *gray, int32_t row_count);
+
+
+/* Mixed raster content: the background of a page, at 1 / factor of the
+   resolution, from rows of 8-bit samples with components (1 or 3)
+   samples per pixel, and the black pixels of mask marking the ink. */
+typedef struct Background Background;
+
+/* Clear the parts of the mask too dense to be text, so that pictures
+   go into the background.  Returns the number of 32x32 blocks
+   cleared. */
+uint32_t clear_mask_pictures (Bitmap *mask);
+
+Background *create_background (Bitmap *mask, int components, int factor);
+void free_background (Background *bg);
+
+/* Rows are the width of the mask, and are supplied top to bottom in
+   bands of any size. */
+void background_rows (Background *bg, uint8_t *samples, int32_t row_count);
+
+/* once all rows are supplied; the samples belong to bg */
+uint8_t *background_samples (Background *bg, uint32_t *width, uint32_t *height);
+
+/* average color of the ink, components samples */
+void foreground_color (Background *bg, uint8_t *color);
@@ -47,7 +47,8 @@
 
 struct bit_buffer
 {
-  FILE *f;
+  bitblt_write_callback write;
+  void *app_data;
   uint32_t byte_idx;  /* index to next byte position in data buffer */
   uint32_t bit_idx;   /* one greater than the next bit position in data buffer,
 			 8 = MSB, 1 = LSB */
@@ -65,14 +66,12 @@ static void init_bit_buffer (struct bit_buffer *buf)
 
 static void flush_bits (struct bit_buffer *buf)
 {
-  size_t s;
   if (buf->bit_idx != 8)
     {
       buf->byte_idx++;
       buf->bit_idx = 8;
     }
-  s = fwrite (& buf->data [0], 1, buf->byte_idx, buf->f);
-  /* $$$ should check result */
+  buf->write (buf->app_data, & buf->data [0], buf->byte_idx);
   init_bit_buffer (buf);
 }
 
@@ -296,7 +295,9 @@ static void g4_encode_row (struct bit_buffer *buf,
 }
 
 
-void bitblt_write_g4 (Bitmap *bitmap, FILE *f)
+void bitblt_write_g4 (Bitmap *bitmap,
+		      bitblt_write_callback write,
+		      void *app_data)
 {
   uint32_t width = bitmap->rect.max.x - bitmap->rect.min.x;
   uint32_t row;
@@ -315,7 +316,8 @@ void bitblt_write_g4 (Bitmap *bitmap, FILE *f)
 
   init_bit_buffer (& bb);
 
-  bb.f = f;
+  bb.write = write;
+  bb.app_data = app_data;
 
   for (row = bitmap->rect.min.y;
        row < bitmap->rect.max.y;
@@ -0,0 +1,221 @@
+/*
+ * tumble: build a PDF file from image files
+ *
+ * Bilevel morphology
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.  Note that permission is
+ * not granted to redistribute this program under the terms of any
+ * other version of the General Public License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111 USA
+ */
+
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bitblt.h"
+
+
+#define SWAP(type,a,b) do { type temp; temp = a; a = b; b = temp; } while (0)
+
+
+/* All of the operators use the 3x3 square neighborhood, and treat
+   pixels outside the bitmap as white.  As elsewhere, pixel x of a row is
+   bit x % 32 of word x / 32, so shifting a row left by one pixel moves
+   each pixel's left neighbor into its bit position. */
+
+#define OP_ERODE     0
+#define OP_DILATE    1
+#define OP_DESPECKLE 2
+
+
+/* pixel x - 1 of the row, in bit position x */
+static inline word_t left_neighbors (const word_t *row, uint32_t i)
+{
+  return ((row [i] << 1) |
+	  (i ? (row [i - 1] >> (BITS_PER_WORD - 1)) : 0));
+}
+
+/* pixel x + 1 of the row, in bit position x */
+static inline word_t right_neighbors (const word_t *row, uint32_t i, uint32_t n)
+{
+  return ((row [i] >> 1) |
+	  ((i + 1 < n) ? (row [i + 1] << (BITS_PER_WORD - 1)) : 0));
+}
+
+
+static void morph_row (word_t *restrict dest,
+		       const word_t *restrict above,
+		       const word_t *restrict row,
+		       const word_t *restrict below,
+		       uint32_t n,
+		       int op)
+{
+  uint32_t i;
+
+  for (i = 0; i < n; i++)
+    {
+      word_t al = left_neighbors (above, i), ar = right_neighbors (above, i, n);
+      word_t l = left_neighbors (row, i), r = right_neighbors (row, i, n);
+      word_t bl = left_neighbors (below, i), br = right_neighbors (below, i, n);
+
+      switch (op)
+	{
+	case OP_ERODE:
+	  dest [i] = al & above [i] & ar & l & row [i] & r & bl & below [i] & br;
+	  break;
+	case OP_DILATE:
+	  dest [i] = al | above [i] | ar | l | row [i] | r | bl | below [i] | br;
+	  break;
+	default:
+	  /* clear black pixels with no black neighbors, and set white
+	     pixels with no white ones */
+	  dest [i] = ((row [i] & (al | above [i] | ar | l | r | bl | below [i] | br)) |
+		      (al & above [i] & ar & l & r & bl & below [i] & br));
+	  break;
+	}
+    }
+}
+
+
+/* The bitmap is processed in place a row at a time, so only the
+   original contents of the row above and the current row need to be
+   kept aside. */
+static bool morph_bitmap (Bitmap *bitmap, int op)
+{
+  uint32_t n = bitmap->row_words;
+  uint32_t width = rect_width (& bitmap->rect);
+  uint32_t height = rect_height (& bitmap->rect);
+  word_t last_mask = (width % BITS_PER_WORD) ?
+    ((1U << (width % BITS_PER_WORD)) - 1) : ~ 0U;
+  word_t *above, *row, *white;
+  uint32_t y;
+
+  above = calloc (n, sizeof (word_t));
+  row = malloc (n * sizeof (word_t));
+  white = calloc (n, sizeof (word_t));
+  if (! (above && row && white))
+    {
+      fprintf (stderr, "can't allocate row buffers\n");
+      free (above);
+      free (row);
+      free (white);
+      return false;
+    }
+
+  /* bits past the right edge must be white, or they would spread into
+     the image */
+  for (y = 0; y < height; y++)
+    bitmap->bits [y * n + n - 1] &= last_mask;
+
+  for (y = 0; y < height; y++)
+    {
+      word_t *dest = bitmap->bits + y * n;
+      word_t *below = (y + 1 < height) ? (dest + n) : white;
+
+      memcpy (row, dest, n * sizeof (word_t));
+      morph_row (dest, above, row, below, n, op);
+      dest [n - 1] &= last_mask;
+      SWAP (word_t *, above, row);
+    }
+
+  free (above);
+  free (row);
+  free (white);
+  return true;
+}
+
+
+bool erode_bitmap (Bitmap *bitmap)
+{
+  return morph_bitmap (bitmap, OP_ERODE);
+}
+
+bool dilate_bitmap (Bitmap *bitmap)
+{
+  return morph_bitmap (bitmap, OP_DILATE);
+}
+
+bool open_bitmap (Bitmap *bitmap)
+{
+  return (morph_bitmap (bitmap, OP_ERODE) &&
+	  morph_bitmap (bitmap, OP_DILATE));
+}
+
+bool close_bitmap (Bitmap *bitmap)
+{
+  return (morph_bitmap (bitmap, OP_DILATE) &&
+	  morph_bitmap (bitmap, OP_ERODE));
+}
+
+bool despeckle_bitmap (Bitmap *bitmap)
+{
+  return morph_bitmap (bitmap, OP_DESPECKLE);
+}
+
+
+uint64_t count_black_pixels (Bitmap *bitmap, uint32_t rows)
+{
+  uint32_t n = bitmap->row_words;
+  uint32_t width = rect_width (& bitmap->rect);
+  word_t last_mask = (width % BITS_PER_WORD) ?
+    ((1U << (width % BITS_PER_WORD)) - 1) : ~ 0U;
+  uint64_t count = 0;
+  uint32_t y, i;
+
+  for (y = 0; y < rows; y++)
+    {
+      const word_t *row = bitmap->bits + y * n;
+
+      for (i = 0; i + 1 < n; i++)
+	count += __builtin_popcount (row [i]);
+      count += __builtin_popcount (row [n - 1] & last_mask);
+    }
+  return count;
+}
+
+
+uint64_t count_transitions (Bitmap *bitmap)
+{
+  uint32_t n = bitmap->row_words;
+  uint32_t width = rect_width (& bitmap->rect);
+  uint32_t height = rect_height (& bitmap->rect);
+  word_t last_mask = (width % BITS_PER_WORD) ?
+    ((1U << (width % BITS_PER_WORD)) - 1) : ~ 0U;
+  uint64_t count = 0;
+  uint32_t y, i;
+
+  for (y = 0; y < height; y++)
+    {
+      const word_t *row = bitmap->bits + y * n;
+
+      /* a bit of w ^ (w << 1) is set where the color changes, counting
+	 changes from and to the white margins on either side */
+      for (i = 0; i < n; i++)
+	{
+	  word_t w = (i + 1 < n) ? row [i] : (row [i] & last_mask);
+	  word_t prev = i ? (row [i - 1] >> (BITS_PER_WORD - 1)) : 0;
+
+	  count += __builtin_popcount (w ^ ((w << 1) | prev));
+	}
+
+      /* the change back to white at the right edge is in the padding,
+	 unless there isn't any */
+      if ((! (width % BITS_PER_WORD)) && (row [n - 1] >> (BITS_PER_WORD - 1)))
+	count++;
+    }
+  return count;
+}
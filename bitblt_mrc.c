@@ -0,0 +1,312 @@
+/*
+ * tumble: build a PDF file from image files
+ *
+ * Mixed raster content background extraction
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.  Note that permission is
+ * not granted to redistribute this program under the terms of any
+ * other version of the General Public License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111 USA
+ */
+
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bitblt.h"
+
+
+#define DIV_ROUND_UP(count,n) (((count) - 1) / (n) + 1)
+
+#define WHITE 255
+
+/* A block of the mask of one word by BITS_PER_WORD rows is taken to be
+   part of a picture if at least PICTURE_PERCENT of it is black, or if it
+   is next to a picture and at least PICTURE_EDGE_PERCENT is.  Text is
+   rarely so dense. */
+#define PICTURE_PERCENT      40
+#define PICTURE_EDGE_PERCENT 10
+
+
+/* The page is split into a bilevel foreground mask, which is drawn in a
+   single ink color, and a background at reduced resolution.  Each
+   background pixel is the average of the pixels of its cell that are
+   away from the ink; the mask is dilated by a pixel so that the
+   anti-aliased edges of the text don't darken the background around
+   it.  Cells that are all ink take the color of their neighbors.
+
+   The ink color is the average of the darker half of the ink pixels,
+   since the lighter ones are mostly the edges of strokes. */
+struct Background
+{
+  Bitmap *mask;
+  Bitmap *near;         /* the mask, dilated */
+  int components;
+  int factor;
+  uint32_t width;       /* of the image */
+  uint32_t height;
+  uint32_t bg_width;
+  uint32_t bg_height;
+
+  uint32_t rows_in;
+  uint32_t *sum;        /* by cell and component, for the current row of cells */
+  uint32_t *count;      /* by cell */
+  uint8_t *samples;     /* bg_width * bg_height * components */
+
+  /* by brightness, the sums of the components of the ink pixels and
+     their count */
+  uint64_t ink_sum [256][3];
+  uint64_t ink_count [256];
+};
+
+
+uint32_t clear_mask_pictures (Bitmap *mask)
+{
+  uint32_t n = mask->row_words;
+  uint32_t height = rect_height (& mask->rect);
+  uint32_t width = rect_width (& mask->rect);
+  uint32_t block_rows = DIV_ROUND_UP (height, BITS_PER_WORD);
+  uint32_t block_count = n * block_rows;
+  uint32_t *count;
+  uint8_t *picture;
+  uint32_t pictures = 0;
+  uint32_t i, j, y;
+  bool changed;
+
+  count = calloc (block_count, sizeof (uint32_t));
+  picture = calloc (block_count, 1);
+  if (! (count && picture))
+    {
+      free (count);
+      free (picture);
+      return 0;
+    }
+
+  for (y = 0; y < height; y++)
+    for (i = 0; i < n; i++)
+      {
+	word_t w = mask->bits [y * n + i];
+
+	if ((i + 1 == n) && (width % BITS_PER_WORD))
+	  w &= (1U << (width % BITS_PER_WORD)) - 1;
+	count [(y / BITS_PER_WORD) * n + i] += __builtin_popcount (w);
+      }
+
+  for (j = 0; j < block_count; j++)
+    picture [j] = (count [j] * 100 >= PICTURE_PERCENT * BITS_PER_WORD * BITS_PER_WORD);
+
+  /* grow the pictures into their less dense edges, sweeping until
+     nothing changes */
+  do
+    {
+      changed = false;
+      for (j = 0; j < block_count; j++)
+	{
+	  uint32_t bx = j % n, by = j / n;
+	  int dx, dy;
+
+	  if (picture [j] ||
+	      (count [j] * 100 < PICTURE_EDGE_PERCENT * BITS_PER_WORD * BITS_PER_WORD))
+	    continue;
+	  for (dy = -1; dy <= 1; dy++)
+	    for (dx = -1; dx <= 1; dx++)
+	      if (((by + dy) < block_rows) && ((bx + dx) < n) &&
+		  picture [(by + dy) * n + bx + dx])
+		{
+		  picture [j] = 1;
+		  changed = true;
+		}
+	}
+    }
+  while (changed);
+
+  for (j = 0; j < block_count; j++)
+    if (picture [j])
+      {
+	uint32_t y0 = (j / n) * BITS_PER_WORD;
+	uint32_t y1 = (y0 + BITS_PER_WORD < height) ? (y0 + BITS_PER_WORD) : height;
+
+	for (y = y0; y < y1; y++)
+	  mask->bits [y * n + j % n] = 0;
+	pictures++;
+      }
+
+  free (count);
+  free (picture);
+  return pictures;
+}
+
+
+Background *create_background (Bitmap *mask, int components, int factor)
+{
+  Background *bg;
+
+  bg = calloc (1, sizeof (Background));
+  if (! bg)
+    return NULL;
+  bg->mask = mask;
+  bg->components = components;
+  bg->factor = factor;
+  bg->width = rect_width (& mask->rect);
+  bg->height = rect_height (& mask->rect);
+  bg->bg_width = DIV_ROUND_UP (bg->width, factor);
+  bg->bg_height = DIV_ROUND_UP (bg->height, factor);
+
+  bg->near = create_bitmap (& mask->rect);
+  bg->sum = calloc (bg->bg_width * components, sizeof (uint32_t));
+  bg->count = calloc (bg->bg_width, sizeof (uint32_t));
+  bg->samples = malloc ((size_t) bg->bg_width * bg->bg_height * components);
+  if (! (bg->near && bg->sum && bg->count && bg->samples))
+    goto fail;
+
+  memcpy (bg->near->bits, mask->bits,
+	  (size_t) bg->height * mask->row_words * sizeof (word_t));
+  if (! dilate_bitmap (bg->near))
+    goto fail;
+  return bg;
+
+ fail:
+  free_background (bg);
+  return NULL;
+}
+
+
+void free_background (Background *bg)
+{
+  if (bg->near)
+    free_bitmap (bg->near);
+  free (bg->sum);
+  free (bg->count);
+  free (bg->samples);
+  free (bg);
+}
+
+
+/* Average the cells of a row of the background, and fill those with no
+   background pixels from the nearest cell to the left, or failing that
+   to the right, or failing that the cell above. */
+static void finish_background_row (Background *bg, uint32_t by)
+{
+  const int c = bg->components;
+  uint8_t *row = bg->samples + (size_t) by * bg->bg_width * c;
+  int32_t last = -1;
+  uint32_t bx;
+  int k;
+
+  for (bx = 0; bx < bg->bg_width; bx++)
+    {
+      if (bg->count [bx])
+	{
+	  for (k = 0; k < c; k++)
+	    row [bx * c + k] = ((bg->sum [bx * c + k] + bg->count [bx] / 2) /
+				bg->count [bx]);
+	  if (last < 0)
+	    {
+	      /* the empty cells at the start of the row */
+	      uint32_t i;
+
+	      for (i = 0; i < bx; i++)
+		memcpy (row + i * c, row + bx * c, c);
+	    }
+	  last = bx;
+	}
+      else if (last >= 0)
+	memcpy (row + bx * c, row + last * c, c);
+    }
+
+  if (last < 0)
+    {
+      if (by)
+	memcpy (row, row - bg->bg_width * c, bg->bg_width * c);
+      else
+	memset (row, WHITE, bg->bg_width * c);
+    }
+
+  memset (bg->sum, 0, bg->bg_width * c * sizeof (uint32_t));
+  memset (bg->count, 0, bg->bg_width * sizeof (uint32_t));
+}
+
+
+void background_rows (Background *bg, uint8_t *samples, int32_t row_count)
+{
+  const int c = bg->components;
+  const uint32_t n = bg->mask->row_words;
+
+  for (; (row_count > 0) && (bg->rows_in < bg->height); row_count--)
+    {
+      const word_t *mask = bg->mask->bits + bg->rows_in * n;
+      const word_t *near = bg->near->bits + bg->rows_in * n;
+      uint32_t x;
+
+      for (x = 0; x < bg->width; x++)
+	{
+	  const uint8_t *s = samples + x * c;
+	  word_t bit = 1U << (x % BITS_PER_WORD);
+	  int k;
+
+	  if (! (near [x / BITS_PER_WORD] & bit))
+	    {
+	      uint32_t *sum = bg->sum + (x / bg->factor) * c;
+
+	      for (k = 0; k < c; k++)
+		sum [k] += s [k];
+	      bg->count [x / bg->factor]++;
+	    }
+	  else if (mask [x / BITS_PER_WORD] & bit)
+	    {
+	      int level = (c == 1) ? s [0] : ((77 * s [0] + 150 * s [1] + 29 * s [2] + 128) >> 8);
+
+	      for (k = 0; k < c; k++)
+		bg->ink_sum [level][k] += s [k];
+	      bg->ink_count [level]++;
+	    }
+	}
+
+      samples += bg->width * c;
+      bg->rows_in++;
+      if ((bg->rows_in % bg->factor == 0) || (bg->rows_in == bg->height))
+	finish_background_row (bg, (bg->rows_in - 1) / bg->factor);
+    }
+}
+
+
+uint8_t *background_samples (Background *bg, uint32_t *width, uint32_t *height)
+{
+  *width = bg->bg_width;
+  *height = bg->bg_height;
+  return bg->samples;
+}
+
+
+void foreground_color (Background *bg, uint8_t *color)
+{
+  uint64_t total = 0, count = 0;
+  uint64_t sum [3] = { 0, 0, 0 };
+  int level, k;
+
+  for (level = 0; level < 256; level++)
+    total += bg->ink_count [level];
+
+  for (level = 0; (level < 256) && (2 * count < total); level++)
+    {
+      for (k = 0; k < bg->components; k++)
+	sum [k] += bg->ink_sum [level][k];
+      count += bg->ink_count [level];
+    }
+
+  for (k = 0; k < bg->components; k++)
+    color [k] = count ? ((sum [k] + count / 2) / count) : 0;
+}
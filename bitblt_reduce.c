@@ -0,0 +1,239 @@
+/*
+ * tumble: build a PDF file from image files
+ *
+ * Bilevel downsampling
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.  Note that permission is
+ * not granted to redistribute this program under the terms of any
+ * other version of the General Public License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111 USA
+ */
+
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bitblt.h"
+
+
+#define SWAP(type,a,b) do { type temp; temp = a; a = b; b = temp; } while (0)
+
+#define DIV_ROUND_UP(count,pow2) (((count) - 1) / (pow2) + 1)
+
+#define EVEN_BITS 0x55555555U
+
+
+/* Both reductions assume pixel x of a row is bit x % 32 of word x / 32,
+   as set_pixel () does.  Pixels past the edges of the source are
+   white. */
+
+
+/* gather the even numbered bits into the low half of the word */
+static inline word_t compact_even_bits (word_t x)
+{
+  x = (x | (x >> 1)) & 0x33333333U;
+  x = (x | (x >> 2)) & 0x0f0f0f0fU;
+  x = (x | (x >> 4)) & 0x00ff00ffU;
+  x = (x | (x >> 8)) & 0x0000ffffU;
+  return x;
+}
+
+
+/* 2x2 cells are reduced a word at a time: the four pixels of each cell
+   are in the same bit position of p, q, r, and s, and the rank test is
+   done with logic operations on all 16 cells of a source word at once. */
+static void reduce_2x_row (word_t *restrict dest,
+			   const word_t *restrict row0,
+			   const word_t *restrict row1,
+			   uint32_t dest_words,
+			   uint32_t src_words,
+			   int level)
+{
+  uint32_t i;
+
+  for (i = 0; i < dest_words; i++)
+    {
+      word_t half [2];
+      int h;
+
+      for (h = 0; h < 2; h++)
+	{
+	  uint32_t j = 2 * i + h;
+	  word_t a = (j < src_words) ? row0 [j] : 0;
+	  word_t b = (j < src_words) ? row1 [j] : 0;
+	  word_t p = a & EVEN_BITS;
+	  word_t q = (a >> 1) & EVEN_BITS;
+	  word_t r = b & EVEN_BITS;
+	  word_t s = (b >> 1) & EVEN_BITS;
+	  word_t x;
+
+	  switch (level)
+	    {
+	    case 1:  x = p | q | r | s; break;
+	    case 2:  x = (p & q) | (r & s) | ((p | q) & (r | s)); break;
+	    case 3:  x = (p & q & (r | s)) | (r & s & (p | q)); break;
+	    default: x = p & q & r & s; break;
+	    }
+	  half [h] = compact_even_bits (x);
+	}
+      dest [i] = half [0] | (half [1] << 16);
+    }
+}
+
+
+/* 4x4 cells are reduced a byte of each row at a time.  The entry of
+   the byte pair table for the bytes of two rows counts the black pixels
+   in each of the two cells they span: the low nibbles in the low byte,
+   the high nibbles in the high byte.  Adding the entries for two pairs
+   of rows gives the counts for two 4x4 cells. */
+static uint16_t reduce_4x_table [1 << 16];
+static bool reduce_4x_table_ready;
+
+static void init_reduce_4x_table (void)
+{
+  uint32_t i;
+
+  for (i = 0; i < (1 << 16); i++)
+    {
+      uint32_t lo = ((i & 0x0f) | ((i >> 4) & 0xf0));
+      uint32_t hi = (((i >> 4) & 0x0f) | ((i >> 8) & 0xf0));
+      int lo_count = 0, hi_count = 0;
+      int b;
+
+      for (b = 0; b < 8; b++)
+	{
+	  lo_count += (lo >> b) & 1;
+	  hi_count += (hi >> b) & 1;
+	}
+      reduce_4x_table [i] = lo_count | (hi_count << 8);
+    }
+  reduce_4x_table_ready = true;
+}
+
+static void reduce_4x_row (word_t *restrict dest,
+			   const word_t **rows,
+			   uint32_t dest_words,
+			   uint32_t src_words,
+			   int level)
+{
+  uint32_t i, j;
+  int k;
+
+  for (i = 0; i < dest_words; i++)
+    {
+      word_t x = 0;
+
+      for (j = 4 * i; (j < 4 * i + 4) && (j < src_words); j++)
+	{
+	  word_t a = rows [0][j], b = rows [1][j];
+	  word_t c = rows [2][j], d = rows [3][j];
+
+	  for (k = 0; k < 4; k++)
+	    {
+	      int shift = 8 * k;
+	      uint16_t count = (reduce_4x_table [((a >> shift) & 0xff) |
+						 (((b >> shift) & 0xff) << 8)] +
+				reduce_4x_table [((c >> shift) & 0xff) |
+						 (((d >> shift) & 0xff) << 8)]);
+	      word_t bits = (((count & 0xff) >= level) |
+			     (((count >> 8) >= level) << 1));
+
+	      x |= bits << (2 * (4 * (j - 4 * i) + k));
+	    }
+	}
+      dest [i] = x;
+    }
+}
+
+
+Bitmap *reduced_bitmap (Bitmap *src, int factor, int level)
+{
+  Rect rect;
+  Bitmap *dest;
+  word_t *white;
+  uint32_t src_width = rect_width (& src->rect);
+  uint32_t src_height = rect_height (& src->rect);
+  uint32_t y;
+
+  if ((factor != 2) && (factor != 4))
+    {
+      fprintf (stderr, "downsampling factor %d, but must be 2 or 4\n", factor);
+      return NULL;
+    }
+  if (level == 0)
+    level = (factor * factor) / 2;  /* majority, ties are black */
+  if ((level < 1) || (level > factor * factor))
+    {
+      fprintf (stderr, "downsampling level %d, but must be 1 to %d\n", level, factor * factor);
+      return NULL;
+    }
+
+  rect.min.x = src->rect.min.x / factor;
+  rect.min.y = src->rect.min.y / factor;
+  rect.max.x = rect.min.x + DIV_ROUND_UP (src_width, factor);
+  rect.max.y = rect.min.y + DIV_ROUND_UP (src_height, factor);
+  dest = create_bitmap (& rect);
+  white = calloc (src->row_words, sizeof (word_t));
+  if (! (dest && white))
+    {
+      fprintf (stderr, "can't allocate bitmap\n");
+      if (dest)
+	free_bitmap (dest);
+      free (white);
+      return NULL;
+    }
+
+  if ((factor == 4) && ! reduce_4x_table_ready)
+    init_reduce_4x_table ();
+
+  /* the padding of the source has no meaning, so it can be cleared in
+     place */
+  if (src_width % BITS_PER_WORD)
+    for (y = 0; y < src_height; y++)
+      src->bits [(y + 1) * src->row_words - 1] &= (1U << (src_width % BITS_PER_WORD)) - 1;
+
+  for (y = 0; y < (uint32_t) rect_height (& rect); y++)
+    {
+      const word_t *rows [4];
+      int k;
+
+      for (k = 0; k < factor; k++)
+	rows [k] = ((factor * y + k) < src_height) ?
+	  (src->bits + (factor * y + k) * src->row_words) : white;
+
+      if (factor == 2)
+	reduce_2x_row (dest->bits + y * dest->row_words, rows [0], rows [1],
+		       dest->row_words, src->row_words, level);
+      else
+	reduce_4x_row (dest->bits + y * dest->row_words, rows,
+		       dest->row_words, src->row_words, level);
+    }
+
+  free (white);
+  return dest;
+}
+
+
+bool reduce_bitmap (Bitmap *src, int factor, int level)
+{
+  Bitmap *dest = reduced_bitmap (src, factor, level);
+
+  if (! dest)
+    return false;
+  SWAP (Bitmap, *src, *dest);
+  free_bitmap (dest);
+  return true;
+}
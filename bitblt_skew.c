@@ -0,0 +1,316 @@
+/*
+ * tumble: build a PDF file from image files
+ *
+ * Skew detection and correction
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.  Note that permission is
+ * not granted to redistribute this program under the terms of any
+ * other version of the General Public License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111 USA
+ */
+
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "bitblt.h"
+
+
+#define DEGREES_PER_RADIAN (180.0 / M_PI)
+
+/* Skew is measured on a copy reduced 4x, in which a pixel is black if
+   any of its cell is, over +/- MAX_SKEW_DEGREES in SKEW_STEPS steps
+   each way. */
+#define SKEW_REDUCTION 4
+#define MAX_SKEW_DEGREES 5.0
+#define SKEW_STEPS 100
+#define SKEW_STEP_DEGREES (MAX_SKEW_DEGREES / SKEW_STEPS)
+
+/* Too little ink, or too flat a peak, gives no usable estimate. */
+#define MIN_SKEW_PIXELS 1000
+#define MIN_SKEW_PEAK_RATIO 1.02
+
+/* smaller angles are left alone */
+#define MIN_DESKEW_DEGREES 0.05
+
+
+static inline word_t last_word_mask (uint32_t width)
+{
+  return (width % BITS_PER_WORD) ? ((1U << (width % BITS_PER_WORD)) - 1) : ~ 0U;
+}
+
+
+/* The profile is built from the black pixel counts of each word of the
+   reduced image, so each 32 pixel wide strip is moved up or down as a
+   whole.  Each strip is moved by its slope offset, and the sum of the
+   squares of the row totals, which grows with their variance, is
+   largest when text lines fall into as few rows as possible. */
+static double profile_score (const uint16_t *counts,  /* by word column */
+			     uint32_t n,
+			     uint32_t height,
+			     double slope,
+			     uint32_t *profile,
+			     int32_t max_offset)
+{
+  uint32_t profile_rows = height + 2 * max_offset;
+  double score = 0.0;
+  uint32_t j, y;
+
+  memset (profile, 0, profile_rows * sizeof (uint32_t));
+  for (j = 0; j < n; j++)
+    {
+      int32_t offset = lround (slope * (BITS_PER_WORD * j + BITS_PER_WORD / 2));
+      uint32_t *restrict p = profile + max_offset - offset;
+      const uint16_t *restrict c = counts + j * height;
+
+      for (y = 0; y < height; y++)
+	p [y] += c [y];
+    }
+  for (y = 0; y < profile_rows; y++)
+    score += (double) profile [y] * profile [y];
+  return score;
+}
+
+
+double find_skew (Bitmap *bitmap)
+{
+  Bitmap *small;
+  uint16_t *counts = NULL;
+  uint32_t *profile = NULL;
+  double scores [2 * SKEW_STEPS + 1];
+  uint32_t n, height, j, y;
+  uint64_t total = 0;
+  int32_t max_offset;
+  double angle = 0.0;
+  double min_score;
+  int k, best;
+
+  small = reduced_bitmap (bitmap, SKEW_REDUCTION, 1);
+  if (! small)
+    return 0.0;
+  n = small->row_words;
+  height = rect_height (& small->rect);
+
+  max_offset = ceil (tan (MAX_SKEW_DEGREES / DEGREES_PER_RADIAN) * n * BITS_PER_WORD) + 1;
+  counts = malloc (n * height * sizeof (uint16_t));
+  profile = malloc ((height + 2 * max_offset) * sizeof (uint32_t));
+  if (! (counts && profile))
+    goto done;
+
+  for (y = 0; y < height; y++)
+    for (j = 0; j < n; j++)
+      {
+	counts [j * height + y] = __builtin_popcount (small->bits [y * n + j]);
+	total += counts [j * height + y];
+      }
+  if (total < MIN_SKEW_PIXELS)
+    goto done;
+
+  best = 0;
+  min_score = HUGE_VAL;
+  for (k = 0; k <= 2 * SKEW_STEPS; k++)
+    {
+      double slope = tan ((k - SKEW_STEPS) * SKEW_STEP_DEGREES / DEGREES_PER_RADIAN);
+
+      scores [k] = profile_score (counts, n, height, slope, profile, max_offset);
+      if (scores [k] > scores [best])
+	best = k;
+      if (scores [k] < min_score)
+	min_score = scores [k];
+    }
+  if (scores [best] < min_score * MIN_SKEW_PEAK_RATIO)
+    goto done;
+
+  angle = (best - SKEW_STEPS) * SKEW_STEP_DEGREES;
+
+  /* interpolate the peak with a parabola through its neighbors */
+  if ((best > 0) && (best < 2 * SKEW_STEPS))
+    {
+      double denominator = scores [best - 1] - 2 * scores [best] + scores [best + 1];
+
+      if (denominator < 0.0)
+	angle += (0.5 * (scores [best - 1] - scores [best + 1]) / denominator) * SKEW_STEP_DEGREES;
+    }
+
+ done:
+  free (profile);
+  free (counts);
+  free_bitmap (small);
+  return angle;
+}
+
+
+/* dest pixel x is src pixel x - shift */
+static void shift_row (word_t *restrict dest,
+		       const word_t *restrict src,
+		       uint32_t n,
+		       int32_t shift)
+{
+  int32_t words = ((shift >= 0) ? shift : - shift) / BITS_PER_WORD;
+  int bits = ((shift >= 0) ? shift : - shift) % BITS_PER_WORD;
+  int32_t i;
+
+  for (i = 0; i < (int32_t) n; i++)
+    {
+      int32_t s = (shift >= 0) ? (i - words) : (i + words);
+      word_t near = ((s >= 0) && (s < (int32_t) n)) ? src [s] : 0;
+      word_t far;
+
+      if (! bits)
+	{
+	  dest [i] = near;
+	  continue;
+	}
+      if (shift >= 0)
+	{
+	  far = ((s - 1 >= 0) && (s - 1 < (int32_t) n)) ? src [s - 1] : 0;
+	  dest [i] = (near << bits) | (far >> (BITS_PER_WORD - bits));
+	}
+      else
+	{
+	  far = ((s + 1 >= 0) && (s + 1 < (int32_t) n)) ? src [s + 1] : 0;
+	  dest [i] = (near >> bits) | (far << (BITS_PER_WORD - bits));
+	}
+    }
+}
+
+
+/* row y moves right by factor * (y - center) */
+static bool shear_rows (Bitmap *bitmap, double factor, double center)
+{
+  uint32_t n = bitmap->row_words;
+  uint32_t width = rect_width (& bitmap->rect);
+  uint32_t height = rect_height (& bitmap->rect);
+  word_t mask = last_word_mask (width);
+  word_t *row;
+  uint32_t y;
+
+  row = malloc (n * sizeof (word_t));
+  if (! row)
+    {
+      fprintf (stderr, "can't allocate row buffer\n");
+      return false;
+    }
+  for (y = 0; y < height; y++)
+    {
+      word_t *dest = bitmap->bits + y * n;
+      int32_t shift = lround (factor * (y - center));
+
+      if (! shift)
+	continue;
+      memcpy (row, dest, n * sizeof (word_t));
+      shift_row (dest, row, n, shift);
+      dest [n - 1] &= mask;
+    }
+  free (row);
+  return true;
+}
+
+
+/* Column x moves down by factor * (x - center).  The columns of a word
+   fall into a few runs with the same offset, and each run is moved as a
+   masked word. */
+static bool shear_columns (Bitmap *bitmap, double factor, double center)
+{
+  uint32_t n = bitmap->row_words;
+  uint32_t width = rect_width (& bitmap->rect);
+  int32_t height = rect_height (& bitmap->rect);
+  word_t *column;
+  uint32_t j;
+  int32_t y;
+
+  column = malloc (height * sizeof (word_t));
+  if (! column)
+    {
+      fprintf (stderr, "can't allocate column buffer\n");
+      return false;
+    }
+  for (j = 0; j < n; j++)
+    {
+      word_t run_mask [BITS_PER_WORD];
+      int32_t run_offset [BITS_PER_WORD];
+      int runs = 0;
+      int b;
+
+      for (b = 0; (b < BITS_PER_WORD) && (j * BITS_PER_WORD + b < width); b++)
+	{
+	  int32_t offset = lround (factor * (j * BITS_PER_WORD + b - center));
+
+	  if ((! runs) || (offset != run_offset [runs - 1]))
+	    {
+	      run_offset [runs] = offset;
+	      run_mask [runs++] = 0;
+	    }
+	  run_mask [runs - 1] |= 1U << b;
+	}
+      if ((runs == 1) && (run_offset [0] == 0))
+	continue;
+
+      for (y = 0; y < height; y++)
+	column [y] = bitmap->bits [y * n + j];
+      for (y = 0; y < height; y++)
+	{
+	  word_t w = 0;
+	  int r;
+
+	  for (r = 0; r < runs; r++)
+	    {
+	      int32_t s = y - run_offset [r];
+
+	      if ((s >= 0) && (s < height))
+		w |= column [s] & run_mask [r];
+	    }
+	  bitmap->bits [y * n + j] = w;
+	}
+    }
+  free (column);
+  return true;
+}
+
+
+/* A rotation is the product of three shears,
+     [1 -tan(a/2)] [  1    0] [1 -tan(a/2)]
+     [0     1    ] [sin(a) 1] [0     1    ]
+   each of which moves whole rows or columns, so no pixel is resampled.
+   The rotation is about the center, and the size is unchanged; corners
+   that come from outside the bitmap are white. */
+bool shear_rotate_bitmap (Bitmap *bitmap, double degrees)
+{
+  double radians = degrees / DEGREES_PER_RADIAN;
+  double a = - tan (radians / 2);
+  double b = sin (radians);
+  double cx = (rect_width (& bitmap->rect) - 1) / 2.0;
+  double cy = (rect_height (& bitmap->rect) - 1) / 2.0;
+  uint32_t y;
+
+  /* shifted pixels mustn't come from the padding */
+  for (y = 0; y < (uint32_t) rect_height (& bitmap->rect); y++)
+    bitmap->bits [(y + 1) * bitmap->row_words - 1] &= last_word_mask (rect_width (& bitmap->rect));
+
+  return (shear_rows (bitmap, a, cy) &&
+	  shear_columns (bitmap, b, cx) &&
+	  shear_rows (bitmap, a, cy));
+}
+
+
+bool deskew_bitmap (Bitmap *bitmap, double *skew)
+{
+  *skew = find_skew (bitmap);
+  if (fabs (*skew) < MIN_DESKEW_DEGREES)
+    return true;
+  return shear_rotate_bitmap (bitmap, - *skew);
+}
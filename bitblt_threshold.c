@@ -0,0 +1,309 @@
+/*
+ * tumble: build a PDF file from image files
+ *
+ * Grayscale to bilevel conversion
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.  Note that permission is
+ * not granted to redistribute this program under the terms of any
+ * other version of the General Public License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111 USA
+ */
+
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bitblt.h"
+
+
+/* Sauvola's threshold is mean * (1 + k * (stddev / R - 1)).  Where the
+   local standard deviation is below MIN_CONTRAST the window is taken to
+   be all background or all ink, and the global level is used instead;
+   otherwise large dark areas would be hollowed out. */
+#define SAUVOLA_K 0.34f
+#define SAUVOLA_R 128.0f
+#define MIN_CONTRAST 16.0f
+
+
+struct Thresholder
+{
+  Bitmap *bitmap;
+  int32_t width;
+  int32_t height;
+  int level;
+  int32_t radius;       /* zero for a global threshold */
+
+  int32_t rows_in;      /* rows supplied so far */
+  int32_t rows_out;     /* bitmap rows written so far */
+
+  /* adaptive only: the last 2 * radius + 2 gray rows, and the sums of
+     the samples and their squares in each column over the rows of the
+     current window */
+  int32_t ring_rows;
+  uint8_t *ring;
+  int32_t window_first; /* first row included in the column sums */
+  uint32_t *col_sum;
+  uint32_t *col_sq;
+
+  /* adaptive only: the integral of the column sums along the row */
+  uint32_t *row_sum;
+  uint64_t *row_sq;
+
+  uint8_t *black;       /* one byte per pixel, padded to whole words */
+};
+
+
+void gray_histogram (uint32_t *histogram, uint8_t *samples, uint32_t count)
+{
+  uint32_t i;
+
+  for (i = 0; i < count; i++)
+    histogram [samples [i]]++;
+}
+
+
+/* Otsu's method: the level that maximizes the between-class variance */
+int otsu_threshold (uint32_t *histogram)
+{
+  double total = 0.0, total_sum = 0.0;
+  double below = 0.0, below_sum = 0.0;
+  double best = -1.0;
+  int level = 128;
+  int i;
+
+  for (i = 0; i < 256; i++)
+    {
+      total += histogram [i];
+      total_sum += (double) i * histogram [i];
+    }
+
+  for (i = 0; i < 255; i++)
+    {
+      double above, mean_below, mean_above, variance;
+
+      below += histogram [i];
+      below_sum += (double) i * histogram [i];
+      above = total - below;
+      if ((below == 0.0) || (above == 0.0))
+	continue;
+      mean_below = below_sum / below;
+      mean_above = (total_sum - below_sum) / above;
+      variance = below * above * (mean_below - mean_above) * (mean_below - mean_above);
+      if (variance > best)
+	{
+	  best = variance;
+	  level = i + 1;  /* samples below level are black */
+	}
+    }
+  return level;
+}
+
+
+Thresholder *create_thresholder (Bitmap *bitmap, int level, int radius)
+{
+  Thresholder *t;
+  int32_t padded_width;
+
+  t = calloc (1, sizeof (Thresholder));
+  if (! t)
+    return NULL;
+  t->bitmap = bitmap;
+  t->width = rect_width (& bitmap->rect);
+  t->height = rect_height (& bitmap->rect);
+  t->level = level;
+  t->radius = radius;
+
+  padded_width = bitmap->row_words * BITS_PER_WORD;
+  t->black = calloc (padded_width, 1);
+  if (! t->black)
+    goto fail;
+
+  if (radius)
+    {
+      t->ring_rows = 2 * radius + 2;
+      t->ring = malloc ((size_t) t->ring_rows * t->width);
+      t->col_sum = calloc (t->width, sizeof (uint32_t));
+      t->col_sq = calloc (t->width, sizeof (uint32_t));
+      t->row_sum = malloc ((t->width + 1) * sizeof (uint32_t));
+      t->row_sq = malloc ((t->width + 1) * sizeof (uint64_t));
+      if (! (t->ring && t->col_sum && t->col_sq && t->row_sum && t->row_sq))
+	goto fail;
+    }
+  return t;
+
+ fail:
+  free_thresholder (t);
+  return NULL;
+}
+
+
+void free_thresholder (Thresholder *t)
+{
+  free (t->ring);
+  free (t->col_sum);
+  free (t->col_sq);
+  free (t->row_sum);
+  free (t->row_sq);
+  free (t->black);
+  free (t);
+}
+
+
+/* pack the black flags into the next row of the bitmap */
+static void write_bitmap_row (Thresholder *t)
+{
+  word_t *dest = t->bitmap->bits + t->rows_out * t->bitmap->row_words;
+  uint8_t *src = t->black;
+  uint32_t i;
+  int b;
+
+  for (i = 0; i < t->bitmap->row_words; i++)
+    {
+      word_t w = 0;
+
+      for (b = 0; b < BITS_PER_WORD; b++)
+#if defined (MIXED_ENDIAN)
+	w |= (word_t) src [b] << ((b & 24) + 7 - (b & 7));
+#elif defined (LSB_RIGHT)
+	w |= (word_t) src [b] << ((BITS_PER_WORD - 1) - b);
+#else
+	w |= (word_t) src [b] << b;
+#endif
+      dest [i] = w;
+      src += BITS_PER_WORD;
+    }
+  t->rows_out++;
+}
+
+
+static void threshold_global_row (Thresholder *t, const uint8_t *restrict gray)
+{
+  uint8_t *restrict black = t->black;
+  const int level = t->level;
+  int32_t x;
+
+  for (x = 0; x < t->width; x++)
+    black [x] = gray [x] < level;
+  write_bitmap_row (t);
+}
+
+
+static void add_window_row (Thresholder *t, const uint8_t *restrict gray, int sign)
+{
+  uint32_t *restrict col_sum = t->col_sum;
+  uint32_t *restrict col_sq = t->col_sq;
+  int32_t x;
+
+  if (sign > 0)
+    for (x = 0; x < t->width; x++)
+      {
+	col_sum [x] += gray [x];
+	col_sq [x] += gray [x] * gray [x];
+      }
+  else
+    for (x = 0; x < t->width; x++)
+      {
+	col_sum [x] -= gray [x];
+	col_sq [x] -= gray [x] * gray [x];
+      }
+}
+
+
+static inline uint8_t *ring_row (Thresholder *t, int32_t row)
+{
+  return t->ring + (size_t) (row % t->ring_rows) * t->width;
+}
+
+
+/* Threshold the next row, once all the rows of its window are in the
+   column sums.  The window is clipped to the image. */
+static void threshold_adaptive_row (Thresholder *t)
+{
+  const int32_t y = t->rows_out;
+  const int32_t r = t->radius;
+  const int32_t w = t->width;
+  const uint8_t *restrict gray;
+  uint8_t *restrict black = t->black;
+  uint32_t *restrict row_sum = t->row_sum;
+  uint64_t *restrict row_sq = t->row_sq;
+  const float level = t->level;
+  const float min_variance = MIN_CONTRAST * MIN_CONTRAST;
+  const float c = (SAUVOLA_K / SAUVOLA_R) * (SAUVOLA_K / SAUVOLA_R);
+  int32_t window_rows;
+  int32_t x;
+
+  while (t->window_first < y - r)
+    add_window_row (t, ring_row (t, t->window_first++), -1);
+  window_rows = t->rows_in - t->window_first;
+
+  row_sum [0] = 0;
+  row_sq [0] = 0;
+  for (x = 0; x < w; x++)
+    {
+      row_sum [x + 1] = row_sum [x] + t->col_sum [x];
+      row_sq [x + 1] = row_sq [x] + t->col_sq [x];
+    }
+
+  gray = ring_row (t, y);
+  for (x = 0; x < w; x++)
+    {
+      int32_t x0 = (x > r) ? (x - r) : 0;
+      int32_t x1 = (x + r + 1 < w) ? (x + r + 1) : w;
+      float inv_n = 1.0f / (float) ((x1 - x0) * window_rows);
+      float mean = (row_sum [x1] - row_sum [x0]) * inv_n;
+      float variance = (row_sq [x1] - row_sq [x0]) * inv_n - mean * mean;
+      float g = gray [x];
+      float d = g - mean * (1.0f - SAUVOLA_K);
+      bool local = (d < 0.0f) || (d * d < c * mean * mean * variance);
+
+      /* g < mean * (1 + k * (sqrt (variance) / R - 1)), without the sqrt */
+      black [x] = (variance < min_variance) ? (g < level) : local;
+    }
+  write_bitmap_row (t);
+}
+
+
+void threshold_rows (Thresholder *t, uint8_t *gray, int32_t row_count)
+{
+  if (row_count > t->height - t->rows_in)
+    row_count = t->height - t->rows_in;
+
+  if (! t->radius)
+    {
+      for (; row_count > 0; row_count--)
+	{
+	  threshold_global_row (t, gray);
+	  gray += t->width;
+	  t->rows_in++;
+	}
+      return;
+    }
+
+  for (; row_count > 0; row_count--)
+    {
+      memcpy (ring_row (t, t->rows_in), gray, t->width);
+      add_window_row (t, gray, 1);
+      gray += t->width;
+      t->rows_in++;
+      if (t->rows_in - t->rows_out > t->radius)
+	threshold_adaptive_row (t);
+    }
+
+  /* the windows of the last rows extend past the bottom of the image */
+  if (t->rows_in == t->height)
+    while (t->rows_out < t->height)
+      threshold_adaptive_row (t);
+}
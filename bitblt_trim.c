@@ -0,0 +1,246 @@
+/*
+ * tumble: build a PDF file from image files
+ *
+ * Border trimming
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.  Note that permission is
+ * not granted to redistribute this program under the terms of any
+ * other version of the General Public License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111 USA
+ */
+
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bitblt.h"
+
+
+/* A row or column at the edge is part of a border if at least this
+   fraction of its pixels, within the other borders, are black.  Text
+   and line art rarely come near it. */
+#define BORDER_NUMERATOR   1
+#define BORDER_DENOMINATOR 2
+
+
+static inline word_t last_word_mask (uint32_t width)
+{
+  return (width % BITS_PER_WORD) ? ((1U << (width % BITS_PER_WORD)) - 1) : ~ 0U;
+}
+
+static inline bool is_border (uint32_t black, uint32_t total)
+{
+  return black * BORDER_DENOMINATOR >= total * BORDER_NUMERATOR;
+}
+
+
+/* black pixels of row y from column x0 to x1 - 1 */
+static uint32_t row_count (Bitmap *bitmap, uint32_t y, uint32_t x0, uint32_t x1)
+{
+  const word_t *row = bitmap->bits + y * bitmap->row_words;
+  uint32_t i0 = x0 / BITS_PER_WORD, i1 = (x1 - 1) / BITS_PER_WORD;
+  uint32_t count = 0;
+  uint32_t i;
+
+  for (i = i0; i <= i1; i++)
+    {
+      word_t w = row [i];
+
+      if (i == i0)
+	w &= ~ 0U << (x0 % BITS_PER_WORD);
+      if (i == i1)
+	w &= last_word_mask (x1);
+      count += __builtin_popcount (w);
+    }
+  return count;
+}
+
+
+/* Black pixels of each 32 pixel band of columns, over rows y0 to
+   y1 - 1. */
+static void band_counts (Bitmap *bitmap, uint32_t y0, uint32_t y1, uint32_t *counts)
+{
+  uint32_t n = bitmap->row_words;
+  uint32_t i, y;
+
+  memset (counts, 0, n * sizeof (uint32_t));
+  for (y = y0; y < y1; y++)
+    {
+      const word_t *row = bitmap->bits + y * n;
+
+      for (i = 0; i < n; i++)
+	counts [i] += __builtin_popcount (row [i]);
+    }
+}
+
+
+/* black pixels of column x over rows y0 to y1 - 1 */
+static uint32_t column_count (Bitmap *bitmap, uint32_t x, uint32_t y0, uint32_t y1)
+{
+  const word_t *p = bitmap->bits + y0 * bitmap->row_words + x / BITS_PER_WORD;
+  uint32_t count = 0;
+  uint32_t y;
+
+  for (y = y0; y < y1; y++, p += bitmap->row_words)
+    count += (*p >> (x % BITS_PER_WORD)) & 1;
+  return count;
+}
+
+
+/* Find the border columns a band at a time, then find the edge a
+   column at a time within the last border band and the first one that
+   isn't.  Returns the content columns as [*x0, *x1). */
+static void find_column_bounds (Bitmap *bitmap,
+				uint32_t *counts,
+				uint32_t y0,
+				uint32_t y1,
+				uint32_t *x0,
+				uint32_t *x1)
+{
+  uint32_t width = rect_width (& bitmap->rect);
+  uint32_t n = bitmap->row_words;
+  uint32_t rows = y1 - y0;
+  uint32_t left, right;
+  uint32_t i;
+
+  band_counts (bitmap, y0, y1, counts);
+
+  /* whole bands; the last one may be narrower */
+  for (i = 0; i < n; i++)
+    {
+      uint32_t band_width = (i + 1 < n) ? BITS_PER_WORD : (width - i * BITS_PER_WORD);
+
+      if (! is_border (counts [i], band_width * rows))
+	break;
+    }
+  left = i ? ((i - 1) * BITS_PER_WORD) : 0;
+  while ((left < width) && is_border (column_count (bitmap, left, y0, y1), rows))
+    left++;
+
+  for (i = n; i > 0; i--)
+    {
+      uint32_t band_width = (i < n) ? BITS_PER_WORD : (width - (i - 1) * BITS_PER_WORD);
+
+      if ((i - 1) * BITS_PER_WORD < left)
+	break;
+      if (! is_border (counts [i - 1], band_width * rows))
+	break;
+    }
+  right = (i + 1 < n) ? ((i + 1) * BITS_PER_WORD) : width;
+  while ((right > left) && is_border (column_count (bitmap, right - 1, y0, y1), rows))
+    right--;
+
+  *x0 = left;
+  *x1 = right;
+}
+
+
+bool find_content_rect (Bitmap *bitmap, Rect *content)
+{
+  uint32_t width = rect_width (& bitmap->rect);
+  uint32_t height = rect_height (& bitmap->rect);
+  uint32_t *counts;
+  uint32_t x0 = 0, x1 = width, y0 = 0, y1 = height;
+  int pass;
+
+  counts = malloc (bitmap->row_words * sizeof (uint32_t));
+  if (! counts)
+    {
+      fprintf (stderr, "can't allocate column counts\n");
+      return false;
+    }
+
+  /* A side border makes every row partly black, and a top or bottom
+     border every column, so each direction is measured within the
+     other's bounds, and the rows are measured again once the columns
+     are known.  Side borders covering half the page, which make every row
+     look like border, are found by measuring the columns first. */
+  for (pass = 0; pass < 2; pass++)
+    {
+      y0 = 0;
+      y1 = height;
+      while ((y0 < y1) && is_border (row_count (bitmap, y0, x0, x1), x1 - x0))
+	y0++;
+      while ((y1 > y0) && is_border (row_count (bitmap, y1 - 1, x0, x1), x1 - x0))
+	y1--;
+      if (pass)
+	break;
+      if (y1 <= y0)
+	{
+	  y0 = 0;
+	  y1 = height;
+	}
+      find_column_bounds (bitmap, counts, y0, y1, & x0, & x1);
+      if (x1 <= x0)
+	break;
+    }
+  free (counts);
+
+  if ((x1 <= x0) || (y1 <= y0))
+    {
+      /* all border, or all black; leave it alone */
+      x0 = y0 = 0;
+      x1 = width;
+      y1 = height;
+    }
+
+  content->min.x = bitmap->rect.min.x + x0;
+  content->min.y = bitmap->rect.min.y + y0;
+  content->max.x = bitmap->rect.min.x + x1;
+  content->max.y = bitmap->rect.min.y + y1;
+  return true;
+}
+
+
+void whiten_outside_rect (Bitmap *bitmap, Rect *content)
+{
+  uint32_t n = bitmap->row_words;
+  uint32_t height = rect_height (& bitmap->rect);
+  uint32_t x0 = content->min.x - bitmap->rect.min.x;
+  uint32_t x1 = content->max.x - bitmap->rect.min.x;
+  uint32_t y0 = content->min.y - bitmap->rect.min.y;
+  uint32_t y1 = content->max.y - bitmap->rect.min.y;
+  uint32_t i0 = x0 / BITS_PER_WORD, i1 = x1 / BITS_PER_WORD;
+  uint32_t y;
+
+  memset (bitmap->bits, 0, y0 * n * sizeof (word_t));
+  memset (bitmap->bits + y1 * n, 0, (height - y1) * n * sizeof (word_t));
+
+  if ((x0 == 0) && (x1 == (uint32_t) rect_width (& bitmap->rect)))
+    return;
+
+  for (y = y0; y < y1; y++)
+    {
+      word_t *row = bitmap->bits + y * n;
+
+      memset (row, 0, i0 * sizeof (word_t));
+      row [i0] &= ~ 0U << (x0 % BITS_PER_WORD);
+      if (i1 < n)
+	{
+	  row [i1] &= (1U << (x1 % BITS_PER_WORD)) - 1;
+	  memset (row + i1 + 1, 0, (n - i1 - 1) * sizeof (word_t));
+	}
+    }
+}
+
+
+bool trim_borders (Bitmap *bitmap, Rect *content)
+{
+  if (! find_content_rect (bitmap, content))
+    return false;
+  whiten_outside_rect (bitmap, content);
+  return true;
+}
@@ -67,13 +67,28 @@
 %token IMAGES
 %token IMAGEMASK
 %token ROTATE
+%token RENDER
 %token CROP
+%token TRIM
 %token SIZE
 %token RESOLUTION
 %token BLANK
+%token DROP
+%token REPLACE
 %token INPUT
 
 %token TRANSPARENT
+%token THRESHOLD
+%token ADAPTIVE
+%token MRC
+%token DOWNSAMPLE
+%token MORPHOLOGY
+%token ERODE
+%token DILATE
+%token OPEN
+%token CLOSE
+%token DESPECKLE
+%token DESKEW
 %token COLORMAP
 %token LABEL
 %token OVERLAY
@@ -98,6 +113,8 @@
 
 %type <integer> orientation
 
+%type <integer> morphology_operator
+
 %type <size> page_size
 
 %type <rgb> rgb
@@ -137,7 +154,8 @@ images_clause:
 	IMAGES image_ranges ;
 
 rotate_clause:
-	ROTATE INTEGER { input_set_rotation ($2); } ;
+	ROTATE INTEGER { input_set_rotation ($2, false); }
+	| ROTATE INTEGER RENDER { input_set_rotation ($2, true); } ;
 
 unit:
 	/* empty */  /* default to INCH */ { $$ = 1.0; }
@@ -151,7 +169,10 @@ crop_clause:
 	CROP PAGE_SIZE
 	| CROP PAGE_SIZE orientation
 	| CROP length ',' length
-	| CROP length ',' length ',' length ',' length ;
+	| CROP length ',' length ',' length ',' length { crop_t crop = { $2, $4, $6, $8 }; input_set_crop (crop); } ;
+
+trim_clause:
+	TRIM { input_set_trim (); } ;
 
 orientation:
 	PORTRAIT { $$ = 0; }
@@ -188,12 +209,49 @@ color_range:
 transparency_clause:
     TRANSPARENT color_range { input_set_transparency ($2); } ;
 
+threshold_clause:
+	THRESHOLD { threshold_t threshold = { THRESHOLD_OTSU, 0 }; input_set_threshold (threshold); }
+	| THRESHOLD INTEGER { threshold_t threshold = { THRESHOLD_FIXED, $2 }; input_set_threshold (threshold); }
+	| THRESHOLD ADAPTIVE { threshold_t threshold = { THRESHOLD_ADAPTIVE, 0 }; input_set_threshold (threshold); } ;
+
+mrc_clause:
+	MRC { input_set_mrc (0); }
+	| MRC INTEGER { input_set_mrc ($2); } ;
+
+downsample_clause:
+	DOWNSAMPLE INTEGER { downsample_t downsample = { $2, 0 }; input_set_downsample (downsample); }
+	| DOWNSAMPLE INTEGER ',' INTEGER { downsample_t downsample = { $2, $4 }; input_set_downsample (downsample); } ;
+
+morphology_operator:
+	ERODE { $$ = MORPH_ERODE; }
+	| DILATE { $$ = MORPH_DILATE; }
+	| OPEN { $$ = MORPH_OPEN; }
+	| CLOSE { $$ = MORPH_CLOSE; }
+	| DESPECKLE { $$ = MORPH_DESPECKLE; } ;
+
+morphology_clause:
+	MORPHOLOGY morphology_operator { input_set_morphology ($2); } ;
+
+deskew_clause:
+	DESKEW { input_set_deskew (); } ;
+
+blank_pages_clause:
+	DROP BLANK { input_set_blank_pages (BLANK_PAGES_DROP); }
+	| REPLACE BLANK { input_set_blank_pages (BLANK_PAGES_REPLACE); } ;
+
 modifier_clause:
 	rotate_clause ';'
 	| crop_clause ';'
+	| trim_clause ';'
 	| size_clause ';'
 	| resolution_clause ';'
-	| transparency_clause ';' ;
+	| transparency_clause ';'
+	| threshold_clause ';'
+	| mrc_clause ';'
+	| downsample_clause ';'
+	| morphology_clause ';'
+	| deskew_clause ';'
+	| blank_pages_clause ';' ;
 
 modifier_clauses:
         modifier_clause
@@ -241,10 +299,10 @@ output_file_clause:
 	pdf_file_attributes ;
 
 label_clause:
-	LABEL { page_label_t label = { NULL, '\0' }; output_set_page_label (label); }
-	| LABEL STRING { page_label_t label = { $2, '\0' }; output_set_page_label (label); }
-	| LABEL CHARACTER { page_label_t label = { NULL, $2 }; output_set_page_label (label); }
-	| LABEL STRING ',' CHARACTER { page_label_t label = { $2, $4 }; output_set_page_label (label); } ;
+	LABEL { page_label_t label = { NULL, '\0', 0, 0, 0 }; output_set_page_label (label); }
+	| LABEL STRING { page_label_t label = { $2, '\0', 0, 0, 0 }; output_set_page_label (label); }
+	| LABEL CHARACTER { page_label_t label = { NULL, $2, 0, 0, 0 }; output_set_page_label (label); }
+	| LABEL STRING ',' CHARACTER { page_label_t label = { $2, $4, 0, 0, 0 }; output_set_page_label (label); } ;
 
 overlay_clause_list:
 	/* empty */
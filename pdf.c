@@ -62,15 +62,121 @@ struct pdf_pages *pdf_new_pages (pdf_file_handle pdf_file)
      but Acrobat 4.0 fails to optimize files if it is. */
 
   pages->count = pdf_new_integer (0);
-  pages->pages_dict = pdf_new_ind_ref (pdf_file, pdf_new_obj (PT_DICTIONARY));
+  pages->pages_dict = ref (pdf_new_ind_ref (pdf_file, pdf_new_obj (PT_DICTIONARY)));
   pdf_set_dict_entry (pages->pages_dict, "Type", pdf_new_name ("Pages"));
   pdf_set_dict_entry (pages->pages_dict, "Kids", pages->kids);
   pdf_set_dict_entry (pages->pages_dict, "Count", pages->count);
+  pdf_lin_note_pages (pdf_file, pages->pages_dict);
   return (pages);
 }
 
 
+static void pdf_add_page_tree_kid (pdf_file_handle pdf_file,
+				   int level,
+				   pdf_obj_handle kid,
+				   long count);
+
+
+/* adds the last node of the level to the level above, and writes it */
+static void pdf_finish_pages (pdf_file_handle pdf_file, int level)
+{
+  struct pdf_pages *node = pdf_file->page_tree [level];
+
+  pdf_file->page_tree [level] = NULL;
+  pdf_add_page_tree_kid (pdf_file, level + 1,
+			 node->pages_dict, pdf_get_integer (node->count));
+  pdf_write_ind_obj (pdf_file, node->pages_dict);
+  unref (node->pages_dict);
+  free (node);
+}
+
+
+/* The tree of Pages nodes is built as the pages are made, so that the
+   pages can be written as they're finished.  Only the last node of each
+   level is open; when it has as many kids as the fan-out allows, it is
+   added to the level above, starting a new level if it was the top, and
+   written.  So the nodes are filled from the left, and the last one of a
+   level may have as few as one kid, but every page is at the same
+   depth. */
+static void pdf_add_page_tree_kid (pdf_file_handle pdf_file,
+				   int level,
+				   pdf_obj_handle kid,
+				   long count)
+{
+  struct pdf_pages *node = pdf_file->page_tree [level];
+
+  if (node && (node->kid_count == pdf_file->page_tree_fanout))
+    {
+      pdf_finish_pages (pdf_file, level);
+      node = NULL;
+    }
+  if (! node)
+    {
+      if (level == PDF_PAGE_TREE_MAX_LEVELS)
+	pdf_fatal ("page tree too deep\n");
+      node = pdf_new_pages (pdf_file);
+      pdf_file->page_tree [level] = node;
+      if (level == pdf_file->page_tree_levels)
+	pdf_file->page_tree_levels++;
+    }
+
+  pdf_set_dict_entry (kid, "Parent", node->pages_dict);
+  pdf_add_array_elem (node->kids, kid);
+  node->kid_count++;
+  pdf_set_integer (node->count, pdf_get_integer (node->count) + count);
+}
+
+
+/* The open nodes are finished from the bottom up, and the one left at
+   the top is the root. */
+static void pdf_finish_page_tree (pdf_file_handle pdf_file)
+{
+  struct pdf_pages *root;
+  int level;
+
+  if (! pdf_file->page_tree_levels)
+    {
+      pdf_file->page_tree [0] = pdf_new_pages (pdf_file);
+      pdf_file->page_tree_levels = 1;
+    }
+
+  for (level = 0; level + 1 < pdf_file->page_tree_levels; level++)
+    pdf_finish_pages (pdf_file, level);
+
+  root = pdf_file->page_tree [level];
+  pdf_file->page_tree [level] = NULL;
+  pdf_set_dict_entry (pdf_file->catalog, "Pages", root->pages_dict);
+  unref (root->pages_dict);
+  free (root);
+}
+
+
+void pdf_write_header (pdf_file_handle pdf_file)
+{
+  pdf_out_string (pdf_file, "%PDF-1.");
+  pdf_out_integer (pdf_file, pdf_file->minor_version);
+  pdf_out_string (pdf_file, "\r\n");
+
+  /* write comment containing 8-bit chars as a hint that the file is binary */
+  /* PDF 1.4 spec, section 3.4.1 */
+  pdf_out_string (pdf_file, "%\342\343\317\323\r\n");
+}
+
+
 pdf_file_handle pdf_create (char *filename)
+{
+  FILE *f;
+
+  f = fopen (filename, "wb");
+  if (! f)
+    {
+      pdf_fatal ("error opening output file\n");
+    }
+  return pdf_create_file (f);
+}
+
+
+pdf_file_handle pdf_create_file (FILE *f)
 {
   pdf_file_handle pdf_file;
   time_t current_time, adjusted_time;
@@ -81,21 +187,19 @@ pdf_file_handle pdf_create (char *filename)
 
   pdf_file = pdf_calloc (1, sizeof (struct pdf_file));
 
-  pdf_file->f = fopen (filename, "wb");
-  if (! pdf_file->f)
-    {
-      pdf_fatal ("error opening output file\n");
-    }
+  pdf_file->f = f;
+  pdf_file->out_buf = pdf_calloc (1, PDF_OUTPUT_BUFFER_SIZE);
+  pdf_file->out_size = PDF_OUTPUT_BUFFER_SIZE;
 
-  pdf_file->root = pdf_new_pages (pdf_file);
+  pdf_file->page_tree_fanout = PDF_PAGE_TREE_FANOUT;
 
-  pdf_file->catalog = pdf_new_ind_ref (pdf_file, pdf_new_obj (PT_DICTIONARY));
+  pdf_file->catalog = ref (pdf_new_ind_ref (pdf_file, pdf_new_obj (PT_DICTIONARY)));
   pdf_set_dict_entry (pdf_file->catalog, "Type", pdf_new_name ("Catalog"));
-  pdf_set_dict_entry (pdf_file->catalog, "Pages", pdf_file->root->pages_dict);
+  /* Pages entry will be added when the page tree is finished */
   /* Outlines dictionary will be created later if needed */
   pdf_set_dict_entry (pdf_file->catalog, "PageLayout", pdf_new_name ("SinglePage"));
 
-  pdf_file->info    = pdf_new_ind_ref (pdf_file, pdf_new_obj (PT_DICTIONARY));
+  pdf_file->info    = ref (pdf_new_ind_ref (pdf_file, pdf_new_obj (PT_DICTIONARY)));
   pdf_set_info (pdf_file, "Producer", PDF_PRODUCER);
 
   /* Generate CreationDate and ModDate */
@@ -114,17 +218,13 @@ pdf_file_handle pdf_create (char *filename)
       pdf_set_info (pdf_file, "ModDate", gmt_string);
     }
 
-  pdf_file->trailer_dict = pdf_new_obj (PT_DICTIONARY);
+  pdf_file->trailer_dict = ref (pdf_new_obj (PT_DICTIONARY));
   /* Size key will be added later */
   pdf_set_dict_entry (pdf_file->trailer_dict, "Root", pdf_file->catalog);
   pdf_set_dict_entry (pdf_file->trailer_dict, "Info", pdf_file->info);
 
-  /* write file header */
-  fprintf (pdf_file->f, "%%PDF-1.3\r\n");
-
-  /* write comment containing 8-bit chars as a hint that the file is binary */
-  /* PDF 1.4 spec, section 3.4.1 */
-  fprintf (pdf_file->f, "%%\342\343\317\323\r\n");
+  pdf_file->minor_version = 3;
+  pdf_write_header (pdf_file);
 
   return (pdf_file);
 }
@@ -133,6 +233,7 @@ pdf_file_handle pdf_create (char *filename)
 void pdf_close (pdf_file_handle pdf_file, int page_mode)
 {
   char *page_mode_string;
+  unsigned long outlines = 0;
 
   page_mode_string = "UseNone";
 
@@ -156,6 +257,7 @@ void pdf_close (pdf_file_handle pdf_file, int page_mode)
 		      pdf_new_name (page_mode_string));
 
   /* finalize trees, object numbers aren't allocated until this step */
+  pdf_finish_page_tree (pdf_file);
   pdf_finalize_name_trees (pdf_file);
 
   /* add the page label number tree, if it exists, to the catalog */
@@ -164,21 +266,94 @@ void pdf_close (pdf_file_handle pdf_file, int page_mode)
 			"PageLabels",
 			pdf_file->page_label_tree->root->dict);
 
+  /* a linearized file puts the outlines it opens showing up front */
+  if (pdf_file->lin && (page_mode == PDF_PAGE_MODE_USE_OUTLINES) &&
+      pdf_file->outline_root)
+    outlines = pdf_obj_num (pdf_get_dict_entry (pdf_file->catalog, "Outlines"));
+
   /* write body */
   pdf_write_all_ind_obj (pdf_file);
 
-  /* write cross reference table and get maximum object number */
-  pdf_set_dict_entry (pdf_file->trailer_dict, "Size", pdf_new_integer (pdf_write_xref (pdf_file)));
+  if (pdf_file->lin)
+    pdf_write_linearized (pdf_file, outlines);
+  else
+    {
+      if (pdf_file->object_streams)
+	pdf_write_xref_stream (pdf_file);
+      else
+	{
+	  /* write cross reference table and get maximum object number */
+	  pdf_set_dict_entry (pdf_file->trailer_dict, "Size", pdf_new_integer (pdf_write_xref (pdf_file)));
+
+	  /* write trailer */
+	  pdf_out_string (pdf_file, "trailer\r\n");
+	  pdf_write_obj (pdf_file, pdf_file->trailer_dict);
+	}
+      pdf_out_string (pdf_file, "startxref\r\n");
+      pdf_out_integer (pdf_file, pdf_file->xref_offset);
+      pdf_out_string (pdf_file, "\r\n%%EOF\r\n");
+    }
 
-  /* write trailer */
-  fprintf (pdf_file->f, "trailer\r\n");
-  pdf_write_obj (pdf_file, pdf_file->trailer_dict);
-  fprintf (pdf_file->f, "startxref\r\n");
-  fprintf (pdf_file->f, "%ld\r\n", pdf_file->xref_offset);
-  fprintf (pdf_file->f, "%%%%EOF\r\n");
+  pdf_flush_output (pdf_file);
+  if (fclose (pdf_file->f))
+    pdf_fatal ("error closing output file\n");
+  free (pdf_file->out_buf);
+
+  /* everything has been written; what's left of the bookmarks and name
+     trees is freed at exit */
+  unref (pdf_file->catalog);
+  unref (pdf_file->info);
+  unref (pdf_file->trailer_dict);
+  if (pdf_file->blank_image)
+    unref (pdf_file->blank_image);
+  if (pdf_file->g4_color_space)
+    unref (pdf_file->g4_color_space);
+  pdf_free_image_cache (pdf_file);
+  free (pdf_file->xref);
+  free (pdf_file);
+}
 
-  fclose (pdf_file->f);
-  /* should free stuff here */
+
+/* must be called before the first page is made */
+void pdf_set_page_tree_fanout (pdf_file_handle pdf_file, int fanout)
+{
+  pdf_assert (! pdf_file->page_count);
+  if (fanout < 2)
+    pdf_fatal ("page tree fan-out must be at least 2\n");
+  pdf_file->page_tree_fanout = fanout;
+}
+
+
+/* Objects other than streams are packed into compressed object
+   streams, and the cross reference table is a compressed stream too.
+   This must be set before any objects are written.  A reader has to
+   know PDF 1.5 to find the catalog, so the header, which is all that's
+   in the output buffer, is written again for that version. */
+void pdf_use_object_streams (pdf_file_handle pdf_file)
+{
+  if (pdf_file->lin)
+    pdf_fatal ("linearized files can't use object streams\n");
+  pdf_assert (! pdf_file->out_offset);
+  pdf_file->object_streams = true;
+  pdf_file->minor_version = 5;
+  pdf_file->out_used = 0;
+  pdf_write_header (pdf_file);
+}
+
+
+/* The header has already been written by the time we find out that a
+   newer feature is used, so the catalog Version entry (PDF 1.4) is
+   used to raise it. */
+void pdf_require_version (pdf_file_handle pdf_file, int minor_version)
+{
+  char version [16];
+
+  if (minor_version <= pdf_file->minor_version)
+    return;
+
+  pdf_file->minor_version = minor_version;
+  sprintf (version, "1.%d", minor_version);
+  pdf_set_dict_entry (pdf_file->catalog, "Version", pdf_new_name (version));
 }
 
 
@@ -233,12 +408,13 @@ pdf_page_handle pdf_new_page (pdf_file_handle pdf_file,
   page->resources = pdf_new_obj (PT_DICTIONARY);
   pdf_set_dict_entry (page->resources, "ProcSet", page->procset);
 
-  page->page_dict = pdf_new_ind_ref (pdf_file, pdf_new_obj (PT_DICTIONARY));
+  page->page_dict = ref (pdf_new_ind_ref (pdf_file, pdf_new_obj (PT_DICTIONARY)));
   pdf_set_dict_entry (page->page_dict, "Type", pdf_new_name ("Page"));
   pdf_set_dict_entry (page->page_dict, "MediaBox", page->media_box);
   pdf_set_dict_entry (page->page_dict, "Resources", page->resources);
+  pdf_lin_note_page (pdf_file, page->page_dict);
 
-  if (pdf_get_integer (pdf_file->root->count) == 0)
+  if (pdf_file->page_count++ == 0)
     {
       pdf_obj_handle dest_array = pdf_new_obj (PT_ARRAY);
       pdf_add_array_elem (dest_array, page->page_dict);
@@ -246,19 +422,26 @@ pdf_page_handle pdf_new_page (pdf_file_handle pdf_file,
       pdf_set_dict_entry (pdf_file->catalog, "OpenAction", dest_array);
     }
 
-  /* $$$ currently only support a single-level pages tree */
-  pdf_set_dict_entry (page->page_dict, "Parent", pdf_file->root->pages_dict);
-  pdf_add_array_elem (pdf_file->root->kids, page->page_dict);
-  pdf_set_integer (pdf_file->root->count,
-		   pdf_get_integer (pdf_file->root->count) + 1);
+  pdf_add_page_tree_kid (pdf_file, 0, page->page_dict, 1);
 
-  page->last_XObject_name = '@';  /* first name will be "ImA" */
+  page->XObject_count = 0;  /* first name will be "ImA" */
 
   return (page);
 }
 
+/* Nothing more can be added to the page, so it's written, and the
+   handle is freed. */
 void pdf_close_page (pdf_page_handle pdf_page)
 {
+  pdf_write_ind_obj (pdf_page->pdf_file, pdf_page->page_dict);
+  unref (pdf_page->page_dict);
+  free (pdf_page);
+}
+
+
+void pdf_set_image_rotation (pdf_page_handle pdf_page, int rotation)
+{
+  pdf_page->image_rotation = rotation;
 }
 
 
@@ -54,6 +54,10 @@ void pdf_init (void);
 
 pdf_file_handle pdf_create (char *filename);
 
+/* The output is written strictly in order, so f can be a pipe or
+   socket.  The PDF file owns f, and pdf_close() closes it. */
+pdf_file_handle pdf_create_file (FILE *f);
+
 void pdf_close (pdf_file_handle pdf_file, int page_mode);
 
 #define AS_STR(S) #S
@@ -69,14 +73,46 @@ void pdf_set_title    (pdf_file_handle pdf_file, char *title);
 void pdf_set_subject  (pdf_file_handle pdf_file, char *subject);
 void pdf_set_keywords (pdf_file_handle pdf_file, char *keywords);
 
+/* Raise the PDF version of the file to at least 1.<minor_version> */
+void pdf_require_version (pdf_file_handle pdf_file, int minor_version);
+
+/* The most kids of a node of the page tree, by default */
+#define PDF_PAGE_TREE_FANOUT 16
+
+void pdf_set_page_tree_fanout (pdf_file_handle pdf_file, int fanout);
+
+/* PDF 1.5 object streams and cross reference stream */
+void pdf_use_object_streams (pdf_file_handle pdf_file);
+
+/* Linearized ("Fast Web View") file, arranged so that the first page
+   can be shown before the rest has been read.  Objects are kept in a
+   temporary file until the file is closed.  This must be called before
+   any objects are written, and can't be used with object streams. */
+void pdf_linearize (pdf_file_handle pdf_file);
+
+/* The most PDF objects that have been in memory at once */
+unsigned long pdf_peak_object_count (void);
+
+/* The number of images drawn from an XObject that was already written,
+   rather than written again, and the bytes that saved */
+unsigned long pdf_reused_image_count (void);
+unsigned long long pdf_reused_image_bytes (void);
+
 
 /* width and height in units of 1/72 inch */
 pdf_page_handle pdf_new_page (pdf_file_handle pdf_file,
 			      double width,
 			      double height);
 
+/* The page is written, and the handle can't be used after this.  Pages
+   that aren't closed are written by pdf_close. */
 void pdf_close_page (pdf_page_handle pdf_page);
 
+/* Images written to the page after this are turned clockwise by
+   rotation degrees, which must be 0, 90, 180, or 270, by the matrix
+   that places them, so the samples are stored unturned. */
+void pdf_set_image_rotation (pdf_page_handle pdf_page, int rotation);
+
 
 void pdf_write_text (pdf_page_handle pdf_page);
 
@@ -107,6 +143,90 @@ void pdf_write_jpeg_image (pdf_page_handle pdf_page,
 			   rgb_range_t *transparency,
 			   FILE *f);
 
+/* Like pdf_write_jpeg_image, but the complete JPEG stream is supplied
+   in memory, and is written out before the function returns.  If
+   color_transform is false, three component data is RGB rather than
+   YCbCr. */
+void pdf_write_jpeg_image_data (pdf_page_handle pdf_page,
+				double x,
+				double y,
+				double width,
+				double height,
+				bool color,
+				bool color_transform,
+				uint32_t width_samples,
+				uint32_t height_samples,
+				rgb_range_t *transparency,
+				uint8_t *data,
+				uint32_t data_length);
+
+
+void pdf_write_jp2_image (pdf_page_handle pdf_page,
+			  double x,
+			  double y,
+			  double width,
+			  double height,
+			  bool color,
+			  uint32_t width_samples,
+			  uint32_t height_samples,
+			  rgb_range_t *transparency,
+			  FILE *f,
+			  long codestream_offset,
+			  long codestream_length);
+
+
+/* Called repeatedly while an encoded image is being written, to get the
+   next band of packed sample rows.  Returns a pointer to the band and sets
+   *row_count, or returns NULL on error.  Rows are (Columns * colors * bpc
+   + 7) / 8 bytes, with no padding, where colors includes alpha if
+   present. */
+typedef uint8_t *(*pdf_image_band_callback) (void *app_data,
+					     uint32_t *row_count);
+
+/* Images that aren't copied from the input file are Flate encoded using
+   the PNG predictors.  If palent is nonzero, the image uses an indexed
+   color space with the palette of palent RGB triples.  If alpha is true,
+   each pixel is followed by an alpha sample (bpc must be 8 or 16), which
+   is written as a soft mask. */
+void pdf_write_flate_image (pdf_page_handle pdf_page,
+			    double x,
+			    double y,
+			    double width,
+			    double height,
+			    bool color,
+			    bool negative,
+			    char *palette,
+			    int palent,
+			    int bpc,
+			    uint32_t width_samples,
+			    uint32_t height_samples,
+			    rgb_range_t *transparency,
+			    bool alpha,
+			    pdf_image_band_callback band_callback,
+			    void *app_data);
+
+/* Like pdf_write_flate_image, but the data is already Flate (or, if lzw
+   is true, LZW) compressed, with the PDF/TIFF predictor number given,
+   and is copied unchanged.  The data is written out before the function
+   returns. */
+void pdf_write_flate_image_data (pdf_page_handle pdf_page,
+				 double x,
+				 double y,
+				 double width,
+				 double height,
+				 bool color,
+				 bool negative,
+				 char *palette,
+				 int palent,
+				 int bpc,
+				 uint32_t width_samples,
+				 uint32_t height_samples,
+				 rgb_range_t *transparency,
+				 bool lzw,
+				 int predictor,
+				 uint8_t *data,
+				 uint32_t data_length);
+
 
 void pdf_write_png_image (pdf_page_handle pdf_page,
 						  double x,
@@ -123,6 +243,31 @@ void pdf_write_png_image (pdf_page_handle pdf_page,
 						  FILE *f);
 
 
+/* Mixed raster content: a background of 8-bit gray or RGB samples,
+   which is JPEG encoded, with the black pixels of the mask painted over
+   it in the foreground color.  Both cover the whole rect. */
+void pdf_write_mrc_image (pdf_page_handle pdf_page,
+			  double x,
+			  double y,
+			  double width,
+			  double height,
+			  Bitmap *mask,
+			  rgb_t foreground,
+			  bool color,
+			  uint32_t bg_width_samples,
+			  uint32_t bg_height_samples,
+			  uint8_t *background);
+
+
+/* White, for pages found to be blank; the image is shared by all of
+   them. */
+void pdf_write_blank_image (pdf_page_handle pdf_page,
+			    double x,
+			    double y,
+			    double width,
+			    double height);
+
+
 void pdf_set_page_number (pdf_page_handle pdf_page, char *page_number);
 
 /* Create a new bookmark, under the specified parent, or at the top
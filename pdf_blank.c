@@ -0,0 +1,113 @@
+/*
+ * tumble: build a PDF file from image files
+ *
+ * PDF routines
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.  Note that permission is
+ * not granted to redistribute this program under the terms of any
+ * other version of the General Public License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111 USA
+ */
+
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+#include "bitblt.h"
+#include "pdf.h"
+#include "pdf_util.h"
+#include "pdf_prim.h"
+#include "pdf_private.h"
+
+
+/* Pages found to be blank are drawn with a single white pixel, scaled
+   to the page.  The image is written to the file once, and shared by
+   all of the blank pages. */
+
+struct pdf_blank_image
+{
+  double matrix [6];  /* placement, from pdf_image_matrix */
+  char XObject_name [XOBJECT_NAME_SIZE];
+};
+
+
+static void pdf_write_blank_content_callback (pdf_file_handle pdf_file,
+					      pdf_obj_handle stream,
+					      void *app_data)
+{
+  struct pdf_blank_image *image = app_data;
+
+  pdf_write_image_matrix (pdf_file, stream, image->matrix);
+  pdf_write_name (pdf_file, image->XObject_name);
+  pdf_stream_printf (pdf_file, stream, "Do Q\r\n");
+}
+
+
+static void pdf_write_blank_image_callback (pdf_file_handle pdf_file,
+					    pdf_obj_handle stream,
+					    void *app_data)
+{
+  char white = (char) 0x80;  /* the first of eight 1-bit samples */
+
+  pdf_stream_write_data (pdf_file, stream, & white, 1);
+}
+
+
+void pdf_write_blank_image (pdf_page_handle pdf_page,
+			    double x,
+			    double y,
+			    double width,
+			    double height)
+{
+  pdf_file_handle pdf_file = pdf_page->pdf_file;
+  struct pdf_blank_image *image;
+
+  if (! pdf_file->blank_image)
+    {
+      pdf_obj_handle stream_dict = pdf_new_obj (PT_DICTIONARY);
+
+      pdf_file->blank_image = ref (pdf_new_ind_ref (pdf_file,
+						    pdf_new_stream (pdf_file,
+								    stream_dict,
+								    & pdf_write_blank_image_callback,
+								    NULL)));
+
+      pdf_set_dict_entry (stream_dict, "Type",    pdf_new_name ("XObject"));
+      pdf_set_dict_entry (stream_dict, "Subtype", pdf_new_name ("Image"));
+      pdf_set_dict_entry (stream_dict, "Width",   pdf_new_integer (1));
+      pdf_set_dict_entry (stream_dict, "Height",  pdf_new_integer (1));
+      pdf_set_dict_entry (stream_dict, "ColorSpace", pdf_new_name ("DeviceGray"));
+      pdf_set_dict_entry (stream_dict, "BitsPerComponent", pdf_new_integer (1));
+
+      pdf_write_ind_obj (pdf_file, pdf_file->blank_image);
+    }
+
+  pdf_add_array_elem_unique (pdf_page->procset, pdf_new_name ("ImageB"));
+
+  image = pdf_calloc (1, sizeof (struct pdf_blank_image));
+  pdf_image_matrix (pdf_page, x, y, width, height, image->matrix);
+
+  pdf_new_XObject (pdf_page, pdf_file->blank_image, image->XObject_name);
+
+  pdf_obj_handle content_stream = pdf_new_ind_ref (pdf_file,
+						   pdf_new_stream (pdf_file,
+								   pdf_new_obj (PT_DICTIONARY),
+								   & pdf_write_blank_content_callback,
+								   image));
+  pdf_page_add_content_stream (pdf_page, content_stream);
+  free (image);
+}
@@ -0,0 +1,664 @@
+/*
+ * tumble: build a PDF file from image files
+ *
+ * PDF routines
+ *
+ * Derived from pdf_png.c written 2004 by Daniel Gloeckner
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.  Note that permission is
+ * not granted to redistribute this program under the terms of any
+ * other version of the General Public License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111 USA
+ */
+
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+
+
+#include "bitblt.h"
+#include "pdf.h"
+#include "pdf_util.h"
+#include "pdf_prim.h"
+#include "pdf_private.h"
+
+
+/* Images that have to be encoded (rather than copied from the input
+   file) are run through the PNG predictors and deflated.  The samples
+   are pulled from the input handler a band of rows at a time, so the
+   uncompressed image is never held in memory.
+
+   An alpha channel is split off from the color samples as each row is
+   read, and becomes a soft mask.  Both are deflated at the same time,
+   but since the image has to be written before its soft mask, the
+   compressed alpha is held in memory until then.
+
+   Data that is already Flate or LZW compressed in a form PDF can decode
+   is copied as-is, with decode parameters describing its predictor. */
+
+
+struct pdf_flate_image
+{
+  double matrix [6];  /* placement, from pdf_image_matrix */
+  int colors;  /* samples per pixel, 1 for indexed */
+  int bpc;
+  uint32_t width_samples, height_samples;
+  uint32_t row_bytes;
+  bool alpha;  /* band rows have an alpha sample after each pixel */
+  pdf_image_band_callback band_callback;
+  void *app_data;
+  uint8_t *data;  /* if not NULL, already compressed */
+  uint32_t data_length;
+  uint8_t *smask_data;  /* compressed alpha, once the image is written */
+  uint32_t smask_length;
+  char XObject_name [XOBJECT_NAME_SIZE];
+};
+
+
+static void pdf_write_flate_content_callback (pdf_file_handle pdf_file,
+					      pdf_obj_handle stream,
+					      void *app_data)
+{
+  struct pdf_flate_image *image = app_data;
+
+  pdf_write_image_matrix (pdf_file, stream, image->matrix);
+  pdf_write_name (pdf_file, image->XObject_name);
+  pdf_stream_printf (pdf_file, stream, "Do Q\r\n");
+}
+
+
+#define PNG_FILTER_UP    2
+#define PNG_FILTER_PAETH 4
+
+/* The filter loops are kept free of data-dependent branches so that the
+   compiler can vectorize them.  The first bpp bytes of a row have no
+   left neighbor and are handled separately. */
+
+static uint32_t png_filter_up (uint8_t *restrict out,
+			       const uint8_t *restrict row,
+			       const uint8_t *restrict prev,
+			       uint32_t row_bytes)
+{
+  uint32_t i;
+  uint32_t cost = 0;
+
+  for (i = 0; i < row_bytes; i++)
+    {
+      out [i] = row [i] - prev [i];
+      cost += abs ((int8_t) out [i]);
+    }
+  return cost;
+}
+
+
+static uint32_t png_filter_paeth (uint8_t *restrict out,
+				  const uint8_t *restrict row,
+				  const uint8_t *restrict prev,
+				  uint32_t row_bytes,
+				  int bpp)
+{
+  const uint8_t *left, *upper_left;
+  uint32_t i;
+  uint32_t cost = 0;
+
+  /* no left neighbor, so the predictor is the byte above */
+  for (i = 0; (i < bpp) && (i < row_bytes); i++)
+    {
+      out [i] = row [i] - prev [i];
+      cost += abs ((int8_t) out [i]);
+    }
+
+  left = row - bpp;
+  upper_left = prev - bpp;
+  for (; i < row_bytes; i++)
+    {
+      int a = left [i];
+      int b = prev [i];
+      int c = upper_left [i];
+      int pa = abs (b - c);
+      int pb = abs (a - c);
+      int pc = abs (a + b - 2 * c);
+      int pred = ((pa <= pb) & (pa <= pc)) ? a : ((pb <= pc) ? b : c);
+      uint8_t d = row [i] - pred;
+      out [i] = d;
+      cost += abs ((int8_t) d);
+    }
+  return cost;
+}
+
+
+#define FLATE_BUFFER_SIZE 8192
+
+/* Filter and compression state for one image or soft mask */
+struct pdf_flate_encoder
+{
+  uint32_t row_bytes;
+  int bpp;
+  uint8_t *prev;
+  uint8_t *up_row, *paeth_row;
+  z_stream zs;
+  pdf_file_handle pdf_file;
+  pdf_obj_handle stream;  /* if NULL, output is collected in buffer */
+  uint8_t *buffer;
+  uint32_t buffer_length;
+  uint32_t buffer_size;
+};
+
+
+static void pdf_deflate_data (struct pdf_flate_encoder *enc,
+			      uint8_t *data,
+			      uint32_t len,
+			      int flush)
+{
+  uint8_t buffer [FLATE_BUFFER_SIZE];
+  uint32_t out_len;
+  int ret;
+
+  enc->zs.next_in = data;
+  enc->zs.avail_in = len;
+  do
+    {
+      enc->zs.next_out = buffer;
+      enc->zs.avail_out = sizeof (buffer);
+      ret = deflate (& enc->zs, flush);
+      if (ret == Z_STREAM_ERROR)
+	pdf_fatal ("deflate error\n");
+      out_len = sizeof (buffer) - enc->zs.avail_out;
+      if (enc->stream)
+	pdf_stream_write_data (enc->pdf_file, enc->stream,
+			       (char *) buffer, out_len);
+      else if (out_len)
+	{
+	  if (enc->buffer_length + out_len > enc->buffer_size)
+	    {
+	      enc->buffer_size = 2 * (enc->buffer_size + out_len);
+	      enc->buffer = realloc (enc->buffer, enc->buffer_size);
+	      if (! enc->buffer)
+		pdf_fatal ("failed to allocate memory\n");
+	    }
+	  memcpy (enc->buffer + enc->buffer_length, buffer, out_len);
+	  enc->buffer_length += out_len;
+	}
+    }
+  while ((enc->zs.avail_out == 0) || (enc->zs.avail_in != 0));
+}
+
+
+static void pdf_flate_encoder_init (struct pdf_flate_encoder *enc,
+				    uint32_t row_bytes,
+				    int colors,
+				    int bpc,
+				    pdf_file_handle pdf_file,
+				    pdf_obj_handle stream)
+{
+  memset (enc, 0, sizeof (*enc));
+  enc->row_bytes = row_bytes;
+
+  /* bytes per complete pixel, rounded up to one, as in PNG */
+  enc->bpp = (colors * bpc + 7) / 8;
+
+  enc->pdf_file = pdf_file;
+  enc->stream = stream;
+
+  /* each filtered row is preceded by its filter type byte */
+  enc->prev = pdf_calloc (1, row_bytes);
+  enc->up_row = pdf_calloc (1, row_bytes + 1);
+  enc->paeth_row = pdf_calloc (1, row_bytes + 1);
+  enc->up_row [0] = PNG_FILTER_UP;
+  enc->paeth_row [0] = PNG_FILTER_PAETH;
+
+  if (deflateInit (& enc->zs, Z_DEFAULT_COMPRESSION) != Z_OK)
+    pdf_fatal ("can't initialize deflate\n");
+}
+
+
+static void pdf_flate_encode_row (struct pdf_flate_encoder *enc,
+				  uint8_t *row)
+{
+  uint32_t up_cost, paeth_cost;
+
+  up_cost = png_filter_up (enc->up_row + 1, row, enc->prev, enc->row_bytes);
+  paeth_cost = png_filter_paeth (enc->paeth_row + 1, row, enc->prev,
+				 enc->row_bytes, enc->bpp);
+
+  pdf_deflate_data (enc,
+		    (paeth_cost < up_cost) ? enc->paeth_row : enc->up_row,
+		    enc->row_bytes + 1,
+		    Z_NO_FLUSH);
+
+  memcpy (enc->prev, row, enc->row_bytes);
+}
+
+
+static void pdf_flate_encoder_finish (struct pdf_flate_encoder *enc)
+{
+  pdf_deflate_data (enc, NULL, 0, Z_FINISH);
+  deflateEnd (& enc->zs);
+
+  free (enc->prev);
+  free (enc->up_row);
+  free (enc->paeth_row);
+}
+
+
+/* Separates interleaved color and alpha samples in a single pass. */
+static void split_alpha (uint8_t *restrict color,
+			 uint8_t *restrict alpha,
+			 const uint8_t *restrict src,
+			 uint32_t width,
+			 int colors,
+			 int sample_bytes)
+{
+  int color_bytes = colors * sample_bytes;
+  int pixel_bytes = color_bytes + sample_bytes;
+  uint32_t x;
+  int i;
+
+  for (x = 0; x < width; x++, src += pixel_bytes)
+    {
+      for (i = 0; i < color_bytes; i++)
+	*color++ = src [i];
+      for (i = 0; i < sample_bytes; i++)
+	*alpha++ = src [color_bytes + i];
+    }
+}
+
+
+static void pdf_write_flate_image_callback (pdf_file_handle pdf_file,
+					    pdf_obj_handle stream,
+					    void *app_data)
+{
+  struct pdf_flate_image *image = app_data;
+  struct pdf_flate_encoder enc, alpha_enc;
+  uint32_t band_row_bytes = image->row_bytes;
+  uint8_t *color_row = NULL;
+  uint8_t *alpha_row = NULL;
+  uint32_t row = 0;
+
+  if (image->data)
+    {
+      pdf_stream_write_data (pdf_file, stream,
+			     (char *) image->data, image->data_length);
+      return;
+    }
+
+  pdf_flate_encoder_init (& enc, image->row_bytes, image->colors, image->bpc,
+			  pdf_file, stream);
+
+  if (image->alpha)
+    {
+      uint32_t alpha_row_bytes = (image->width_samples * image->bpc + 7) / 8;
+
+      pdf_flate_encoder_init (& alpha_enc, alpha_row_bytes, 1, image->bpc,
+			      pdf_file, NULL);
+      band_row_bytes += alpha_row_bytes;
+      color_row = pdf_calloc (1, image->row_bytes);
+      alpha_row = pdf_calloc (1, alpha_row_bytes);
+    }
+
+  while (row < image->height_samples)
+    {
+      uint32_t band_rows;
+      uint8_t *band;
+      uint8_t *rp;
+
+      band = image->band_callback (image->app_data, & band_rows);
+      if (! band)
+	pdf_fatal ("error reading image data\n");
+      if (band_rows > image->height_samples - row)
+	band_rows = image->height_samples - row;
+
+      for (rp = band; band_rows--; rp += band_row_bytes, row++)
+	{
+	  if (image->alpha)
+	    {
+	      split_alpha (color_row, alpha_row, rp,
+			   image->width_samples, image->colors, image->bpc / 8);
+	      pdf_flate_encode_row (& enc, color_row);
+	      pdf_flate_encode_row (& alpha_enc, alpha_row);
+	    }
+	  else
+	    pdf_flate_encode_row (& enc, rp);
+	}
+    }
+
+  pdf_flate_encoder_finish (& enc);
+
+  if (image->alpha)
+    {
+      pdf_flate_encoder_finish (& alpha_enc);
+      image->smask_data = alpha_enc.buffer;
+      image->smask_length = alpha_enc.buffer_length;
+      free (color_row);
+      free (alpha_row);
+    }
+}
+
+
+static void pdf_write_flate_smask_callback (pdf_file_handle pdf_file,
+					    pdf_obj_handle stream,
+					    void *app_data)
+{
+  struct pdf_flate_image *image = app_data;
+
+  pdf_stream_write_data (pdf_file, stream,
+			 (char *) image->smask_data, image->smask_length);
+  free (image->smask_data);
+  image->smask_data = NULL;
+}
+
+
+/* The soft mask, if there is one, is returned in *smask, held, to be
+   written after the image. */
+static pdf_obj_handle pdf_new_flate_XObject (pdf_page_handle pdf_page,
+					     struct pdf_flate_image *image,
+					     bool color,
+					     bool negative,
+					     char *palette,
+					     int palent,
+					     rgb_range_t *transparency,
+					     bool lzw,
+					     int predictor,
+					     pdf_obj_handle *smask)
+{
+  pdf_obj_handle stream;
+  pdf_obj_handle stream_dict;
+  pdf_obj_handle decode_parms = NULL;
+
+  pdf_obj_handle mask;
+
+  *smask = NULL;
+
+  stream_dict = pdf_new_obj (PT_DICTIONARY);
+
+  stream = pdf_new_ind_ref (pdf_page->pdf_file,
+			    pdf_new_stream (pdf_page->pdf_file,
+					    stream_dict,
+					    & pdf_write_flate_image_callback,
+					    image));
+
+  pdf_new_XObject (pdf_page, stream, image->XObject_name);
+
+  pdf_set_dict_entry (stream_dict, "Type",    pdf_new_name ("XObject"));
+  pdf_set_dict_entry (stream_dict, "Subtype", pdf_new_name ("Image"));
+  pdf_set_dict_entry (stream_dict, "Width",   pdf_new_integer (image->width_samples));
+  pdf_set_dict_entry (stream_dict, "Height",  pdf_new_integer (image->height_samples));
+
+  if (image->alpha)
+    {
+      pdf_obj_handle smask_dict = pdf_new_obj (PT_DICTIONARY);
+      pdf_obj_handle smask_parms = pdf_new_obj (PT_DICTIONARY);
+
+      /* soft masks were introduced in PDF 1.4 */
+      pdf_require_version (pdf_page->pdf_file, 4);
+
+      /* held until it's written, after the image that refers to it */
+      *smask = ref (pdf_new_ind_ref (pdf_page->pdf_file,
+				    pdf_new_stream (pdf_page->pdf_file,
+						    smask_dict,
+						    & pdf_write_flate_smask_callback,
+						    image)));
+
+      pdf_set_dict_entry (smask_dict, "Type",    pdf_new_name ("XObject"));
+      pdf_set_dict_entry (smask_dict, "Subtype", pdf_new_name ("Image"));
+      pdf_set_dict_entry (smask_dict, "Width",   pdf_new_integer (image->width_samples));
+      pdf_set_dict_entry (smask_dict, "Height",  pdf_new_integer (image->height_samples));
+      pdf_set_dict_entry (smask_dict, "ColorSpace", pdf_new_name ("DeviceGray"));
+      pdf_set_dict_entry (smask_dict, "BitsPerComponent", pdf_new_integer (image->bpc));
+
+      pdf_set_dict_entry (smask_parms, "Predictor", pdf_new_integer (15));
+      pdf_set_dict_entry (smask_parms, "Colors", pdf_new_integer (1));
+      pdf_set_dict_entry (smask_parms, "BitsPerComponent", pdf_new_integer (image->bpc));
+      pdf_set_dict_entry (smask_parms, "Columns", pdf_new_integer (image->width_samples));
+      pdf_stream_add_filter (*smask, "FlateDecode", smask_parms);
+
+      pdf_set_dict_entry (stream_dict, "SMask", *smask);
+    }
+  else if (transparency)
+    {
+      mask = pdf_new_obj (PT_ARRAY);
+
+      pdf_add_array_elem (mask, pdf_new_integer (transparency->red.first));
+      pdf_add_array_elem (mask, pdf_new_integer (transparency->red.last));
+
+      if (image->colors == 3) {
+	pdf_add_array_elem (mask, pdf_new_integer (transparency->green.first));
+	pdf_add_array_elem (mask, pdf_new_integer (transparency->green.last));
+	pdf_add_array_elem (mask, pdf_new_integer (transparency->blue.first));
+	pdf_add_array_elem (mask, pdf_new_integer (transparency->blue.last));
+      }
+
+      pdf_set_dict_entry (stream_dict, "Mask", mask);
+    }
+
+  if (palent)
+    {
+      pdf_obj_handle space;
+      space = pdf_new_obj (PT_ARRAY);
+      pdf_add_array_elem (space, pdf_new_name ("Indexed"));
+      pdf_add_array_elem (space, pdf_new_name ("DeviceRGB"));
+      pdf_add_array_elem (space, pdf_new_integer (palent - 1));
+      pdf_add_array_elem (space, pdf_new_string_n (palette, 3 * palent));
+      pdf_set_dict_entry (stream_dict, "ColorSpace", space);
+    }
+  else
+    pdf_set_dict_entry (stream_dict, "ColorSpace", pdf_new_name (color ? "DeviceRGB" : "DeviceGray"));
+
+  if (negative && ! palent)
+    {
+      pdf_obj_handle decode;
+      int i;
+
+      decode = pdf_new_obj (PT_ARRAY);
+      for (i = 0; i < image->colors; i++)
+	{
+	  pdf_add_array_elem (decode, pdf_new_integer (1));
+	  pdf_add_array_elem (decode, pdf_new_integer (0));
+	}
+      pdf_set_dict_entry (stream_dict, "Decode", decode);
+    }
+
+  pdf_set_dict_entry (stream_dict, "BitsPerComponent", pdf_new_integer (image->bpc));
+
+  if (lzw || (predictor > 1))
+    decode_parms = pdf_new_obj (PT_DICTIONARY);
+  if (lzw)
+    pdf_set_dict_entry (decode_parms, "EarlyChange", pdf_new_integer (1));
+  if (predictor > 1)
+    {
+      pdf_set_dict_entry (decode_parms, "Predictor", pdf_new_integer (predictor));
+      pdf_set_dict_entry (decode_parms, "Colors", pdf_new_integer (image->colors));
+      pdf_set_dict_entry (decode_parms, "BitsPerComponent", pdf_new_integer (image->bpc));
+      pdf_set_dict_entry (decode_parms, "Columns", pdf_new_integer (image->width_samples));
+    }
+
+  pdf_stream_add_filter (stream, lzw ? "LZWDecode" : "FlateDecode", decode_parms);
+
+  return (stream);
+}
+
+
+/* the parameters that go into the XObject, for its key */
+struct pdf_flate_image_params
+{
+  bool color;
+  bool negative;
+  bool lzw;
+  bool transparent;
+  int palent;
+  int bpc;
+  int predictor;
+  uint32_t width_samples, height_samples;
+  rgb_range_t transparency;
+};
+
+
+static void pdf_add_flate_image (pdf_page_handle pdf_page,
+				 struct pdf_flate_image *image,
+				 bool color,
+				 bool negative,
+				 char *palette,
+				 int palent,
+				 rgb_range_t *transparency,
+				 bool lzw,
+				 int predictor)
+{
+  struct pdf_image_key key;
+  pdf_obj_handle smask;
+
+  /* 16 bits per component was introduced in PDF 1.5 */
+  if (image->bpc > 8)
+    pdf_require_version (pdf_page->pdf_file, 5);
+
+  pdf_add_array_elem_unique (pdf_page->procset,
+			     pdf_new_name (palent ? "ImageI" : color ? "ImageC" : "ImageB"));
+
+  /* Only an image whose data is already encoded can be known before
+     it's written; the samples of the others arrive as the stream is
+     written, in bands. */
+  if (image->data)
+    {
+      struct pdf_flate_image_params params;
+
+      memset (& params, 0, sizeof (params));
+      params.color = color;
+      params.negative = negative;
+      params.lzw = lzw;
+      params.palent = palent;
+      params.bpc = image->bpc;
+      params.predictor = predictor;
+      params.width_samples = image->width_samples;
+      params.height_samples = image->height_samples;
+      if (transparency)
+	{
+	  params.transparent = true;
+	  params.transparency = *transparency;
+	}
+
+      pdf_image_key_init (& key);
+      pdf_image_key_add (& key, "FlateDecode", 11);
+      pdf_image_key_add (& key, & params, sizeof (params));
+      if (palent)
+	pdf_image_key_add (& key, palette, 3 * palent);
+      pdf_image_key_add_data (& key, image->data, image->data_length);
+    }
+
+  /* the streams are written using our callback functions to get the
+     actual data */
+  if (! (image->data && pdf_reuse_XObject (pdf_page, & key, image->XObject_name)))
+    {
+      pdf_write_XObject (pdf_page->pdf_file,
+			 image->data ? & key : NULL,
+			 pdf_new_flate_XObject (pdf_page, image, color, negative,
+						palette, palent, transparency,
+						lzw, predictor, & smask));
+      if (smask)
+	{
+	  pdf_write_ind_obj (pdf_page->pdf_file, smask);
+	  unref (smask);
+	}
+    }
+
+  pdf_obj_handle content_stream = pdf_new_ind_ref(pdf_page->pdf_file,
+						  pdf_new_stream (pdf_page->pdf_file,
+								  pdf_new_obj (PT_DICTIONARY),
+								  & pdf_write_flate_content_callback,
+								  image));
+
+  pdf_page_add_content_stream(pdf_page, content_stream);
+
+  /* all of the streams have been written, so the caller may free the
+     data */
+  free (image);
+}
+
+
+void pdf_write_flate_image (pdf_page_handle pdf_page,
+			    double x,
+			    double y,
+			    double width,
+			    double height,
+			    bool color,
+			    bool negative,
+			    char *palette,
+			    int palent,
+			    int bpc,
+			    uint32_t width_samples,
+			    uint32_t height_samples,
+			    rgb_range_t *transparency,
+			    bool alpha,
+			    pdf_image_band_callback band_callback,
+			    void *app_data)
+{
+  struct pdf_flate_image *image;
+
+  image = pdf_calloc (1, sizeof (struct pdf_flate_image));
+
+  pdf_image_matrix (pdf_page, x, y, width, height, image->matrix);
+
+  image->colors = (! palent && color) ? 3 : 1;
+  image->bpc = bpc;
+  image->width_samples = width_samples;
+  image->height_samples = height_samples;
+  image->row_bytes = (width_samples * image->colors * bpc + 7) / 8;
+
+  image->alpha = alpha;
+  image->band_callback = band_callback;
+  image->app_data = app_data;
+
+  /* PNG predictors, chosen per row */
+  pdf_add_flate_image (pdf_page, image, color, negative, palette, palent,
+		       transparency, false, 15);
+}
+
+
+void pdf_write_flate_image_data (pdf_page_handle pdf_page,
+				 double x,
+				 double y,
+				 double width,
+				 double height,
+				 bool color,
+				 bool negative,
+				 char *palette,
+				 int palent,
+				 int bpc,
+				 uint32_t width_samples,
+				 uint32_t height_samples,
+				 rgb_range_t *transparency,
+				 bool lzw,
+				 int predictor,
+				 uint8_t *data,
+				 uint32_t data_length)
+{
+  struct pdf_flate_image *image;
+
+  image = pdf_calloc (1, sizeof (struct pdf_flate_image));
+
+  pdf_image_matrix (pdf_page, x, y, width, height, image->matrix);
+
+  image->colors = (! palent && color) ? 3 : 1;
+  image->bpc = bpc;
+  image->width_samples = width_samples;
+  image->height_samples = height_samples;
+  image->row_bytes = (width_samples * image->colors * bpc + 7) / 8;
+
+  image->data = data;
+  image->data_length = data_length;
+
+  pdf_add_flate_image (pdf_page, image, color, negative, palette, palent,
+		       transparency, lzw, predictor);
+}
@@ -43,12 +43,11 @@
 
 struct pdf_g4_image
 {
-  double width, height;
-  double x, y;
+  double matrix [6];  /* placement, from pdf_image_matrix */
   unsigned long Columns;
   unsigned long Rows;
   Bitmap *bitmap;
-  char XObject_name [4];
+  char XObject_name [XOBJECT_NAME_SIZE];
   bool imagemask;
   double fg_red, fg_green, fg_blue;  // only if imagemask
 };
@@ -60,15 +59,15 @@ static void pdf_write_g4_content_callback (pdf_file_handle pdf_file,
 {
   struct pdf_g4_image *image = app_data;
 
-  /* transformation matrix is: width 0 0 height x y cm */
-  pdf_stream_printf (pdf_file, stream, "q %g 0 0 %g %g %g cm ",
-		     image->width, image->height,
-		     image->x, image->y);
+  pdf_write_image_matrix (pdf_file, stream, image->matrix);
 
   if (image->imagemask)
     {
       // set nonstroking color in DeviceRGB color space
-      pdf_stream_printf(pdf_file, stream, "%g %g %g rg ", image->fg_red, image->fg_green, image->fg_blue);
+      pdf_write_real (pdf_file, image->fg_red);
+      pdf_write_real (pdf_file, image->fg_green);
+      pdf_write_real (pdf_file, image->fg_blue);
+      pdf_stream_printf (pdf_file, stream, "rg ");
     }
 
   pdf_write_name(pdf_file, image->XObject_name);
@@ -76,65 +75,49 @@ static void pdf_write_g4_content_callback (pdf_file_handle pdf_file,
 }
 
 
+static void pdf_write_g4_data (void *app_data,
+			       const uint8_t *data,
+			       uint32_t len)
+{
+  pdf_file_handle pdf_file = app_data;
+
+  pdf_out_data (pdf_file, data, len);
+}
+
+
 static void pdf_write_g4_fax_image_callback (pdf_file_handle pdf_file,
 					     pdf_obj_handle stream,
 					     void *app_data)
 {
   struct pdf_g4_image *image = app_data;
 
-  bitblt_write_g4 (image->bitmap, pdf_file->f);
+  bitblt_write_g4 (image->bitmap, & pdf_write_g4_data, pdf_file);
 }
 
 
-void pdf_write_g4_fax_image (pdf_page_handle pdf_page,
-			     double x,
-			     double y,
-			     double width,
-			     double height,
-			     bool negative,
-			     Bitmap *bitmap,
-			     overlay_t *overlay,
-			     colormap_t *colormap,
-			     rgb_range_t *transparency)
+/* the parameters that go into the XObject, for its key */
+struct pdf_g4_image_params
 {
-  struct pdf_g4_image *image;
+  unsigned long Columns;
+  unsigned long Rows;
+  bool negative;
+  bool imagemask;
+  bool colormapped;
+  bool transparent;
+  char color_index [6];
+  rgb_range_t transparency;
+};
+
 
+static pdf_obj_handle pdf_new_g4_XObject (pdf_page_handle pdf_page,
+					  struct pdf_g4_image *image,
+					  struct pdf_g4_image_params *params)
+{
   pdf_obj_handle stream;
   pdf_obj_handle stream_dict;
   pdf_obj_handle decode_parms;
 
-  typedef char MAP_STRING[6];
-  
-  MAP_STRING color_index;
-  static MAP_STRING last_color_index;
-  static pdf_obj_handle color_space;
-
-  if (transparency && (overlay && overlay->imagemask))
-  {
-    fprintf(stderr, "Can't use transparency or color map with an image mask.\n");
-    exit(2);  // XXX should be a failure return value
-  }
-
-  pdf_add_array_elem_unique (pdf_page->procset, pdf_new_name ("ImageB"));
-
-  image = pdf_calloc (1, sizeof (struct pdf_g4_image));
-
-  image->width = width;
-  image->height = height;
-  image->x = x;
-  image->y = y;
-
-  image->bitmap = bitmap;
-  image->Columns = bitmap->rect.max.x - bitmap->rect.min.x;
-  image->Rows = bitmap->rect.max.y - bitmap->rect.min.y;
-
-  if (overlay && overlay->imagemask)
-    {
-      image->imagemask = true;
-      image->fg_red   = overlay->foreground.red   / 255.0;
-      image->fg_green = overlay->foreground.green / 255.0;
-      image->fg_blue  = overlay->foreground.blue  / 255.0;
-    }
+  pdf_file_handle pdf_file = pdf_page->pdf_file;
 
   stream_dict = pdf_new_obj (PT_DICTIONARY);
 
@@ -144,8 +127,7 @@ void pdf_write_g4_fax_image (pdf_page_handle pdf_page,
 					    & pdf_write_g4_fax_image_callback,
 					    image));
 
-  strcpy (& image->XObject_name [0], "Im ");
-  image->XObject_name [2] = pdf_new_XObject (pdf_page, stream);
+  pdf_new_XObject (pdf_page, stream, image->XObject_name);
 
   pdf_set_dict_entry (stream_dict, "Type",    pdf_new_name ("XObject"));
   pdf_set_dict_entry (stream_dict, "Subtype", pdf_new_name ("Image"));
@@ -155,49 +137,46 @@ void pdf_write_g4_fax_image (pdf_page_handle pdf_page,
   pdf_set_dict_entry (stream_dict, "Height",  pdf_new_integer (image->Rows));
   pdf_set_dict_entry (stream_dict, "BitsPerComponent", pdf_new_integer (1));
 
-  if (overlay && overlay->imagemask)
+  if (image->imagemask)
     {
       pdf_set_dict_entry (stream_dict, "ImageMask", pdf_new_bool (true));
     }
 
-  if (transparency)
+  if (params->transparent)
     {
       pdf_obj_handle mask;
   
       mask = pdf_new_obj (PT_ARRAY);
       
-      pdf_add_array_elem (mask, pdf_new_integer (transparency->red.first));
-      pdf_add_array_elem (mask, pdf_new_integer (transparency->red.last));
+      pdf_add_array_elem (mask, pdf_new_integer (params->transparency.red.first));
+      pdf_add_array_elem (mask, pdf_new_integer (params->transparency.red.last));
 
       pdf_set_dict_entry (stream_dict, "Mask", mask);
     }
 
-  if (! (overlay && overlay->imagemask))
+  if (! image->imagemask)
     {
-      if (colormap)
+      if (params->colormapped)
 	{
-	  color_index [0] = (char) colormap->black_map.red;
-	  color_index [1] = (char) colormap->black_map.green;
-	  color_index [2] = (char) colormap->black_map.blue;
-	  color_index [3] = (char) colormap->white_map.red;
-	  color_index [4] = (char) colormap->white_map.green;
-	  color_index [5] = (char) colormap->white_map.blue;
-
-	  if ((color_space == NULL) || 
-	      (memcmp (color_index, last_color_index, sizeof (MAP_STRING)) != 0))
+	  if ((pdf_file->g4_color_space == NULL) || 
+	      (memcmp (params->color_index, pdf_file->g4_color_index, sizeof (params->color_index)) != 0))
 	    {
-	      memcpy (last_color_index, color_index, sizeof (MAP_STRING));
+	      pdf_obj_handle color_space;
+
+	      memcpy (pdf_file->g4_color_index, params->color_index, sizeof (params->color_index));
 
 	      color_space = pdf_new_obj (PT_ARRAY);
 	      pdf_add_array_elem (color_space, pdf_new_name ("Indexed"));
 	      pdf_add_array_elem (color_space, pdf_new_name ("DeviceRGB"));
 	      pdf_add_array_elem (color_space, pdf_new_integer (1));
-	      pdf_add_array_elem (color_space, pdf_new_string_n (color_index, 6));
+	      pdf_add_array_elem (color_space, pdf_new_string_n (params->color_index, 6));
 
-	      color_space = pdf_new_ind_ref (pdf_page->pdf_file, color_space);
+	      if (pdf_file->g4_color_space)
+		unref (pdf_file->g4_color_space);
+	      pdf_file->g4_color_space = ref (pdf_new_ind_ref (pdf_file, color_space));
 	    }
 
-	  pdf_set_dict_entry (stream_dict, "ColorSpace", color_space);
+	  pdf_set_dict_entry (stream_dict, "ColorSpace", pdf_file->g4_color_space);
 	}
       else
 	pdf_set_dict_entry (stream_dict, "ColorSpace", pdf_new_name ("DeviceGray"));
@@ -217,16 +196,89 @@ void pdf_write_g4_fax_image (pdf_page_handle pdf_page,
 		      "Rows",
 		      pdf_new_integer (image->Rows));
 
-  if (negative)
+  if (params->negative)
     pdf_set_dict_entry (decode_parms,
 			"BlackIs1",
 			pdf_new_bool (true));
 
   pdf_stream_add_filter (stream, "CCITTFaxDecode", decode_parms);
 
-  /* the following will write the stream, using our callback function to
-     get the actual data */
-  pdf_write_ind_obj (pdf_page->pdf_file, stream);
+  return (stream);
+}
+
+
+void pdf_write_g4_fax_image (pdf_page_handle pdf_page,
+			     double x,
+			     double y,
+			     double width,
+			     double height,
+			     bool negative,
+			     Bitmap *bitmap,
+			     overlay_t *overlay,
+			     colormap_t *colormap,
+			     rgb_range_t *transparency)
+{
+  struct pdf_g4_image *image;
+  struct pdf_g4_image_params params;
+  struct pdf_image_key key;
+
+  if (transparency && (overlay && overlay->imagemask))
+  {
+    fprintf(stderr, "Can't use transparency or color map with an image mask.\n");
+    exit(2);  // XXX should be a failure return value
+  }
+
+  pdf_add_array_elem_unique (pdf_page->procset, pdf_new_name ("ImageB"));
+
+  image = pdf_calloc (1, sizeof (struct pdf_g4_image));
+
+  pdf_image_matrix (pdf_page, x, y, width, height, image->matrix);
+
+  image->bitmap = bitmap;
+  image->Columns = bitmap->rect.max.x - bitmap->rect.min.x;
+  image->Rows = bitmap->rect.max.y - bitmap->rect.min.y;
+
+  if (overlay && overlay->imagemask)
+    {
+      image->imagemask = true;
+      image->fg_red   = overlay->foreground.red   / 255.0;
+      image->fg_green = overlay->foreground.green / 255.0;
+      image->fg_blue  = overlay->foreground.blue  / 255.0;
+    }
+
+  memset (& params, 0, sizeof (params));
+  params.Columns = image->Columns;
+  params.Rows = image->Rows;
+  params.negative = negative;
+  params.imagemask = image->imagemask;
+  if (colormap && ! image->imagemask)
+    {
+      params.colormapped = true;
+      params.color_index [0] = (char) colormap->black_map.red;
+      params.color_index [1] = (char) colormap->black_map.green;
+      params.color_index [2] = (char) colormap->black_map.blue;
+      params.color_index [3] = (char) colormap->white_map.red;
+      params.color_index [4] = (char) colormap->white_map.green;
+      params.color_index [5] = (char) colormap->white_map.blue;
+    }
+  if (transparency)
+    {
+      params.transparent = true;
+      params.transparency = *transparency;
+    }
+
+  /* hashing the bitmap costs much less than encoding it */
+  pdf_image_key_init (& key);
+  pdf_image_key_add (& key, "CCITTFaxDecode", 14);
+  pdf_image_key_add (& key, & params, sizeof (params));
+  pdf_image_key_add_data (& key, bitmap->bits,
+			  (size_t) image->Rows * bitmap->row_words * sizeof (word_t));
+
+  /* the stream is written using our callback function to get the
+     actual data */
+  if (! pdf_reuse_XObject (pdf_page, & key, image->XObject_name))
+    pdf_write_XObject (pdf_page->pdf_file, & key,
+		       pdf_new_g4_XObject (pdf_page, image, & params));
 
   pdf_obj_handle content_stream = pdf_new_ind_ref(pdf_page->pdf_file,
 						  pdf_new_stream (pdf_page->pdf_file,
@@ -234,5 +286,7 @@ void pdf_write_g4_fax_image (pdf_page_handle pdf_page,
 								  & pdf_write_g4_content_callback,
 								  image));
   pdf_page_add_content_stream(pdf_page, content_stream);
-}
 
+  /* both streams have been written */
+  free (image);
+}
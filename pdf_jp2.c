@@ -0,0 +1,225 @@
+/*
+ * tumble: build a PDF file from image files
+ *
+ * PDF routines
+ *
+ * Derived from pdf_jpeg.c written 2003 by Eric Smith <spacewar@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.  Note that permission is
+ * not granted to redistribute this program under the terms of any
+ * other version of the General Public License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111 USA
+ */
+
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+#include "bitblt.h"
+#include "pdf.h"
+#include "pdf_util.h"
+#include "pdf_prim.h"
+#include "pdf_private.h"
+
+
+struct pdf_jp2_image
+{
+  double matrix [6];  /* placement, from pdf_image_matrix */
+  bool color;  /* false for grayscale */
+  uint32_t width_samples, height_samples;
+  FILE *f;
+  long codestream_offset;
+  long codestream_length;
+  char XObject_name [XOBJECT_NAME_SIZE];
+};
+
+
+static void pdf_write_jp2_content_callback (pdf_file_handle pdf_file,
+					    pdf_obj_handle stream,
+					    void *app_data)
+{
+  struct pdf_jp2_image *image = app_data;
+
+  pdf_write_image_matrix (pdf_file, stream, image->matrix);
+  pdf_write_name (pdf_file, image->XObject_name);
+  pdf_stream_printf (pdf_file, stream, "Do Q\r\n");
+}
+
+
+#define JP2_BUFFER_SIZE 8192
+
+/* Copy the contiguous codestream box contents unchanged; JPXDecode
+   accepts a bare JPEG 2000 codestream. */
+static void pdf_write_jp2_image_callback (pdf_file_handle pdf_file,
+					  pdf_obj_handle stream,
+					  void *app_data)
+{
+  struct pdf_jp2_image *image = app_data;
+  long remaining = image->codestream_length;
+  int rlen;
+  uint8_t buffer [JP2_BUFFER_SIZE];
+
+  if (fseek (image->f, image->codestream_offset, SEEK_SET))
+    pdf_fatal ("can't seek to JPEG 2000 codestream\n");
+
+  while (remaining)
+    {
+      rlen = fread (& buffer [0], 1,
+		    (remaining < JP2_BUFFER_SIZE) ? remaining : JP2_BUFFER_SIZE,
+		    image->f);
+      if (ferror (image->f))
+	pdf_fatal ("error on input file\n");
+      if (! rlen)
+	pdf_fatal ("unexpected EOF on input file\n");
+      remaining -= rlen;
+      pdf_stream_write_data (pdf_file, stream, (char *) & buffer [0], rlen);
+    }
+}
+
+
+static pdf_obj_handle pdf_new_jp2_XObject (pdf_page_handle pdf_page,
+					   struct pdf_jp2_image *image,
+					   rgb_range_t *transparency)
+{
+  pdf_obj_handle stream;
+  pdf_obj_handle stream_dict;
+
+  pdf_obj_handle mask;
+
+  stream_dict = pdf_new_obj (PT_DICTIONARY);
+
+  stream = pdf_new_ind_ref (pdf_page->pdf_file,
+			    pdf_new_stream (pdf_page->pdf_file,
+					    stream_dict,
+					    & pdf_write_jp2_image_callback,
+					    image));
+
+  pdf_new_XObject (pdf_page, stream, image->XObject_name);
+
+  pdf_set_dict_entry (stream_dict, "Type",    pdf_new_name ("XObject"));
+  pdf_set_dict_entry (stream_dict, "Subtype", pdf_new_name ("Image"));
+  pdf_set_dict_entry (stream_dict, "Width",   pdf_new_integer (image->width_samples));
+  pdf_set_dict_entry (stream_dict, "Height",  pdf_new_integer (image->height_samples));
+  /* Only the bare codestream is copied, so the color space from the
+     JP2 header has to be given explicitly.  BitsPerComponent is
+     ignored for JPXDecode, and is omitted. */
+  pdf_set_dict_entry (stream_dict, "ColorSpace", pdf_new_name (image->color ? "DeviceRGB" : "DeviceGray"));
+
+  if (transparency)
+    {
+      mask = pdf_new_obj (PT_ARRAY);
+
+      pdf_add_array_elem (mask, pdf_new_integer (transparency->red.first));
+      pdf_add_array_elem (mask, pdf_new_integer (transparency->red.last));
+
+      if (image->color) {
+	pdf_add_array_elem (mask, pdf_new_integer (transparency->green.first));
+	pdf_add_array_elem (mask, pdf_new_integer (transparency->green.last));
+	pdf_add_array_elem (mask, pdf_new_integer (transparency->blue.first));
+	pdf_add_array_elem (mask, pdf_new_integer (transparency->blue.last));
+      }
+
+      pdf_set_dict_entry (stream_dict, "Mask", mask);
+    }
+
+  pdf_stream_add_filter (stream, "JPXDecode", NULL);
+
+  return (stream);
+}
+
+
+/* the parameters that go into the XObject, for its key */
+struct pdf_jp2_image_params
+{
+  bool color;
+  bool transparent;
+  uint32_t width_samples, height_samples;
+  rgb_range_t transparency;
+};
+
+
+void pdf_write_jp2_image (pdf_page_handle pdf_page,
+			  double x,
+			  double y,
+			  double width,
+			  double height,
+			  bool color,
+			  uint32_t width_samples,
+			  uint32_t height_samples,
+			  rgb_range_t *transparency,
+			  FILE *f,
+			  long codestream_offset,
+			  long codestream_length)
+{
+  struct pdf_jp2_image *image;
+  struct pdf_jp2_image_params params;
+  struct pdf_image_key key;
+
+  image = pdf_calloc (1, sizeof (struct pdf_jp2_image));
+
+  pdf_image_matrix (pdf_page, x, y, width, height, image->matrix);
+
+  image->f = f;
+  image->codestream_offset = codestream_offset;
+  image->codestream_length = codestream_length;
+
+  image->color = color;
+  image->width_samples = width_samples;
+  image->height_samples = height_samples;
+
+  /* JPXDecode was introduced in PDF 1.5 */
+  pdf_require_version (pdf_page->pdf_file, 5);
+
+  pdf_add_array_elem_unique (pdf_page->procset,
+			     pdf_new_name (image->color ? "ImageC" : "ImageB"));
+
+  memset (& params, 0, sizeof (params));
+  params.color = color;
+  params.width_samples = width_samples;
+  params.height_samples = height_samples;
+  if (transparency)
+    {
+      params.transparent = true;
+      params.transparency = *transparency;
+    }
+
+  pdf_image_key_init (& key);
+  pdf_image_key_add (& key, "JPXDecode", 9);
+  pdf_image_key_add (& key, & params, sizeof (params));
+  /* the codestream is hashed as it's copied, unless it may be an image
+     that's already been written */
+  pdf_image_key_set_length (& key, codestream_length);
+  if (pdf_image_key_seen (pdf_page->pdf_file, & key))
+    pdf_image_key_add_file (& key, f, codestream_offset, codestream_length);
+
+  /* the stream is written using our callback function to get the
+     actual data */
+  if (! pdf_reuse_XObject (pdf_page, & key, image->XObject_name))
+    pdf_write_XObject (pdf_page->pdf_file, & key,
+		       pdf_new_jp2_XObject (pdf_page, image, transparency));
+
+  pdf_obj_handle content_stream = pdf_new_ind_ref(pdf_page->pdf_file,
+						  pdf_new_stream (pdf_page->pdf_file,
+								  pdf_new_obj (PT_DICTIONARY),
+								  & pdf_write_jp2_content_callback,
+								  image));
+
+  pdf_page_add_content_stream(pdf_page, content_stream);
+
+  /* both streams have been written */
+  free (image);
+}
@@ -41,12 +41,14 @@
 
 struct pdf_jpeg_image
 {
-  double width, height;
-  double x, y;
+  double matrix [6];  /* placement, from pdf_image_matrix */
   bool color;  /* false for grayscale */
+  bool color_transform;  /* YCbCr encoded, only meaningful if color */
   uint32_t width_samples, height_samples;
   FILE *f;
-  char XObject_name [4];
+  uint8_t *data;  /* if not NULL, used instead of f */
+  uint32_t data_length;
+  char XObject_name [XOBJECT_NAME_SIZE];
 };
 
 
@@ -56,10 +58,7 @@ static void pdf_write_jpeg_content_callback (pdf_file_handle pdf_file,
 {
   struct pdf_jpeg_image *image = app_data;
 
-  /* transformation matrix is: width 0 0 height x y cm */
-  pdf_stream_printf (pdf_file, stream, "q %g 0 0 %g %g %g cm ",
-		     image->width, image->height,
-		     image->x, image->y);
+  pdf_write_image_matrix (pdf_file, stream, image->matrix);
   pdf_write_name (pdf_file, image->XObject_name);
   pdf_stream_printf (pdf_file, stream, "Do Q\r\n");
 }
@@ -72,64 +71,36 @@ static void pdf_write_jpeg_image_callback (pdf_file_handle pdf_file,
 					   void *app_data)
 {
   struct pdf_jpeg_image *image = app_data;
-  int rlen, wlen;
-  uint8_t *wp;
-  uint8_t buffer [8192];
+  int rlen;
+  uint8_t buffer [JPEG_BUFFER_SIZE];
+
+  if (image->data)
+    {
+      pdf_stream_write_data (pdf_file, stream,
+			     (char *) image->data, image->data_length);
+      return;
+    }
 
   while (! feof (image->f))
     {
       rlen = fread (& buffer [0], 1, JPEG_BUFFER_SIZE, image->f);
-      wp = & buffer [0];
-      while (rlen)
-	{
-	  wlen = fwrite (wp, 1, rlen, pdf_file->f);
-	  if (feof (pdf_file->f))
-	    pdf_fatal ("unexpected EOF on output file\n");
-	  if (ferror (pdf_file->f))
-	    pdf_fatal ("error on output file\n");
-	  rlen -= wlen;
-	  wp += wlen;
-	}
+      pdf_stream_write_data (pdf_file, stream, (char *) & buffer [0], rlen);
       if (ferror (image->f))
 	pdf_fatal ("error on input file\n");
     }
 }
 
 
-void pdf_write_jpeg_image (pdf_page_handle pdf_page,
-			   double x,
-			   double y,
-			   double width,
-			   double height,
-			   bool color,
-			   uint32_t width_samples,
-			   uint32_t height_samples,
-			   rgb_range_t *transparency,
-			   FILE *f)
+static pdf_obj_handle pdf_new_jpeg_XObject (pdf_page_handle pdf_page,
+					    struct pdf_jpeg_image *image,
+					    rgb_range_t *transparency)
 {
-  struct pdf_jpeg_image *image;
-
   pdf_obj_handle stream;
   pdf_obj_handle stream_dict;
+  pdf_obj_handle decode_parms = NULL;
 
   pdf_obj_handle mask;
 
-  image = pdf_calloc (1, sizeof (struct pdf_jpeg_image));
-
-  image->width = width;
-  image->height = height;
-  image->x = x;
-  image->y = y;
-
-  image->f = f;
-
-  image->color = color;
-  image->width_samples = width_samples;
-  image->height_samples = height_samples;
-
-  pdf_add_array_elem_unique (pdf_page->procset,
-			     pdf_new_name (image->color ? "ImageC" : "ImageB"));
-
   stream_dict = pdf_new_obj (PT_DICTIONARY);
 
   stream = pdf_new_ind_ref (pdf_page->pdf_file,
@@ -138,8 +109,7 @@ void pdf_write_jpeg_image (pdf_page_handle pdf_page,
 					    & pdf_write_jpeg_image_callback,
 					    image));
 
-  strcpy (& image->XObject_name [0], "Im ");
-  image->XObject_name [2] = pdf_new_XObject (pdf_page, stream);
+  pdf_new_XObject (pdf_page, stream, image->XObject_name);
 
   pdf_set_dict_entry (stream_dict, "Type",    pdf_new_name ("XObject"));
   pdf_set_dict_entry (stream_dict, "Subtype", pdf_new_name ("Image"));
@@ -165,11 +135,77 @@ void pdf_write_jpeg_image (pdf_page_handle pdf_page,
       pdf_set_dict_entry (stream_dict, "Mask", mask);
     }
 
-  pdf_stream_add_filter (stream, "DCTDecode", NULL);
+  /* DCTDecode assumes three component data is YCbCr unless an Adobe
+     marker says otherwise, so RGB data needs an explicit override */
+  if (image->color && ! image->color_transform)
+    {
+      decode_parms = pdf_new_obj (PT_DICTIONARY);
+      pdf_set_dict_entry (decode_parms, "ColorTransform", pdf_new_integer (0));
+    }
+
+  pdf_stream_add_filter (stream, "DCTDecode", decode_parms);
+
+  return (stream);
+}
+
+
+/* the parameters that go into the XObject, for its key */
+struct pdf_jpeg_image_params
+{
+  bool color;
+  bool color_transform;
+  bool transparent;
+  uint32_t width_samples, height_samples;
+  rgb_range_t transparency;
+};
+
+
+static void pdf_add_jpeg_image (pdf_page_handle pdf_page,
+				struct pdf_jpeg_image *image,
+				rgb_range_t *transparency)
+{
+  struct pdf_jpeg_image_params params;
+  struct pdf_image_key key;
+
+  pdf_add_array_elem_unique (pdf_page->procset,
+			     pdf_new_name (image->color ? "ImageC" : "ImageB"));
+
+  memset (& params, 0, sizeof (params));
+  params.color = image->color;
+  params.color_transform = image->color_transform;
+  params.width_samples = image->width_samples;
+  params.height_samples = image->height_samples;
+  if (transparency)
+    {
+      params.transparent = true;
+      params.transparency = *transparency;
+    }
+
+  pdf_image_key_init (& key);
+  pdf_image_key_add (& key, "DCTDecode", 9);
+  pdf_image_key_add (& key, & params, sizeof (params));
+  if (image->data)
+    pdf_image_key_add_data (& key, image->data, image->data_length);
+  else
+    {
+      /* the rest of the file is hashed as it's copied, unless it may
+	 be an image that's already been written */
+      long pos = ftell (image->f);
+
+      if ((pos < 0) || fseek (image->f, 0, SEEK_END))
+	pdf_fatal ("can't seek in input file\n");
+      pdf_image_key_set_length (& key, ftell (image->f) - pos);
+      if (fseek (image->f, pos, SEEK_SET))
+	pdf_fatal ("can't seek in input file\n");
+      if (pdf_image_key_seen (pdf_page->pdf_file, & key))
+	pdf_image_key_add_file (& key, image->f, pos, -1);
+    }
 
-  /* the following will write the stream, using our callback function to
-     get the actual data */
-  pdf_write_ind_obj (pdf_page->pdf_file, stream);
+  /* the stream is written using our callback function to get the
+     actual data */
+  if (! pdf_reuse_XObject (pdf_page, & key, image->XObject_name))
+    pdf_write_XObject (pdf_page->pdf_file, & key,
+		       pdf_new_jpeg_XObject (pdf_page, image, transparency));
 
   pdf_obj_handle content_stream = pdf_new_ind_ref(pdf_page->pdf_file,
 						  pdf_new_stream (pdf_page->pdf_file,
@@ -178,4 +214,66 @@ void pdf_write_jpeg_image (pdf_page_handle pdf_page,
 								  image));
 
   pdf_page_add_content_stream(pdf_page, content_stream);
+
+  /* both streams have been written, so the caller may free the data */
+  free (image);
+}
+
+
+void pdf_write_jpeg_image (pdf_page_handle pdf_page,
+			   double x,
+			   double y,
+			   double width,
+			   double height,
+			   bool color,
+			   uint32_t width_samples,
+			   uint32_t height_samples,
+			   rgb_range_t *transparency,
+			   FILE *f)
+{
+  struct pdf_jpeg_image *image;
+
+  image = pdf_calloc (1, sizeof (struct pdf_jpeg_image));
+
+  pdf_image_matrix (pdf_page, x, y, width, height, image->matrix);
+
+  image->f = f;
+
+  image->color = color;
+  image->color_transform = true;
+  image->width_samples = width_samples;
+  image->height_samples = height_samples;
+
+  pdf_add_jpeg_image (pdf_page, image, transparency);
+}
+
+
+void pdf_write_jpeg_image_data (pdf_page_handle pdf_page,
+				double x,
+				double y,
+				double width,
+				double height,
+				bool color,
+				bool color_transform,
+				uint32_t width_samples,
+				uint32_t height_samples,
+				rgb_range_t *transparency,
+				uint8_t *data,
+				uint32_t data_length)
+{
+  struct pdf_jpeg_image *image;
+
+  image = pdf_calloc (1, sizeof (struct pdf_jpeg_image));
+
+  pdf_image_matrix (pdf_page, x, y, width, height, image->matrix);
+
+  image->data = data;
+  image->data_length = data_length;
+
+  image->color = color;
+  image->color_transform = color_transform;
+  image->width_samples = width_samples;
+  image->height_samples = height_samples;
+
+  pdf_add_jpeg_image (pdf_page, image, transparency);
 }
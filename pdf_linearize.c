@@ -0,0 +1,925 @@
+/*
+ * tumble: build a PDF file from image files
+ *
+ * PDF routines
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.  Note that permission is
+ * not granted to redistribute this program under the terms of any
+ * other version of the General Public License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111 USA
+ */
+
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+#include "bitblt.h"
+#include "pdf.h"
+#include "pdf_util.h"
+#include "pdf_prim.h"
+#include "pdf_private.h"
+
+
+/* A linearized file (PDF 1.4 spec, Appendix F) starts with everything
+   needed to show the first page, and a hint stream that tells a viewer
+   where to find each of the other pages, so that the first page can be
+   shown before the rest of the file has arrived.
+
+   Objects are numbered in the order they're placed, which isn't known
+   until every page has been made, so until the file is closed they are
+   written without their headers to a temporary file, the spool, and
+   where each reference was written is noted, without its number.
+   pdf_write_linearized then copies them to the file in their final
+   order, filling in the numbers.
+
+   The file is laid out in the parts of the spec:
+
+     1  header
+     2  linearization dictionary
+     3  cross reference table and trailer of the first page section
+     4  catalog, and the outlines if they're shown when the file opens
+     5  hint stream
+     6  the first page, the objects only it uses, and the shared
+        objects it uses
+     7  each of the other pages, and the objects only it uses
+     8  the other shared objects
+     9  everything else: the page tree, the Info dictionary, and so on
+     11 main cross reference table and trailer
+
+   The objects of parts 7 to 9 are numbered from 1, and those of parts
+   2 to 6 after them, so that each cross reference table has one
+   section. */
+
+struct pdf_lin_ref
+{
+  long int      offset;   /* in the spool, where the number goes */
+  unsigned long obj_num;  /* referred to */
+};
+
+
+struct pdf_linearization
+{
+  FILE *f;  /* the output file, while objects go to the spool */
+
+  unsigned long *spooled;  /* object numbers, in the order spooled */
+  unsigned long spooled_count;
+  unsigned long spooled_alloc;
+
+  struct pdf_lin_ref *refs;  /* in the order written */
+  unsigned long ref_count;
+  unsigned long ref_alloc;
+
+  unsigned long *pages;  /* object numbers of the pages, in order */
+  unsigned long page_count;
+  unsigned long page_alloc;
+
+  unsigned long *page_tree;  /* object numbers of the Pages nodes */
+  unsigned long page_tree_count;
+  unsigned long page_tree_alloc;
+};
+
+
+#define OWNER_NONE   0
+#define OWNER_SHARED (-1)
+
+
+/* what's known of each object when it's placed */
+struct pdf_lin_obj
+{
+  long int      spool_offset;
+  long int      spool_length;
+  unsigned long first_ref;  /* in refs */
+  unsigned long ref_count;
+  bool          page_tree;  /* a page or Pages node, which searches stop at */
+  long int      owner;  /* the only page that uses it, or OWNER_ */
+  bool          first_page_shared;  /* shared, and used by the first page */
+  unsigned long mark;  /* of the last search that reached it */
+  int           part;
+  unsigned long shared_id;  /* in the shared object hint table */
+  unsigned long new_num;
+  long int      offset;  /* in the file */
+  long int      size;  /* in the file */
+};
+
+
+struct pdf_lin_layout
+{
+  struct pdf_linearization *lin;
+  struct pdf_lin_obj *objs;  /* by old object number */
+  unsigned long obj_count;
+  unsigned long *found;  /* by pdf_lin_reach */
+
+  unsigned long *order;  /* old object numbers, in the order placed */
+  unsigned long part4_start, part6_start, part7_start;
+  unsigned long part8_start, part9_start;
+  unsigned long *page_start;  /* of each page in order, and of part 8 */
+
+  unsigned long *page_shared;  /* shared objects used by pages after the first */
+  unsigned long *page_shared_start;  /* of each page in page_shared */
+  unsigned long page_shared_count;
+  unsigned long page_shared_alloc;
+};
+
+
+struct pdf_lin_bits
+{
+  uint8_t *data;
+  unsigned long bit;  /* next to be written */
+  unsigned long alloc;  /* bytes */
+};
+
+
+/* makes room for one more element in a growing array */
+static void *pdf_lin_grow (void *array,
+			   unsigned long count,
+			   unsigned long *alloc,
+			   size_t size)
+{
+  if (count < *alloc)
+    return array;
+  *alloc = 2 * *alloc + 1024;
+  array = realloc (array, *alloc * size);
+  if (! array)
+    pdf_fatal ("can't allocate linearization tables\n");
+  return array;
+}
+
+
+/* Objects are spooled from here on.  The header has been written to
+   the output buffer, but it's written again once the version is
+   known. */
+void pdf_linearize (pdf_file_handle pdf_file)
+{
+  struct pdf_linearization *lin;
+
+  if (pdf_file->object_streams)
+    pdf_fatal ("linearized files can't use object streams\n");
+  pdf_assert (! pdf_file->out_offset);
+
+  lin = pdf_calloc (1, sizeof (struct pdf_linearization));
+  lin->f = pdf_file->f;
+  pdf_file->f = tmpfile ();
+  if (! pdf_file->f)
+    pdf_fatal ("can't create temporary file\n");
+  pdf_file->out_used = 0;
+  pdf_file->lin = lin;
+}
+
+
+void pdf_lin_note_obj (pdf_file_handle pdf_file, unsigned long obj_num)
+{
+  struct pdf_linearization *lin = pdf_file->lin;
+
+  lin->spooled = pdf_lin_grow (lin->spooled, lin->spooled_count,
+			       & lin->spooled_alloc, sizeof (unsigned long));
+  lin->spooled [lin->spooled_count++] = obj_num;
+}
+
+
+void pdf_lin_note_ref (pdf_file_handle pdf_file, unsigned long obj_num)
+{
+  struct pdf_linearization *lin = pdf_file->lin;
+
+  lin->refs = pdf_lin_grow (lin->refs, lin->ref_count,
+			    & lin->ref_alloc, sizeof (struct pdf_lin_ref));
+  lin->refs [lin->ref_count].offset = pdf_output_offset (pdf_file);
+  lin->refs [lin->ref_count].obj_num = obj_num;
+  lin->ref_count++;
+}
+
+
+void pdf_lin_note_page (pdf_file_handle pdf_file, pdf_obj_handle page_dict)
+{
+  struct pdf_linearization *lin = pdf_file->lin;
+
+  if (! lin)
+    return;
+  lin->pages = pdf_lin_grow (lin->pages, lin->page_count,
+			     & lin->page_alloc, sizeof (unsigned long));
+  lin->pages [lin->page_count++] = pdf_obj_num (page_dict);
+}
+
+
+void pdf_lin_note_pages (pdf_file_handle pdf_file, pdf_obj_handle pages_dict)
+{
+  struct pdf_linearization *lin = pdf_file->lin;
+
+  if (! lin)
+    return;
+  lin->page_tree = pdf_lin_grow (lin->page_tree, lin->page_tree_count,
+				 & lin->page_tree_alloc, sizeof (unsigned long));
+  lin->page_tree [lin->page_tree_count++] = pdf_obj_num (pages_dict);
+}
+
+
+static int pdf_lin_digits (unsigned long val)
+{
+  int digits = 1;
+
+  while (val >= 10)
+    {
+      val /= 10;
+      digits++;
+    }
+  return digits;
+}
+
+
+/* the number of bits needed to hold val */
+static int pdf_lin_bit_count (unsigned long val)
+{
+  int bits = 0;
+
+  while (val)
+    {
+      val >>= 1;
+      bits++;
+    }
+  return bits;
+}
+
+
+static void pdf_lin_put_bits (struct pdf_lin_bits *bits,
+			      unsigned long val,
+			      int count)
+{
+  while (count--)
+    {
+      if (! (bits->bit % 8))
+	{
+	  bits->data = pdf_lin_grow (bits->data, bits->bit / 8,
+				     & bits->alloc, 1);
+	  bits->data [bits->bit / 8] = 0;
+	}
+      if ((val >> count) & 1)
+	bits->data [bits->bit / 8] |= 0x80 >> (bits->bit % 8);
+      bits->bit++;
+    }
+}
+
+
+/* each item of the hint tables starts on a byte boundary */
+static void pdf_lin_align_bits (struct pdf_lin_bits *bits)
+{
+  bits->bit = (bits->bit + 7) & ~ 7UL;
+}
+
+
+/* Finds the objects reached from root by references, not passing
+   through any page or Pages node, or any object already placed.  They
+   are left in found, root first, and their count is returned. */
+static unsigned long pdf_lin_reach (struct pdf_lin_layout *layout,
+				    unsigned long root,
+				    unsigned long mark)
+{
+  struct pdf_lin_obj *objs = layout->objs;
+  struct pdf_lin_ref *refs = layout->lin->refs;
+  unsigned long count = 0;
+  unsigned long i, r;
+
+  objs [root].mark = mark;
+  layout->found [count++] = root;
+  for (i = 0; i < count; i++)
+    {
+      struct pdf_lin_obj *obj = & objs [layout->found [i]];
+
+      for (r = obj->first_ref; r < obj->first_ref + obj->ref_count; r++)
+	{
+	  struct pdf_lin_obj *target = & objs [refs [r].obj_num];
+
+	  if (target->page_tree || target->part || (target->mark == mark))
+	    continue;
+	  target->mark = mark;
+	  layout->found [count++] = refs [r].obj_num;
+	}
+    }
+  return count;
+}
+
+
+/* Each object is taken by the first page that uses it, and is shared if
+   another page uses it too.  The shared objects used by each page are
+   then found. */
+static void pdf_lin_find_owners (struct pdf_lin_layout *layout)
+{
+  struct pdf_linearization *lin = layout->lin;
+  struct pdf_lin_obj *objs = layout->objs;
+  unsigned long page_count = lin->page_count;
+  unsigned long p, i, count;
+
+  for (p = 1; p <= page_count; p++)
+    {
+      count = pdf_lin_reach (layout, lin->pages [p - 1], p);
+      objs [lin->pages [p - 1]].owner = p;
+      for (i = 1; i < count; i++)
+	{
+	  struct pdf_lin_obj *obj = & objs [layout->found [i]];
+
+	  if (obj->owner == OWNER_NONE)
+	    obj->owner = p;
+	  else if (obj->owner != (long) p)
+	    obj->owner = OWNER_SHARED;
+	}
+    }
+
+  layout->page_shared_start = pdf_calloc (page_count + 2, sizeof (unsigned long));
+  for (p = 1; p <= page_count; p++)
+    {
+      layout->page_shared_start [p] = layout->page_shared_count;
+      count = pdf_lin_reach (layout, lin->pages [p - 1], page_count + p);
+      for (i = 1; i < count; i++)
+	{
+	  unsigned long num = layout->found [i];
+
+	  if (objs [num].owner != OWNER_SHARED)
+	    continue;
+	  if (p == 1)
+	    {
+	      objs [num].first_page_shared = true;
+	      continue;
+	    }
+	  layout->page_shared = pdf_lin_grow (layout->page_shared,
+					      layout->page_shared_count,
+					      & layout->page_shared_alloc,
+					      sizeof (unsigned long));
+	  layout->page_shared [layout->page_shared_count++] = num;
+	}
+    }
+  layout->page_shared_start [page_count + 1] = layout->page_shared_count;
+}
+
+
+static void pdf_lin_place (struct pdf_lin_layout *layout,
+			   unsigned long *placed,
+			   unsigned long num,
+			   int part)
+{
+  layout->objs [num].part = part;
+  layout->order [(*placed)++] = num;
+}
+
+
+/* Puts the objects in the order of the parts, each part in the order
+   the objects were spooled, except that each page comes first in its
+   part. */
+static void pdf_lin_order (struct pdf_lin_layout *layout,
+			   unsigned long catalog,
+			   unsigned long outlines)
+{
+  struct pdf_linearization *lin = layout->lin;
+  struct pdf_lin_obj *objs = layout->objs;
+  unsigned long page_count = lin->page_count;
+  unsigned long *spooled = lin->spooled;
+  unsigned long placed = 0;
+  unsigned long *next;
+  unsigned long i, p, count;
+
+  layout->order = pdf_calloc (layout->obj_count, sizeof (unsigned long));
+
+  layout->part4_start = placed;
+  pdf_lin_place (layout, & placed, catalog, 4);
+  if (outlines)
+    {
+      count = pdf_lin_reach (layout, outlines, 2 * page_count + 1);
+      for (i = 0; i < count; i++)
+	objs [layout->found [i]].part = 4;
+      for (i = 0; i < layout->obj_count; i++)
+	if ((objs [spooled [i]].part == 4) && (spooled [i] != catalog))
+	  layout->order [placed++] = spooled [i];
+    }
+
+  layout->part6_start = placed;
+  pdf_lin_place (layout, & placed, lin->pages [0], 6);
+  for (i = 0; i < layout->obj_count; i++)
+    {
+      struct pdf_lin_obj *obj = & objs [spooled [i]];
+
+      if ((! obj->part) && ((obj->owner == 1) || obj->first_page_shared))
+	pdf_lin_place (layout, & placed, spooled [i], 6);
+    }
+
+  /* the objects of each page are counted, and then placed after the
+     page */
+  layout->part7_start = placed;
+  layout->page_start = pdf_calloc (page_count + 2, sizeof (unsigned long));
+  next = pdf_calloc (page_count + 2, sizeof (unsigned long));
+  for (i = 0; i < layout->obj_count; i++)
+    if ((! objs [spooled [i]].part) && (objs [spooled [i]].owner > 1))
+      layout->page_start [objs [spooled [i]].owner]++;
+  for (p = 2; p <= page_count + 1; p++)
+    {
+      count = layout->page_start [p];
+      layout->page_start [p] = placed;
+      placed += count;
+    }
+  for (p = 2; p <= page_count; p++)
+    {
+      next [p] = layout->page_start [p];
+      pdf_lin_place (layout, & next [p], lin->pages [p - 1], 7);
+    }
+  for (i = 0; i < layout->obj_count; i++)
+    {
+      struct pdf_lin_obj *obj = & objs [spooled [i]];
+
+      if ((! obj->part) && (obj->owner > 1))
+	pdf_lin_place (layout, & next [obj->owner], spooled [i], 7);
+    }
+  free (next);
+
+  layout->part8_start = placed;
+  for (i = 0; i < layout->obj_count; i++)
+    if ((! objs [spooled [i]].part) && (objs [spooled [i]].owner == OWNER_SHARED))
+      pdf_lin_place (layout, & placed, spooled [i], 8);
+
+  layout->part9_start = placed;
+  for (i = 0; i < layout->obj_count; i++)
+    if (! objs [spooled [i]].part)
+      pdf_lin_place (layout, & placed, spooled [i], 9);
+
+  pdf_assert (placed == layout->obj_count);
+}
+
+
+/* bytes that an object will take in the file, once it's numbered */
+static long pdf_lin_obj_size (struct pdf_lin_layout *layout,
+			      struct pdf_lin_obj *obj)
+{
+  long size = pdf_lin_digits (obj->new_num) + strlen (" 0 obj\r\n");
+  unsigned long r;
+
+  size += obj->spool_length + strlen ("endobj\r\n");
+  for (r = obj->first_ref; r < obj->first_ref + obj->ref_count; r++)
+    size += pdf_lin_digits (layout->objs [layout->lin->refs [r].obj_num].new_num) + 1;
+  return size;
+}
+
+
+/* the range of objects in order that make up page p */
+static void pdf_lin_page_range (struct pdf_lin_layout *layout,
+				unsigned long p,
+				unsigned long *first,
+				unsigned long *end)
+{
+  *first = (p == 1) ? layout->part6_start : layout->page_start [p];
+  *end = (p == 1) ? layout->part7_start : layout->page_start [p + 1];
+}
+
+
+static long pdf_lin_range_length (struct pdf_lin_layout *layout,
+				  unsigned long first,
+				  unsigned long end)
+{
+  struct pdf_lin_obj *last = & layout->objs [layout->order [end - 1]];
+
+  return last->offset + last->size - layout->objs [layout->order [first]].offset;
+}
+
+
+/* The page offset hint table, then the shared object hint table, whose
+   offset is returned in *shared_table.  Offsets in the tables are those
+   the objects would have without the hint stream, which is how they
+   are laid out when this is called. */
+static void pdf_lin_hint_tables (struct pdf_lin_layout *layout,
+				 struct pdf_lin_bits *bits,
+				 unsigned long *shared_table)
+{
+  struct pdf_lin_obj *objs = layout->objs;
+  unsigned long page_count = layout->lin->page_count;
+  unsigned long part6_count = layout->part7_start - layout->part6_start;
+  unsigned long part8_count = layout->part9_start - layout->part8_start;
+  unsigned long min_objs = ~ 0UL, max_objs = 0;
+  long min_length = -1, max_length = 0;
+  unsigned long max_shared = 0, max_shared_id = 0;
+  unsigned long p, i, first, end;
+  int objs_bits, length_bits, shared_bits, shared_id_bits;
+
+  for (i = layout->part6_start; i < layout->part7_start; i++)
+    objs [layout->order [i]].shared_id = i - layout->part6_start;
+  for (i = layout->part8_start; i < layout->part9_start; i++)
+    objs [layout->order [i]].shared_id = part6_count + i - layout->part8_start;
+
+  for (p = 1; p <= page_count; p++)
+    {
+      unsigned long shared = (layout->page_shared_start [p + 1] -
+			      layout->page_shared_start [p]);
+      long length;
+
+      pdf_lin_page_range (layout, p, & first, & end);
+      length = pdf_lin_range_length (layout, first, end);
+      if (end - first < min_objs)
+	min_objs = end - first;
+      if (end - first > max_objs)
+	max_objs = end - first;
+      if ((min_length < 0) || (length < min_length))
+	min_length = length;
+      if (length > max_length)
+	max_length = length;
+      if (shared > max_shared)
+	max_shared = shared;
+    }
+  for (i = 0; i < layout->page_shared_count; i++)
+    if (objs [layout->page_shared [i]].shared_id > max_shared_id)
+      max_shared_id = objs [layout->page_shared [i]].shared_id;
+
+  objs_bits = pdf_lin_bit_count (max_objs - min_objs);
+  length_bits = pdf_lin_bit_count (max_length - min_length);
+  shared_bits = pdf_lin_bit_count (max_shared);
+  shared_id_bits = pdf_lin_bit_count (max_shared_id);
+
+  /* page offset hint table header; the content of each page is taken
+     to be all of it */
+  pdf_lin_put_bits (bits, min_objs, 32);
+  pdf_lin_put_bits (bits, objs [layout->order [layout->part6_start]].offset, 32);
+  pdf_lin_put_bits (bits, objs_bits, 16);
+  pdf_lin_put_bits (bits, min_length, 32);
+  pdf_lin_put_bits (bits, length_bits, 16);
+  pdf_lin_put_bits (bits, 0, 32);  /* least content stream offset */
+  pdf_lin_put_bits (bits, 0, 16);
+  pdf_lin_put_bits (bits, min_length, 32);  /* least content stream length */
+  pdf_lin_put_bits (bits, length_bits, 16);
+  pdf_lin_put_bits (bits, shared_bits, 16);
+  pdf_lin_put_bits (bits, shared_id_bits, 16);
+  pdf_lin_put_bits (bits, 0, 16);  /* bits of the fraction numerator */
+  pdf_lin_put_bits (bits, 1, 16);  /* fraction denominator */
+
+  /* each item of the page entries is written for every page in turn */
+  for (p = 1; p <= page_count; p++)
+    {
+      pdf_lin_page_range (layout, p, & first, & end);
+      pdf_lin_put_bits (bits, end - first - min_objs, objs_bits);
+    }
+  pdf_lin_align_bits (bits);
+  for (p = 1; p <= page_count; p++)
+    {
+      pdf_lin_page_range (layout, p, & first, & end);
+      pdf_lin_put_bits (bits, pdf_lin_range_length (layout, first, end) - min_length,
+			length_bits);
+    }
+  pdf_lin_align_bits (bits);
+  for (p = 1; p <= page_count; p++)
+    pdf_lin_put_bits (bits,
+		      layout->page_shared_start [p + 1] - layout->page_shared_start [p],
+		      shared_bits);
+  pdf_lin_align_bits (bits);
+  for (i = 0; i < layout->page_shared_count; i++)
+    pdf_lin_put_bits (bits, objs [layout->page_shared [i]].shared_id, shared_id_bits);
+  pdf_lin_align_bits (bits);
+  /* the numerators and content stream offsets take no bits */
+  for (p = 1; p <= page_count; p++)
+    {
+      pdf_lin_page_range (layout, p, & first, & end);
+      pdf_lin_put_bits (bits, pdf_lin_range_length (layout, first, end) - min_length,
+			length_bits);
+    }
+  pdf_lin_align_bits (bits);
+
+  /* shared object hint table, with a group for each object of the
+     first page, and then for each of part 8 */
+  *shared_table = bits->bit / 8;
+  min_length = -1;
+  max_length = 0;
+  for (i = 0; i < part6_count + part8_count; i++)
+    {
+      unsigned long k = (i < part6_count) ? (layout->part6_start + i)
+	                                  : (layout->part8_start + i - part6_count);
+      long size = objs [layout->order [k]].size;
+
+      if ((min_length < 0) || (size < min_length))
+	min_length = size;
+      if (size > max_length)
+	max_length = size;
+    }
+  length_bits = pdf_lin_bit_count (max_length - min_length);
+
+  if (part8_count)
+    {
+      struct pdf_lin_obj *obj = & objs [layout->order [layout->part8_start]];
+
+      pdf_lin_put_bits (bits, obj->new_num, 32);
+      pdf_lin_put_bits (bits, obj->offset, 32);
+    }
+  else
+    {
+      pdf_lin_put_bits (bits, 0, 32);
+      pdf_lin_put_bits (bits, 0, 32);
+    }
+  pdf_lin_put_bits (bits, part6_count, 32);
+  pdf_lin_put_bits (bits, part6_count + part8_count, 32);
+  pdf_lin_put_bits (bits, 0, 16);  /* bits of the objects in a group */
+  pdf_lin_put_bits (bits, min_length, 32);
+  pdf_lin_put_bits (bits, length_bits, 16);
+
+  for (i = 0; i < part6_count + part8_count; i++)
+    {
+      unsigned long k = (i < part6_count) ? (layout->part6_start + i)
+	                                  : (layout->part8_start + i - part6_count);
+
+      pdf_lin_put_bits (bits, objs [layout->order [k]].size - min_length, length_bits);
+    }
+  pdf_lin_align_bits (bits);
+  for (i = 0; i < part6_count + part8_count; i++)
+    pdf_lin_put_bits (bits, 0, 1);  /* no MD5 signature */
+  pdf_lin_align_bits (bits);
+}
+
+
+/* Copies an object from the spool, with its header and the numbers of
+   the objects it refers to. */
+static void pdf_lin_copy_obj (pdf_file_handle pdf_file,
+			      struct pdf_lin_layout *layout,
+			      FILE *spool,
+			      unsigned long num)
+{
+  struct pdf_lin_obj *obj = & layout->objs [num];
+  struct pdf_lin_ref *refs = layout->lin->refs;
+  char buf [4096];
+  long pos = obj->spool_offset;
+  long end = obj->spool_offset + obj->spool_length;
+  unsigned long r = obj->first_ref;
+
+  pdf_assert (pdf_output_offset (pdf_file) == obj->offset);
+
+  pdf_out_integer (pdf_file, obj->new_num);
+  pdf_out_string (pdf_file, " 0 obj\r\n");
+  if (fseek (spool, pos, SEEK_SET))
+    pdf_fatal ("error reading temporary file\n");
+  for (;;)
+    {
+      long stop = (r < obj->first_ref + obj->ref_count) ? refs [r].offset : end;
+
+      while (pos < stop)
+	{
+	  size_t len = stop - pos;
+
+	  if (len > sizeof (buf))
+	    len = sizeof (buf);
+	  if (fread (buf, 1, len, spool) != len)
+	    pdf_fatal ("error reading temporary file\n");
+	  pdf_out_data (pdf_file, buf, len);
+	  pos += len;
+	}
+      if (stop == end)
+	break;
+      pdf_out_integer (pdf_file, layout->objs [refs [r].obj_num].new_num);
+      pdf_out_string (pdf_file, " ");
+      r++;
+    }
+  pdf_out_string (pdf_file, "endobj\r\n");
+
+  pdf_assert (pdf_output_offset (pdf_file) == obj->offset + obj->size);
+}
+
+
+/* With no pages, the objects are written in the order they were
+   spooled, as a file that isn't linearized. */
+static void pdf_lin_write_plain (pdf_file_handle pdf_file,
+				 struct pdf_lin_layout *layout,
+				 FILE *spool,
+				 unsigned long catalog,
+				 unsigned long info)
+{
+  struct pdf_lin_obj *objs = layout->objs;
+  unsigned long *spooled = layout->lin->spooled;
+  unsigned long i;
+  long xref_offset;
+
+  for (i = 0; i < layout->obj_count; i++)
+    objs [spooled [i]].new_num = i + 1;
+  for (i = 0; i < layout->obj_count; i++)
+    {
+      objs [spooled [i]].offset = pdf_output_offset (pdf_file);
+      objs [spooled [i]].size = pdf_lin_obj_size (layout, & objs [spooled [i]]);
+      pdf_lin_copy_obj (pdf_file, layout, spool, spooled [i]);
+    }
+
+  xref_offset = pdf_output_offset (pdf_file);
+  pdf_out_string (pdf_file, "xref\r\n0 ");
+  pdf_out_integer (pdf_file, layout->obj_count + 1);
+  pdf_out_string (pdf_file, "\r\n0000000000 65535 f\r\n");
+  for (i = 0; i < layout->obj_count; i++)
+    pdf_out_xref_entry (pdf_file, objs [spooled [i]].offset);
+  pdf_out_string (pdf_file, "trailer\r\n<< /Size ");
+  pdf_out_integer (pdf_file, layout->obj_count + 1);
+  pdf_out_string (pdf_file, " /Root ");
+  pdf_out_integer (pdf_file, objs [catalog].new_num);
+  pdf_out_string (pdf_file, " 0 R /Info ");
+  pdf_out_integer (pdf_file, objs [info].new_num);
+  pdf_out_string (pdf_file, " 0 R >>\r\nstartxref\r\n");
+  pdf_out_integer (pdf_file, xref_offset);
+  pdf_out_string (pdf_file, "\r\n%%EOF\r\n");
+}
+
+
+/* The fixed width fields of the linearization dictionary and the first
+   page trailer are filled in once the offsets are known, so the
+   lengths of these don't change. */
+#define LIN_DICT_FORMAT "%lu 0 obj\r\n<< /Linearized 1 /L %10ld /H [ %10ld %10ld ] " \
+                        "/O %lu /E %10ld /N %lu /T %10ld >>\r\nendobj\r\n"
+
+#define FIRST_TRAILER_FORMAT "trailer\r\n<< /Size %lu /Root %lu 0 R /Info %lu 0 R " \
+                             "/Prev %10ld >>\r\nstartxref\r\n0\r\n%%%%EOF\r\n"
+
+
+void pdf_write_linearized (pdf_file_handle pdf_file, unsigned long outlines)
+{
+  struct pdf_linearization *lin = pdf_file->lin;
+  struct pdf_lin_layout layout;
+  struct pdf_lin_obj *objs;
+  struct pdf_lin_bits bits;
+  FILE *spool;
+  unsigned long catalog = pdf_obj_num (pdf_file->catalog);
+  unsigned long info = pdf_obj_num (pdf_file->info);
+  unsigned long i, r, m, lin_num, hint_num, shared_table;
+  unsigned long first_count;  /* of objects in the first page section */
+  long spool_end, pos, hint_offset = 0, hint_length, first_page_end;
+  long lin_offset, first_xref_offset, main_xref_offset, file_length;
+  char text [512];
+  long lin_length, first_xref_length, main_xref_length;
+
+  pdf_flush_output (pdf_file);
+  spool = pdf_file->f;
+  spool_end = pdf_output_offset (pdf_file);
+  if (fflush (spool))
+    pdf_fatal ("error writing temporary file\n");
+
+  memset (& layout, 0, sizeof (layout));
+  layout.lin = lin;
+  layout.obj_count = pdf_file->obj_count;
+  pdf_assert (lin->spooled_count == layout.obj_count);
+  pdf_assert (lin->page_count == pdf_file->page_count);
+  objs = pdf_calloc (layout.obj_count + 1, sizeof (struct pdf_lin_obj));
+  layout.objs = objs;
+  layout.found = pdf_calloc (layout.obj_count, sizeof (unsigned long));
+
+  /* the spool holds the objects back to back, and each holds the
+     references written since it began */
+  for (i = 0, r = 0; i < layout.obj_count; i++)
+    {
+      struct pdf_lin_obj *obj = & objs [lin->spooled [i]];
+
+      obj->spool_offset = pdf_file->xref [lin->spooled [i]].offset;
+      obj->spool_length = ((i + 1 < layout.obj_count)
+			   ? pdf_file->xref [lin->spooled [i + 1]].offset
+			   : spool_end) - obj->spool_offset;
+      obj->first_ref = r;
+      while ((r < lin->ref_count) &&
+	     (lin->refs [r].offset < obj->spool_offset + obj->spool_length))
+	r++;
+      obj->ref_count = r - obj->first_ref;
+    }
+  pdf_assert (r == lin->ref_count);
+
+  /* the output file gets the objects from here on */
+  pdf_file->f = lin->f;
+  pdf_file->out_offset = 0;
+  pdf_write_header (pdf_file);
+
+  if (! lin->page_count)
+    {
+      pdf_lin_write_plain (pdf_file, & layout, spool, catalog, info);
+      goto done;
+    }
+
+  for (i = 0; i < lin->page_count; i++)
+    objs [lin->pages [i]].page_tree = true;
+  for (i = 0; i < lin->page_tree_count; i++)
+    objs [lin->page_tree [i]].page_tree = true;
+
+  pdf_lin_find_owners (& layout);
+  pdf_lin_order (& layout, catalog, outlines);
+
+  /* parts 7 to 9 are numbered first, then the linearization
+     dictionary, part 4, the hint stream, and part 6 */
+  m = layout.obj_count - layout.part7_start;
+  for (i = layout.part7_start; i < layout.obj_count; i++)
+    objs [layout.order [i]].new_num = i - layout.part7_start + 1;
+  lin_num = m + 1;
+  for (i = layout.part4_start; i < layout.part6_start; i++)
+    objs [layout.order [i]].new_num = lin_num + 1 + i - layout.part4_start;
+  hint_num = lin_num + 1 + layout.part6_start - layout.part4_start;
+  for (i = layout.part6_start; i < layout.part7_start; i++)
+    objs [layout.order [i]].new_num = hint_num + 1 + i - layout.part6_start;
+  first_count = layout.part7_start + 2;
+  for (i = 0; i < layout.obj_count; i++)
+    objs [layout.order [i]].size = pdf_lin_obj_size (& layout, & objs [layout.order [i]]);
+
+  /* laid out first without the hint stream */
+  lin_offset = pdf_output_offset (pdf_file);
+  lin_length = sprintf (text, LIN_DICT_FORMAT, lin_num, 0L, 0L, 0L,
+			objs [lin->pages [0]].new_num, 0L, lin->page_count, 0L);
+  first_xref_offset = lin_offset + lin_length;
+  first_xref_length = (strlen ("xref\r\n") + pdf_lin_digits (lin_num) + 1 +
+		       pdf_lin_digits (first_count) + strlen ("\r\n") + 20 * first_count);
+  first_xref_length += sprintf (text, FIRST_TRAILER_FORMAT, lin_num + first_count,
+				objs [catalog].new_num, objs [info].new_num, 0L);
+  pos = first_xref_offset + first_xref_length;
+  for (i = 0; i < layout.obj_count; i++)
+    {
+      if (i == layout.part6_start)
+	hint_offset = pos;
+      objs [layout.order [i]].offset = pos;
+      pos += objs [layout.order [i]].size;
+    }
+
+  memset (& bits, 0, sizeof (bits));
+  pdf_lin_hint_tables (& layout, & bits, & shared_table);
+  hint_length = (pdf_lin_digits (hint_num) + strlen (" 0 obj\r\n<< /S ") +
+		 pdf_lin_digits (shared_table) + strlen (" /Length ") +
+		 pdf_lin_digits (bits.bit / 8) + strlen (" >>\r\nstream\r\n") +
+		 bits.bit / 8 + strlen ("\r\nendstream\r\nendobj\r\n"));
+
+  for (i = layout.part6_start; i < layout.obj_count; i++)
+    objs [layout.order [i]].offset += hint_length;
+  first_page_end = (objs [layout.order [layout.part7_start - 1]].offset +
+		    objs [layout.order [layout.part7_start - 1]].size);
+  main_xref_offset = pos + hint_length;
+  main_xref_length = (strlen ("xref\r\n0 ") + pdf_lin_digits (m + 1) +
+		      strlen ("\r\n") + 20 * (m + 1));
+  file_length = (main_xref_offset + main_xref_length +
+		 strlen ("trailer\r\n<< /Size ") + pdf_lin_digits (m + 1) +
+		 strlen (" >>\r\nstartxref\r\n") + pdf_lin_digits (first_xref_offset) +
+		 strlen ("\r\n%%EOF\r\n"));
+
+  /* parts 2 and 3 */
+  sprintf (text, LIN_DICT_FORMAT, lin_num, file_length, hint_offset, hint_length,
+	   objs [lin->pages [0]].new_num, first_page_end, lin->page_count,
+	   main_xref_offset + (long) strlen ("xref\r\n0 ") + pdf_lin_digits (m + 1) + 1);
+  pdf_out_string (pdf_file, text);
+
+  pdf_assert (pdf_output_offset (pdf_file) == first_xref_offset);
+  pdf_out_string (pdf_file, "xref\r\n");
+  pdf_out_integer (pdf_file, lin_num);
+  pdf_out_string (pdf_file, " ");
+  pdf_out_integer (pdf_file, first_count);
+  pdf_out_string (pdf_file, "\r\n");
+  pdf_out_xref_entry (pdf_file, lin_offset);
+  for (i = layout.part4_start; i < layout.part6_start; i++)
+    pdf_out_xref_entry (pdf_file, objs [layout.order [i]].offset);
+  pdf_out_xref_entry (pdf_file, hint_offset);
+  for (i = layout.part6_start; i < layout.part7_start; i++)
+    pdf_out_xref_entry (pdf_file, objs [layout.order [i]].offset);
+  sprintf (text, FIRST_TRAILER_FORMAT, lin_num + first_count,
+	   objs [catalog].new_num, objs [info].new_num, main_xref_offset);
+  pdf_out_string (pdf_file, text);
+
+  /* parts 4 to 9 */
+  for (i = layout.part4_start; i < layout.part6_start; i++)
+    pdf_lin_copy_obj (pdf_file, & layout, spool, layout.order [i]);
+
+  pdf_assert (pdf_output_offset (pdf_file) == hint_offset);
+  pdf_out_integer (pdf_file, hint_num);
+  pdf_out_string (pdf_file, " 0 obj\r\n<< /S ");
+  pdf_out_integer (pdf_file, shared_table);
+  pdf_out_string (pdf_file, " /Length ");
+  pdf_out_integer (pdf_file, bits.bit / 8);
+  pdf_out_string (pdf_file, " >>\r\nstream\r\n");
+  pdf_out_data (pdf_file, bits.data, bits.bit / 8);
+  pdf_out_string (pdf_file, "\r\nendstream\r\nendobj\r\n");
+  free (bits.data);
+
+  for (i = layout.part6_start; i < layout.obj_count; i++)
+    pdf_lin_copy_obj (pdf_file, & layout, spool, layout.order [i]);
+
+  /* part 11 */
+  pdf_assert (pdf_output_offset (pdf_file) == main_xref_offset);
+  pdf_out_string (pdf_file, "xref\r\n0 ");
+  pdf_out_integer (pdf_file, m + 1);
+  pdf_out_string (pdf_file, "\r\n0000000000 65535 f\r\n");
+  for (i = layout.part7_start; i < layout.obj_count; i++)
+    pdf_out_xref_entry (pdf_file, objs [layout.order [i]].offset);
+  pdf_out_string (pdf_file, "trailer\r\n<< /Size ");
+  pdf_out_integer (pdf_file, m + 1);
+  pdf_out_string (pdf_file, " >>\r\nstartxref\r\n");
+  pdf_out_integer (pdf_file, first_xref_offset);
+  pdf_out_string (pdf_file, "\r\n%%EOF\r\n");
+  pdf_assert (pdf_output_offset (pdf_file) == file_length);
+
+ done:
+  fclose (spool);
+  free (layout.order);
+  free (layout.page_start);
+  free (layout.page_shared);
+  free (layout.page_shared_start);
+  free (layout.found);
+  free (objs);
+  free (lin->spooled);
+  free (lin->refs);
+  free (lin->pages);
+  free (lin->page_tree);
+  free (lin);
+  pdf_file->lin = NULL;
+}
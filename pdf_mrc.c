@@ -0,0 +1,188 @@
+/*
+ * tumble: build a PDF file from image files
+ *
+ * PDF routines
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.  Note that permission is
+ * not granted to redistribute this program under the terms of any
+ * other version of the General Public License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111 USA
+ */
+
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <jpeglib.h>
+
+
+#include "bitblt.h"
+#include "pdf.h"
+#include "pdf_util.h"
+#include "pdf_prim.h"
+#include "pdf_private.h"
+
+
+/* A mixed raster content page is drawn as a JPEG background, with the
+   foreground mask painted over it as an image mask in the ink color.
+   The background is low resolution and smooth, which JPEG compresses
+   well, and the text keeps its edges in the G4 coded mask. */
+
+#define MRC_JPEG_QUALITY 50
+
+#define JPEG_BUFFER_INCREMENT 65536
+
+
+/* libjpeg destination that collects the compressed data in memory */
+struct mrc_jpeg_dest
+{
+  struct jpeg_destination_mgr pub;
+  uint8_t *data;
+  size_t size;
+};
+
+
+static void mrc_jpeg_init (j_compress_ptr cinfo)
+{
+  struct mrc_jpeg_dest *dest = (struct mrc_jpeg_dest *) cinfo->dest;
+
+  dest->size = JPEG_BUFFER_INCREMENT;
+  dest->data = malloc (dest->size);
+  if (! dest->data)
+    pdf_fatal ("can't allocate JPEG buffer\n");
+  dest->pub.next_output_byte = dest->data;
+  dest->pub.free_in_buffer = dest->size;
+}
+
+
+static boolean mrc_jpeg_empty (j_compress_ptr cinfo)
+{
+  struct mrc_jpeg_dest *dest = (struct mrc_jpeg_dest *) cinfo->dest;
+  size_t used = dest->size;
+
+  dest->size += JPEG_BUFFER_INCREMENT;
+  dest->data = realloc (dest->data, dest->size);
+  if (! dest->data)
+    pdf_fatal ("can't allocate JPEG buffer\n");
+  dest->pub.next_output_byte = dest->data + used;
+  dest->pub.free_in_buffer = dest->size - used;
+  return TRUE;
+}
+
+
+static void mrc_jpeg_term (j_compress_ptr cinfo)
+{
+  struct mrc_jpeg_dest *dest = (struct mrc_jpeg_dest *) cinfo->dest;
+
+  dest->size -= dest->pub.free_in_buffer;
+}
+
+
+static void mrc_jpeg_error_exit (j_common_ptr cinfo)
+{
+  char message [JMSG_LENGTH_MAX];
+
+  (* cinfo->err->format_message) (cinfo, message);
+  pdf_fatal ("JPEG compression error: %s\n", message);
+}
+
+
+static uint8_t *mrc_jpeg_compress (bool color,
+				   uint32_t width_samples,
+				   uint32_t height_samples,
+				   uint8_t *samples,
+				   uint32_t *data_length)
+{
+  struct jpeg_compress_struct cinfo;
+  struct jpeg_error_mgr jerr;
+  struct mrc_jpeg_dest dest;
+  uint32_t row_bytes = width_samples * (color ? 3 : 1);
+
+  cinfo.err = jpeg_std_error (& jerr);
+  jerr.error_exit = mrc_jpeg_error_exit;
+  jpeg_create_compress (& cinfo);
+
+  memset (& dest, 0, sizeof (dest));
+  dest.pub.init_destination = mrc_jpeg_init;
+  dest.pub.empty_output_buffer = mrc_jpeg_empty;
+  dest.pub.term_destination = mrc_jpeg_term;
+  cinfo.dest = & dest.pub;
+
+  cinfo.image_width = width_samples;
+  cinfo.image_height = height_samples;
+  cinfo.input_components = color ? 3 : 1;
+  cinfo.in_color_space = color ? JCS_RGB : JCS_GRAYSCALE;
+  jpeg_set_defaults (& cinfo);
+  jpeg_set_quality (& cinfo, MRC_JPEG_QUALITY, TRUE);
+
+  jpeg_start_compress (& cinfo, TRUE);
+  while (cinfo.next_scanline < cinfo.image_height)
+    {
+      JSAMPROW row = samples + (size_t) cinfo.next_scanline * row_bytes;
+
+      jpeg_write_scanlines (& cinfo, & row, 1);
+    }
+  jpeg_finish_compress (& cinfo);
+  jpeg_destroy_compress (& cinfo);
+
+  *data_length = dest.size;
+  return dest.data;
+}
+
+
+void pdf_write_mrc_image (pdf_page_handle pdf_page,
+			  double x,
+			  double y,
+			  double width,
+			  double height,
+			  Bitmap *mask,
+			  rgb_t foreground,
+			  bool color,
+			  uint32_t bg_width_samples,
+			  uint32_t bg_height_samples,
+			  uint8_t *background)
+{
+  overlay_t overlay;
+  uint8_t *data;
+  uint32_t data_length;
+
+  data = mrc_jpeg_compress (color,
+				bg_width_samples,
+				bg_height_samples,
+				background,
+				& data_length);
+  pdf_write_jpeg_image_data (pdf_page,
+			     x, y, width, height,
+			     color,
+			     true,  /* libjpeg writes color as YCbCr */
+			     bg_width_samples,
+			     bg_height_samples,
+			     NULL,
+			     data,
+			     data_length);
+  free (data);
+
+  memset (& overlay, 0, sizeof (overlay));
+  overlay.imagemask = true;
+  overlay.foreground = foreground;
+  pdf_write_g4_fax_image (pdf_page,
+			  x, y, width, height,
+			  false,
+			  mask,
+			  & overlay,
+			  NULL,
+			  NULL);
+}
@@ -43,12 +43,11 @@
 
 struct pdf_png_image
 {
-  double width, height;
-  double x, y;
+  double matrix [6];  /* placement, from pdf_image_matrix */
   bool color;  /* false for grayscale */
   uint32_t width_samples, height_samples;
   FILE *f;
-  char XObject_name [4];
+  char XObject_name [XOBJECT_NAME_SIZE];
 };
 
 
@@ -58,100 +57,82 @@ static void pdf_write_png_content_callback (pdf_file_handle pdf_file,
 {
   struct pdf_png_image *image = app_data;
 
-  /* transformation matrix is: width 0 0 height x y cm */
-  pdf_stream_printf (pdf_file, stream, "q %g 0 0 %g %g %g cm ",
-		     image->width, image->height,
-		     image->x, image->y);
+  pdf_write_image_matrix (pdf_file, stream, image->matrix);
   pdf_write_name (pdf_file, image->XObject_name);
   pdf_stream_printf (pdf_file, stream, "Do Q\r\n");
 }
 
 
-static void pdf_write_png_image_callback (pdf_file_handle pdf_file,
-					   pdf_obj_handle stream,
-					   void *app_data)
+/* Passes the contents of the IDAT chunks from the file position on to
+   the stream, or if there's no stream to the key, or with neither only
+   counts them.  Returns their length. */
+static uint64_t pdf_png_copy_idat (FILE *f,
+				   pdf_file_handle pdf_file,
+				   pdf_obj_handle stream,
+				   struct pdf_image_key *key)
 {
-  struct pdf_png_image *image = app_data;
-  int rlen, wlen;
-  uint8_t *wp;
+  uint64_t length = 0;
+  int rlen;
   uint8_t buffer [8192];
 
-  while (! feof (image->f))
+  while (! feof (f))
     {
       uint32_t clen;
-      rlen = fread (buffer, 1, 8, image->f);
+      rlen = fread (buffer, 1, 8, f);
       if (rlen != 8)
 	pdf_fatal ("unexpected EOF on input file\n");
       clen=(buffer[0]<<24)+(buffer[1]<<16)+(buffer[2]<<8)+buffer[3];
       if (!memcmp(buffer+4,"IEND",4))
 	break;
-      if (memcmp(buffer+4,"IDAT",4)) {
-	fseek(image->f, clen+4, SEEK_CUR);
+      if (memcmp(buffer+4,"IDAT",4) || ! (stream || key)) {
+	if (!memcmp(buffer+4,"IDAT",4))
+	  length += clen;
+	fseek(f, clen+4, SEEK_CUR);
 	continue;
       }
+      length += clen;
       while (clen)
       {
-	rlen = fread (buffer, 1, (clen<sizeof(buffer))?clen:sizeof(buffer), image->f);
+	rlen = fread (buffer, 1, (clen<sizeof(buffer))?clen:sizeof(buffer), f);
 	if(!rlen)
 	  pdf_fatal ("unexpected EOF on input file\n");
 	clen -= rlen;
-        wp = buffer;
-        while (rlen)
-	{
-	  wlen = fwrite (wp, 1, rlen, pdf_file->f);
-	  if (feof (pdf_file->f))
-	    pdf_fatal ("unexpected EOF on output file\n");
-	  if (ferror (pdf_file->f))
-	    pdf_fatal ("error on output file\n");
-	  rlen -= wlen;
-	  wp += wlen;
-	}
-        if (ferror (image->f))
+	if (stream)
+	  pdf_stream_write_data (pdf_file, stream, (char *) buffer, rlen);
+	else
+	  pdf_image_key_hash (key, buffer, rlen);
+        if (ferror (f))
 	  pdf_fatal ("error on input file\n");
       }
-      fseek(image->f, 4, SEEK_CUR);
+      fseek(f, 4, SEEK_CUR);
     }
+  return length;
 }
 
 
-void pdf_write_png_image (pdf_page_handle pdf_page,
-			   double x,
-			   double y,
-			   double width,
-			   double height,
-			   int color,
-			   char *indexed,
-			   int palent,
-			   int bpp,
-			   uint32_t width_samples,
-			   uint32_t height_samples,
-               rgb_range_t *transparency,
-			   FILE *f)
+static void pdf_write_png_image_callback (pdf_file_handle pdf_file,
+					   pdf_obj_handle stream,
+					   void *app_data)
 {
-  struct pdf_png_image *image;
+  struct pdf_png_image *image = app_data;
+
+  pdf_png_copy_idat (image->f, pdf_file, stream, NULL);
+}
 
+
+static pdf_obj_handle pdf_new_png_XObject (pdf_page_handle pdf_page,
+					   struct pdf_png_image *image,
+					   char *indexed,
+					   int palent,
+					   int bpp,
+					   rgb_range_t *transparency)
+{
   pdf_obj_handle stream;
   pdf_obj_handle stream_dict;
   pdf_obj_handle flateparams;
 
   pdf_obj_handle mask;
 
-  image = pdf_calloc (1, sizeof (struct pdf_png_image));
-
-  image->width = width;
-  image->height = height;
-  image->x = x;
-  image->y = y;
-
-  image->f = f;
-
-  image->color = color;
-  image->width_samples = width_samples;
-  image->height_samples = height_samples;
-
-  pdf_add_array_elem_unique (pdf_page->procset,
-			     pdf_new_name (palent ? "ImageI" : image->color ? "ImageC" : "ImageB"));
-
   stream_dict = pdf_new_obj (PT_DICTIONARY);
 
   stream = pdf_new_ind_ref (pdf_page->pdf_file,
@@ -160,8 +141,7 @@ void pdf_write_png_image (pdf_page_handle pdf_page,
 					    & pdf_write_png_image_callback,
 					    image));
 
-  strcpy (& image->XObject_name [0], "Im ");
-  image->XObject_name [2] = pdf_new_XObject (pdf_page, stream);
+  pdf_new_XObject (pdf_page, stream, image->XObject_name);
 
   flateparams = pdf_new_obj (PT_DICTIONARY);
   
@@ -208,9 +188,98 @@ void pdf_write_png_image (pdf_page_handle pdf_page,
 
   pdf_stream_add_filter (stream, "FlateDecode", flateparams);
 
-  /* the following will write the stream, using our callback function to
-     get the actual data */
-  pdf_write_ind_obj (pdf_page->pdf_file, stream);
+  return (stream);
+}
+
+
+/* the parameters that go into the XObject, for its key */
+struct pdf_png_image_params
+{
+  bool color;
+  bool transparent;
+  int palent;
+  int bpp;
+  uint32_t width_samples, height_samples;
+  rgb_range_t transparency;
+};
+
+
+void pdf_write_png_image (pdf_page_handle pdf_page,
+			   double x,
+			   double y,
+			   double width,
+			   double height,
+			   int color,
+			   char *indexed,
+			   int palent,
+			   int bpp,
+			   uint32_t width_samples,
+			   uint32_t height_samples,
+               rgb_range_t *transparency,
+			   FILE *f)
+{
+  struct pdf_png_image *image;
+  struct pdf_png_image_params params;
+  struct pdf_image_key key;
+  long pos;
+
+  image = pdf_calloc (1, sizeof (struct pdf_png_image));
+
+  pdf_image_matrix (pdf_page, x, y, width, height, image->matrix);
+
+  image->f = f;
+
+  image->color = color;
+  image->width_samples = width_samples;
+  image->height_samples = height_samples;
+
+  /* 16 bits per component was introduced in PDF 1.5 */
+  if (bpp > 8)
+    pdf_require_version (pdf_page->pdf_file, 5);
+
+  pdf_add_array_elem_unique (pdf_page->procset,
+			     pdf_new_name (palent ? "ImageI" : image->color ? "ImageC" : "ImageB"));
+
+  memset (& params, 0, sizeof (params));
+  params.color = image->color;
+  params.palent = palent;
+  params.bpp = bpp;
+  params.width_samples = width_samples;
+  params.height_samples = height_samples;
+  if (transparency)
+    {
+      params.transparent = true;
+      params.transparency = *transparency;
+    }
+
+  pdf_image_key_init (& key);
+  pdf_image_key_add (& key, "PNG", 3);
+  pdf_image_key_add (& key, & params, sizeof (params));
+  if (palent)
+    pdf_image_key_add (& key, indexed, 3 * palent);
+
+  /* The image data is hashed as it's copied, unless it may be an image
+     that's already been written.  Finding its length only reads the
+     chunk headers. */
+  pos = ftell (f);
+  if (pos < 0)
+    pdf_fatal ("can't seek in input file\n");
+  pdf_image_key_set_length (& key, pdf_png_copy_idat (f, NULL, NULL, NULL));
+  if (fseek (f, pos, SEEK_SET))
+    pdf_fatal ("can't seek in input file\n");
+  if (pdf_image_key_seen (pdf_page->pdf_file, & key))
+    {
+      pdf_png_copy_idat (f, NULL, NULL, & key);
+      if (fseek (f, pos, SEEK_SET))
+	pdf_fatal ("can't seek in input file\n");
+    }
+
+  /* the stream is written using our callback function to get the
+     actual data */
+  if (! pdf_reuse_XObject (pdf_page, & key, image->XObject_name))
+    pdf_write_XObject (pdf_page->pdf_file, & key,
+		       pdf_new_png_XObject (pdf_page, image, indexed, palent,
+					    bpp, transparency));
 
   pdf_obj_handle content_stream = pdf_new_ind_ref(pdf_page->pdf_file,
 						  pdf_new_stream (pdf_page->pdf_file,
@@ -219,4 +288,7 @@ void pdf_write_png_image (pdf_page_handle pdf_page,
 								  image));
 
   pdf_page_add_content_stream(pdf_page, content_stream);
+
+  /* both streams have been written */
+  free (image);
 }
@@ -24,6 +24,7 @@
  */
 
 
+#include <math.h>
 #include <stdarg.h>
 #include <stdbool.h>
 #include <stdint.h>
@@ -31,6 +32,8 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include <zlib.h>
+
 #include "bitblt.h"
 #include "pdf.h"
 #include "pdf_util.h"
@@ -84,7 +87,7 @@ struct pdf_obj
   pdf_obj_handle      next;
   unsigned long       obj_num;
   unsigned long       obj_gen;
-  long int            file_offset;
+  bool                immutable;  /* written, and its contents released */
 
   /* these fields apply to all objects */
   unsigned long       ref_count;
@@ -106,6 +109,97 @@ struct pdf_obj
 };
 
 
+/* An object is referenced by each array or dictionary it's in, by
+   each indirect reference to it, and by the file until it's written
+   if it's an indirect object.  It's freed, with what it holds, when
+   the last reference goes. */
+
+static unsigned long live_objects, peak_objects;
+
+static struct pdf_pool obj_pool = PDF_POOL (sizeof (struct pdf_obj));
+static struct pdf_pool dict_entry_pool = PDF_POOL (sizeof (struct pdf_dict_entry));
+static struct pdf_pool array_elem_pool = PDF_POOL (sizeof (struct pdf_array_elem));
+
+
+static void pdf_free_obj (pdf_obj_handle obj);
+
+
+/* Names are interned: there is one name object for each distinct
+   name, shared by every use of it, and dictionary keys are the strings
+   of those objects.  Names and keys are then compared by address.  The
+   table holds a reference to each name, so they're never freed; a file
+   has few distinct names, since even XObject names start over on each
+   page. */
+#define PDF_NAME_TABLE_MIN_SIZE 256  /* must be a power of two */
+
+static pdf_obj_handle *name_table;
+static unsigned long name_table_size, name_count;
+
+
+static unsigned long pdf_name_hash (char *name)
+{
+  unsigned long hash = 2166136261UL;  /* FNV-1a */
+
+  while (*name)
+    hash = (hash ^ (unsigned char) *name++) * 16777619UL;
+  return (hash);
+}
+
+
+static pdf_obj_handle *pdf_name_slot (char *name)
+{
+  unsigned long i = pdf_name_hash (name) & (name_table_size - 1);
+
+  while (name_table [i] && (strcmp (name_table [i]->val.name, name) != 0))
+    i = (i + 1) & (name_table_size - 1);
+  return (& name_table [i]);
+}
+
+
+static void pdf_grow_name_table (void)
+{
+  pdf_obj_handle *old_table = name_table;
+  unsigned long old_size = name_table_size;
+  unsigned long i;
+
+  name_table_size = old_size ? (2 * old_size) : PDF_NAME_TABLE_MIN_SIZE;
+  name_table = pdf_calloc (name_table_size, sizeof (pdf_obj_handle));
+  for (i = 0; i < old_size; i++)
+    if (old_table [i])
+      * pdf_name_slot (old_table [i]->val.name) = old_table [i];
+  free (old_table);
+}
+
+
+/* Returns the name object for name, or if create is false and there
+   isn't one yet, NULL. */
+static pdf_obj_handle pdf_intern_name (char *name, bool create)
+{
+  pdf_obj_handle *slot;
+
+  if (! name_table)
+    {
+      if (! create)
+	return (NULL);
+      pdf_grow_name_table ();
+    }
+  else if (create && (2 * (name_count + 1) > name_table_size))
+    pdf_grow_name_table ();
+
+  slot = pdf_name_slot (name);
+  if ((! *slot) && create)
+    {
+      *slot = pdf_pool_alloc (& obj_pool);
+      (*slot)->type = PT_NAME;
+      (*slot)->immutable = true;
+      (*slot)->ref_count = 1;  /* the table's */
+      (*slot)->val.name = pdf_strdup (name);
+      name_count++;
+    }
+  return (*slot);
+}
+
+
 pdf_obj_handle ref (pdf_obj_handle obj)
 {
   obj->ref_count++;
@@ -115,13 +209,78 @@ pdf_obj_handle ref (pdf_obj_handle obj)
 
 void unref (pdf_obj_handle obj)
 {
+  pdf_assert (obj->ref_count);
   if ((--obj->ref_count) == 0)
+    pdf_free_obj (obj);
+}
+
+
+/* frees what the object holds, but not the object */
+static void pdf_release_contents (pdf_obj_handle obj)
+{
+  switch (obj->type)
     {
-      /* $$$ free the object */
+    case PT_STRING:
+      free (obj->val.string.content);
+      obj->val.string.content = NULL;
+      break;
+    case PT_IND_REF:
+      unref (obj->val.ind_ref);
+      break;
+    case PT_DICTIONARY:
+      {
+	struct pdf_dict_entry *entry, *next;
+
+	for (entry = obj->val.dict.first; entry; entry = next)
+	  {
+	    next = entry->next;
+	    unref (entry->val);
+	    pdf_pool_free (& dict_entry_pool, entry);
+	  }
+	obj->val.dict.first = NULL;
+      }
+      break;
+    case PT_ARRAY:
+      {
+	struct pdf_array_elem *elem, *next;
+
+	for (elem = obj->val.array.first; elem; elem = next)
+	  {
+	    next = elem->next;
+	    unref (elem->val);
+	    pdf_pool_free (& array_elem_pool, elem);
+	  }
+	obj->val.array.first = obj->val.array.last = NULL;
+      }
+      break;
+    case PT_STREAM:
+      /* the app_data belongs to whoever made the stream */
+      if (obj->val.stream.stream_dict)
+	unref (obj->val.stream.stream_dict);
+      obj->val.stream.stream_dict = NULL;
+      obj->val.stream.length = NULL;
+      obj->val.stream.app_data = NULL;
+      break;
+    default:
+      break;
     }
 }
 
 
+static void pdf_free_obj (pdf_obj_handle obj)
+{
+  pdf_release_contents (obj);
+  pdf_pool_free (& obj_pool, obj);
+  live_objects--;
+}
+
+
+unsigned long pdf_peak_object_count (void)
+{
+  return peak_objects;
+}
+
+
 pdf_obj_handle pdf_deref_ind_obj (pdf_obj_handle ind_obj)
 {
   pdf_assert (ind_obj->type == PT_IND_REF);
@@ -129,6 +288,15 @@ pdf_obj_handle pdf_deref_ind_obj (pdf_obj_handle ind_obj)
 }
 
 
+unsigned long pdf_obj_num (pdf_obj_handle ind_obj)
+{
+  if (ind_obj->type == PT_IND_REF)
+    ind_obj = pdf_deref_ind_obj (ind_obj);
+  pdf_assert (ind_obj->obj_num);
+  return (ind_obj->obj_num);
+}
+
+
 void pdf_set_dict_entry (pdf_obj_handle dict_obj, char *key, pdf_obj_handle val)
 {
   struct pdf_dict_entry *entry;
@@ -137,23 +305,28 @@ void pdf_set_dict_entry (pdf_obj_handle dict_obj, char *key, pdf_obj_handle val)
     dict_obj = pdf_deref_ind_obj (dict_obj);
 
   pdf_assert (dict_obj->type == PT_DICTIONARY);
+  pdf_assert (! dict_obj->immutable);
+
+  key = pdf_intern_name (key, true)->val.name;
 
   /* replacing existing entry? */
   for (entry = dict_obj->val.dict.first; entry; entry = entry->next)
-    if (strcmp (entry->key, key) == 0)
+    if (entry->key == key)
       {
+	/* it may be replaced by itself */
+	ref (val);
 	unref (entry->val);
-	entry->val = ref (val);
+	entry->val = val;
 	return;
       }
 
   /* new entry */
-  entry = pdf_calloc (1, sizeof (struct pdf_dict_entry));
+  entry = pdf_pool_alloc (& dict_entry_pool);
 
   entry->next = dict_obj->val.dict.first;
   dict_obj->val.dict.first = entry;
 
-  entry->key = pdf_strdup (key);
+  entry->key = key;
   entry->val = ref (val);
 }
 
@@ -161,14 +334,20 @@ void pdf_set_dict_entry (pdf_obj_handle dict_obj, char *key, pdf_obj_handle val)
 pdf_obj_handle pdf_get_dict_entry (pdf_obj_handle dict_obj, char *key)
 {
   struct pdf_dict_entry *entry;
+  pdf_obj_handle name;
 
   if (dict_obj->type == PT_IND_REF)
     dict_obj = pdf_deref_ind_obj (dict_obj);
 
   pdf_assert (dict_obj->type == PT_DICTIONARY);
 
+  /* a key that was never interned isn't in any dictionary */
+  name = pdf_intern_name (key, false);
+  if (! name)
+    return (NULL);
+
   for (entry = dict_obj->val.dict.first; entry; entry = entry->next)
-    if (strcmp (entry->key, key) == 0)
+    if (entry->key == name->val.name)
       return (entry->val);
 
   return (NULL);
@@ -177,12 +356,13 @@ pdf_obj_handle pdf_get_dict_entry (pdf_obj_handle dict_obj, char *key)
 
 void pdf_add_array_elem (pdf_obj_handle array_obj, pdf_obj_handle val)
 {
-  struct pdf_array_elem *elem = pdf_calloc (1, sizeof (struct pdf_array_elem));
+  struct pdf_array_elem *elem = pdf_pool_alloc (& array_elem_pool);
 
   if (array_obj->type == PT_IND_REF)
     array_obj = pdf_deref_ind_obj (array_obj);
 
   pdf_assert (array_obj->type == PT_ARRAY);
+  pdf_assert (! array_obj->immutable);
 
   elem->val = ref (val);
 
@@ -203,12 +383,18 @@ void pdf_add_array_elem_unique (pdf_obj_handle array_obj, pdf_obj_handle val)
     array_obj = pdf_deref_ind_obj (array_obj);
 
   pdf_assert (array_obj->type == PT_ARRAY);
+  pdf_assert (! array_obj->immutable);
 
   for (elem = array_obj->val.array.first; elem; elem = elem->next)
-    if (pdf_compare_obj (val, elem->val) == 0)
-      return;
+    if ((elem->val == val) || (pdf_compare_obj (val, elem->val) == 0))
+      {
+	/* usually made just for the call */
+	if (! val->ref_count)
+	  pdf_free_obj (val);
+	return;
+      }
 
-  elem = pdf_calloc (1, sizeof (struct pdf_array_elem));
+  elem = pdf_pool_alloc (& array_elem_pool);
 
   elem->val = ref (val);
 
@@ -223,8 +409,10 @@ void pdf_add_array_elem_unique (pdf_obj_handle array_obj, pdf_obj_handle val)
 
 pdf_obj_handle pdf_new_obj (pdf_obj_type type)
 {
-  pdf_obj_handle obj = pdf_calloc (1, sizeof (struct pdf_obj));
+  pdf_obj_handle obj = pdf_pool_alloc (& obj_pool);
   obj->type = type;
+  if (++live_objects > peak_objects)
+    peak_objects = live_objects;
   return (obj);
 }
 
@@ -239,18 +427,13 @@ pdf_obj_handle pdf_new_bool (bool val)
 
 pdf_obj_handle pdf_new_name (char *name)
 {
-  pdf_obj_handle obj = pdf_new_obj (PT_NAME);
-  obj->val.name = pdf_strdup (name);
-  return (obj);
+  return (pdf_intern_name (name, true));
 }
 
 
 pdf_obj_handle pdf_new_string (char *str)
 {
-  pdf_obj_handle obj = pdf_new_obj (PT_STRING);
-  obj->val.string.content = pdf_strdup (str);
-  obj->val.string.length = strlen(str);
-  return (obj);
+  return (pdf_new_string_n (str, strlen (str)));
 }
 
 
@@ -258,7 +441,7 @@ pdf_obj_handle pdf_new_string_n (char *str, int n)
 {
   pdf_obj_handle obj = pdf_new_obj (PT_STRING);
   obj->val.string.length = n;
-  obj->val.string.content = pdf_calloc (1,n);
+  obj->val.string.content = pdf_calloc (1, n + 1);  /* n may be 0 */
   memcpy(obj->val.string.content, str, n);
   return (obj);
 }
@@ -287,7 +470,7 @@ pdf_obj_handle pdf_new_stream (pdf_file_handle pdf_file,
 {
   pdf_obj_handle obj = pdf_new_obj (PT_STREAM);
 
-  obj->val.stream.stream_dict = stream_dict;
+  obj->val.stream.stream_dict = ref (stream_dict);
   obj->val.stream.length = pdf_new_ind_ref (pdf_file, pdf_new_integer (0));
   pdf_set_dict_entry (obj->val.stream.stream_dict, "Length", obj->val.stream.length);
 
@@ -306,6 +489,7 @@ void pdf_stream_add_filter (pdf_obj_handle stream,
     stream = pdf_deref_ind_obj (stream);
 
   pdf_assert (stream->type == PT_STREAM);
+  pdf_assert (! stream->immutable);
 
   pdf_set_dict_entry (stream->val.stream.stream_dict, "Filter", pdf_new_name (filter_name));
   if (decode_parms)
@@ -318,28 +502,39 @@ pdf_obj_handle pdf_new_ind_ref (pdf_file_handle pdf_file, pdf_obj_handle obj)
   pdf_obj_handle ind_obj;
 
   pdf_assert (obj->type != PT_IND_REF);
+  pdf_assert (obj->type != PT_NAME);  /* shared */
 
   ind_obj = pdf_new_obj (PT_IND_REF);
 
   ind_obj->type = PT_IND_REF;
-  ind_obj->val.ind_ref = obj;
+  ind_obj->val.ind_ref = ref (obj);
 
   /* is there already an indirect reference to this object? */
   if (! obj->obj_num)
     {
-      /* no, assign object number/generation and add to linked list */
-      if (! pdf_file->first_ind_obj)
+      /* no, assign object number/generation and add to linked list of
+	 objects to be written */
+      obj->obj_num = ++pdf_file->obj_count;
+      if (obj->obj_num >= pdf_file->xref_alloc)
 	{
-	  obj->obj_num = 1;
-	  pdf_file->first_ind_obj = pdf_file->last_ind_obj = obj;
+	  pdf_file->xref_alloc = 2 * pdf_file->xref_alloc + 1024;
+	  pdf_file->xref = realloc (pdf_file->xref,
+				    pdf_file->xref_alloc * sizeof (struct pdf_xref_entry));
+	  if (! pdf_file->xref)
+	    pdf_fatal ("can't allocate cross reference table\n");
 	}
+      pdf_file->xref [obj->obj_num].obj_stream = 0;
+      pdf_file->xref [obj->obj_num].offset = 0;
+
+      ref (obj);
+      if (! pdf_file->first_ind_obj)
+	pdf_file->first_ind_obj = obj;
       else
 	{
-	  obj->obj_num = pdf_file->last_ind_obj->obj_num + 1;
 	  pdf_file->last_ind_obj->next = obj;
 	  obj->prev = pdf_file->last_ind_obj;
-	  pdf_file->last_ind_obj = obj;
 	}
+      pdf_file->last_ind_obj = obj;
     }
 
   return (ind_obj);
@@ -362,6 +557,7 @@ void pdf_set_integer (pdf_obj_handle obj, long val)
     obj = pdf_deref_ind_obj (obj);
 
   pdf_assert (obj->type == PT_INTEGER);
+  pdf_assert (! obj->immutable);
 
   obj->val.integer = val;
 }
@@ -383,6 +579,7 @@ void pdf_set_real (pdf_obj_handle obj, double val)
     obj = pdf_deref_ind_obj (obj);
 
   pdf_assert (obj->type == PT_REAL);
+  pdf_assert (! obj->immutable);
 
   obj->val.real = val;
 }
@@ -424,6 +621,8 @@ int pdf_compare_obj (pdf_obj_handle o1, pdf_obj_handle o2)
 	return o1->val.string.length - o2->val.string.length;
       }
     case PT_NAME:
+      if (o1 == o2)
+	return (0);  /* interned */
       return (strcmp (o1->val.name, o2->val.name));
     default:
       pdf_fatal ("invalid object type for comparison\n");
@@ -431,6 +630,148 @@ int pdf_compare_obj (pdf_obj_handle o1, pdf_obj_handle o2)
 }
 
 
+/* Output is collected in a buffer in the pdf_file and written to the
+   file in large blocks.  Numbers, names and strings are formatted here
+   rather than by printf, which was most of the time spent writing the
+   objects of a large file. */
+
+void pdf_flush_output (pdf_file_handle pdf_file)
+{
+  pdf_assert (! pdf_file->out_capture);
+  if (pdf_file->out_used &&
+      (fwrite (pdf_file->out_buf, 1, pdf_file->out_used, pdf_file->f) != pdf_file->out_used))
+    pdf_fatal ("error writing output file\n");
+  pdf_file->out_offset += pdf_file->out_used;
+  pdf_file->out_used = 0;
+}
+
+
+/* The offset is counted rather than asked of the file, which needn't
+   be seekable. */
+long pdf_output_offset (pdf_file_handle pdf_file)
+{
+  return pdf_file->out_offset + pdf_file->out_used;
+}
+
+
+void pdf_out_data (pdf_file_handle pdf_file, const void *data, size_t len)
+{
+  if (pdf_file->out_used + len > pdf_file->out_size)
+    {
+      if (pdf_file->out_capture)
+	{
+	  /* objects going to an object stream are kept until it's full */
+	  pdf_file->out_size = 2 * (pdf_file->out_used + len);
+	  pdf_file->out_buf = realloc (pdf_file->out_buf, pdf_file->out_size);
+	  if (! pdf_file->out_buf)
+	    pdf_fatal ("can't allocate object stream\n");
+	}
+      else
+	{
+	  pdf_flush_output (pdf_file);
+	  if (len >= pdf_file->out_size)
+	    {
+	      if (fwrite (data, 1, len, pdf_file->f) != len)
+		pdf_fatal ("error writing output file\n");
+	      pdf_file->out_offset += len;
+	      return;
+	    }
+	}
+    }
+  memcpy (pdf_file->out_buf + pdf_file->out_used, data, len);
+  pdf_file->out_used += len;
+}
+
+
+static inline void pdf_out_char (pdf_file_handle pdf_file, char c)
+{
+  if (pdf_file->out_used == pdf_file->out_size)
+    pdf_out_data (pdf_file, & c, 1);
+  else
+    pdf_file->out_buf [pdf_file->out_used++] = c;
+}
+
+
+void pdf_out_string (pdf_file_handle pdf_file, const char *s)
+{
+  pdf_out_data (pdf_file, s, strlen (s));
+}
+
+
+/* digits of val, ending at end; returns the first */
+static char *format_unsigned (char *end, unsigned long val)
+{
+  do
+    *--end = '0' + val % 10;
+  while (val /= 10);
+  return end;
+}
+
+
+/* each entry is exactly 20 bytes */
+void pdf_out_xref_entry (pdf_file_handle pdf_file, long offset)
+{
+  char entry [] = "0000000000 00000 n\r\n";
+
+  format_unsigned (entry + 10, offset);
+  pdf_out_data (pdf_file, entry, 20);
+}
+
+
+void pdf_out_integer (pdf_file_handle pdf_file, long val)
+{
+  char buf [24];
+  char *p;
+
+  p = format_unsigned (buf + sizeof (buf),
+		       (val < 0) ? - (unsigned long) val : (unsigned long) val);
+  if (val < 0)
+    *--p = '-';
+  pdf_out_data (pdf_file, p, buf + sizeof (buf) - p);
+}
+
+
+/* Reals are written with up to six decimal places, without trailing
+   zeros, and never with an exponent, which PDF doesn't allow. */
+void pdf_out_real (pdf_file_handle pdf_file, double num)
+{
+  char buf [48];
+  char *p = buf + sizeof (buf);
+  unsigned long long scaled;
+  unsigned long fraction;
+  int digits;
+
+  if (! (fabs (num) < 1e12))
+    {
+      /* far beyond any coordinate or sample value */
+      snprintf (buf, sizeof (buf), "%.0f", isfinite (num) ? num : 0.0);
+      pdf_out_string (pdf_file, buf);
+      return;
+    }
+
+  scaled = llround (fabs (num) * 1e6);
+  fraction = scaled % 1000000;
+  if (fraction)
+    {
+      for (digits = 6; ! (fraction % 10); digits--)
+	fraction /= 10;
+      while (digits--)
+	{
+	  *--p = '0' + fraction % 10;
+	  fraction /= 10;
+	}
+      *--p = '.';
+    }
+  p = format_unsigned (p, scaled / 1000000);
+  if ((num < 0) && scaled)
+    *--p = '-';
+  pdf_out_data (pdf_file, p, buf + sizeof (buf) - p);
+}
+
+
+static const char hex_digits [] = "0123456789ABCDEF";
+
+
 static int name_char_needs_quoting (char c)
 {
   return ((c < '!')  || (c > '~')  || (c == '/') || (c == '\\') ||
@@ -442,13 +783,17 @@ static int name_char_needs_quoting (char c)
 
 void pdf_write_name (pdf_file_handle pdf_file, char *s)
 {
-  fprintf (pdf_file->f, "/");
-  while (*s)
+  pdf_out_char (pdf_file, '/');
+  for (; *s; s++)
     if (name_char_needs_quoting (*s))
-      fprintf (pdf_file->f, "#%02x", 0xff & *(s++));
+      {
+	pdf_out_char (pdf_file, '#');
+	pdf_out_char (pdf_file, hex_digits [(*s >> 4) & 0xf]);
+	pdf_out_char (pdf_file, hex_digits [*s & 0xf]);
+      }
     else
-      fprintf (pdf_file->f, "%c", *(s++));
-  fprintf (pdf_file->f, " ");
+      pdf_out_char (pdf_file, *s);
+  pdf_out_char (pdf_file, ' ');
 }
 
 
@@ -457,7 +802,7 @@ static int pdf_write_literal_string (pdf_file_handle pdf_file, char *s, int n)
   int i, p;
 
   if (pdf_file)
-    fprintf (pdf_file->f, "(");
+    pdf_out_char (pdf_file, '(');
 
   for (i = p = 0; n; n--)
     {
@@ -489,17 +834,18 @@ static int pdf_write_literal_string (pdf_file_handle pdf_file, char *s, int n)
 	{
 	  i++;
 	  if (pdf_file)
-	    fprintf (pdf_file->f, "\\");
+	    pdf_out_char (pdf_file, '\\');
 	}
 
       i++;
 
       if (pdf_file)
-	fprintf (pdf_file->f, "%c", *(s++));
+	pdf_out_char (pdf_file, *s);
+      s++;
     }
 
   if (pdf_file)
-    fprintf (pdf_file->f, ") ");
+    pdf_out_string (pdf_file, ") ");
   return i;
 }
 
@@ -510,27 +856,36 @@ void pdf_write_string (pdf_file_handle pdf_file, char *s, int n)
     pdf_write_literal_string (pdf_file, s, n);
   else
     {
-      fprintf (pdf_file->f, "<");
-
-      for( ; n--; )
-	fprintf (pdf_file->f, "%.2X",*(s++));
-      fprintf (pdf_file->f, "> ");
+      pdf_out_char (pdf_file, '<');
+      for (; n--; s++)
+	{
+	  pdf_out_char (pdf_file, hex_digits [(*s >> 4) & 0xf]);
+	  pdf_out_char (pdf_file, hex_digits [*s & 0xf]);
+	}
+      pdf_out_string (pdf_file, "> ");
     }
 }
 
 
 void pdf_write_real (pdf_file_handle pdf_file, double num)
 {
-  /* $$$ not actually good enough, precision needs to be variable,
-     and no exponent is allowed */
-  fprintf (pdf_file->f, "%0f ", num);
+  pdf_out_real (pdf_file, num);
+  pdf_out_char (pdf_file, ' ');
 }
 
 
 void pdf_write_ind_ref (pdf_file_handle pdf_file, pdf_obj_handle ind_obj)
 {
   pdf_obj_handle obj = pdf_deref_ind_obj (ind_obj);
-  fprintf (pdf_file->f, "%ld %ld R ", obj->obj_num, obj->obj_gen);
+  if (pdf_file->lin)
+    pdf_lin_note_ref (pdf_file, obj->obj_num);  /* numbered when it's placed */
+  else
+    {
+      pdf_out_integer (pdf_file, obj->obj_num);
+      pdf_out_char (pdf_file, ' ');
+    }
+  pdf_out_integer (pdf_file, obj->obj_gen);
+  pdf_out_string (pdf_file, " R ");
 }
 
 
@@ -540,13 +895,13 @@ void pdf_write_array (pdf_file_handle pdf_file, pdf_obj_handle array_obj)
 
   pdf_assert (array_obj->type == PT_ARRAY);
 
-  fprintf (pdf_file->f, "[ ");
+  pdf_out_string (pdf_file, "[ ");
   for (elem = array_obj->val.array.first; elem; elem = elem->next)
     {
       pdf_write_obj (pdf_file, elem->val);
-      fprintf (pdf_file->f, " ");
+      pdf_out_char (pdf_file, ' ');
     }
-  fprintf (pdf_file->f, "] ");
+  pdf_out_string (pdf_file, "] ");
 }
 
 
@@ -556,15 +911,15 @@ void pdf_write_dict (pdf_file_handle pdf_file, pdf_obj_handle dict_obj)
 
   pdf_assert (dict_obj->type == PT_DICTIONARY);
 
-  fprintf (pdf_file->f, "<<\r\n");
+  pdf_out_string (pdf_file, "<<\r\n");
   for (entry = dict_obj->val.dict.first; entry; entry = entry->next)
     {
       pdf_write_name (pdf_file, entry->key);
-      fprintf (pdf_file->f, " ");
+      pdf_out_char (pdf_file, ' ');
       pdf_write_obj (pdf_file, entry->val);
-      fprintf (pdf_file->f, "\r\n");
+      pdf_out_string (pdf_file, "\r\n");
     }
-  fprintf (pdf_file->f, ">>\r\n");
+  pdf_out_string (pdf_file, ">>\r\n");
 }
 
 
@@ -573,14 +928,9 @@ void pdf_stream_write_data (pdf_file_handle pdf_file,
 			    char *data,
 			    unsigned long len)
 {
-  while (len)
-    {
-      unsigned long l2 = fwrite (data, 1, len, pdf_file->f);
-      data += l2;
-      len -= l2;
-      if (ferror (pdf_file->f))
-	pdf_fatal ("error writing stream data\n");
-    }
+  if (pdf_file->image_key)
+    pdf_image_key_hash (pdf_file->image_key, data, len);
+  pdf_out_data (pdf_file, data, len);
 }
 
 
@@ -588,11 +938,31 @@ void pdf_stream_printf (pdf_file_handle pdf_file,
 			pdf_obj_handle stream,
 			char *fmt, ...)
 {
+  size_t room = pdf_file->out_size - pdf_file->out_used;
   va_list ap;
+  int len;
 
   va_start (ap, fmt);
-  vfprintf (pdf_file->f, fmt, ap);
+  len = vsnprintf (pdf_file->out_buf + pdf_file->out_used, room, fmt, ap);
   va_end (ap);
+  if (len < 0)
+    pdf_fatal ("error formatting stream data\n");
+  if ((size_t) len < room)
+    {
+      pdf_file->out_used += len;
+      return;
+    }
+
+  /* didn't fit; format it again into a buffer of its own */
+  {
+    char *buf = pdf_calloc (len + 1, 1);
+
+    va_start (ap, fmt);
+    vsnprintf (buf, len + 1, fmt, ap);
+    va_end (ap);
+    pdf_out_data (pdf_file, buf, len);
+    free (buf);
+  }
 }
 
 
@@ -603,14 +973,14 @@ void pdf_write_stream (pdf_file_handle pdf_file, pdf_obj_handle stream)
   pdf_assert (stream->type == PT_STREAM);
 
   pdf_write_dict (pdf_file, stream->val.stream.stream_dict);
-  fprintf (pdf_file->f, "stream\r\n");
-  begin_pos = ftell (pdf_file->f);
+  pdf_out_string (pdf_file, "stream\r\n");
+  begin_pos = pdf_output_offset (pdf_file);
   stream->val.stream.callback (pdf_file,
 			       stream,
 			       stream->val.stream.app_data);
-  end_pos = ftell (pdf_file->f);
+  end_pos = pdf_output_offset (pdf_file);
 
-  fprintf (pdf_file->f, "\r\nendstream\r\n");
+  pdf_out_string (pdf_file, "\r\nendstream\r\n");
 
   pdf_set_integer (stream->val.stream.length, end_pos - begin_pos);
 }
@@ -621,13 +991,13 @@ void pdf_write_obj (pdf_file_handle pdf_file, pdf_obj_handle obj)
   switch (obj->type)
     {
     case PT_NULL:
-      fprintf (pdf_file->f, "null ");
+      pdf_out_string (pdf_file, "null ");
       break;
     case PT_BOOL:
       if (obj->val.boolean)
-	fprintf (pdf_file->f, "true ");
+	pdf_out_string (pdf_file, "true ");
       else
-	fprintf (pdf_file->f, "false ");
+	pdf_out_string (pdf_file, "false ");
       break;
     case PT_NAME:
       pdf_write_name (pdf_file, obj->val.name);
@@ -636,7 +1006,8 @@ void pdf_write_obj (pdf_file_handle pdf_file, pdf_obj_handle obj)
       pdf_write_string (pdf_file, obj->val.string.content, obj->val.string.length);
       break;
     case PT_INTEGER:
-      fprintf (pdf_file->f, "%ld ", obj->val.integer);
+      pdf_out_integer (pdf_file, obj->val.integer);
+      pdf_out_char (pdf_file, ' ');
       break;
     case PT_REAL:
       pdf_write_real (pdf_file, obj->val.real);
@@ -659,6 +1030,199 @@ void pdf_write_obj (pdf_file_handle pdf_file, pdf_obj_handle obj)
 }
 
 
+/* Streams whose data is compressed in memory before they are written,
+   so that they can have a direct Length.  The object streams and the
+   cross reference stream must. */
+struct pdf_packed_data
+{
+  uint8_t *data;
+  unsigned long length;
+};
+
+
+static void pdf_write_packed_stream_callback (pdf_file_handle pdf_file,
+					      pdf_obj_handle stream,
+					      void *app_data)
+{
+  struct pdf_packed_data *packed = app_data;
+
+  pdf_stream_write_data (pdf_file, stream, (char *) packed->data, packed->length);
+}
+
+
+static pdf_obj_handle pdf_new_packed_stream (pdf_obj_handle stream_dict,
+					     struct pdf_packed_data *packed)
+{
+  pdf_obj_handle stream = pdf_new_obj (PT_STREAM);
+
+  stream->val.stream.stream_dict = ref (stream_dict);
+  stream->val.stream.callback = & pdf_write_packed_stream_callback;
+  stream->val.stream.app_data = packed;
+  return stream;
+}
+
+
+static void pdf_pack_stream (pdf_obj_handle stream, char *data, size_t len)
+{
+  struct pdf_packed_data *packed = stream->val.stream.app_data;
+  uLongf length = compressBound (len);
+
+  packed->data = pdf_calloc (1, length);
+  if (compress2 (packed->data, & length, (Bytef *) data, len,
+		 Z_DEFAULT_COMPRESSION) != Z_OK)
+    pdf_fatal ("deflate error\n");
+  packed->length = length;
+
+  stream->val.stream.length = pdf_new_integer (length);
+  pdf_set_dict_entry (stream->val.stream.stream_dict, "Length", stream->val.stream.length);
+  pdf_set_dict_entry (stream->val.stream.stream_dict, "Filter", pdf_new_name ("FlateDecode"));
+}
+
+
+/* With object streams (PDF 1.5), objects other than streams are
+   written into an object stream rather than the file.  They are kept
+   in memory, by swapping the object stream's buffer with the output
+   buffer while one is written, and the object stream is compressed and
+   written when it's full or the file is closed. */
+
+#define OBJ_STREAM_OBJECTS 200
+
+struct pdf_obj_stream
+{
+  pdf_obj_handle stream;  /* not an indirect object until it's written */
+  struct pdf_packed_data packed;
+
+  char *buf;
+  size_t used;
+  size_t size;
+
+  unsigned int count;
+  unsigned long obj_num [OBJ_STREAM_OBJECTS];
+  size_t offset [OBJ_STREAM_OBJECTS];
+};
+
+
+static void pdf_swap_output (pdf_file_handle pdf_file, struct pdf_obj_stream *os)
+{
+  char *buf = pdf_file->out_buf;
+  size_t used = pdf_file->out_used;
+  size_t size = pdf_file->out_size;
+
+  pdf_file->out_buf = os->buf;
+  pdf_file->out_used = os->used;
+  pdf_file->out_size = os->size;
+  os->buf = buf;
+  os->used = used;
+  os->size = size;
+  pdf_file->out_capture = ! pdf_file->out_capture;
+}
+
+
+/* appends the digits of val at p, and returns the end */
+static char *append_unsigned (char *p, unsigned long val)
+{
+  char buf [24];
+  char *digits = format_unsigned (buf + sizeof (buf), val);
+
+  memcpy (p, digits, buf + sizeof (buf) - digits);
+  return p + (buf + sizeof (buf) - digits);
+}
+
+
+static void pdf_flush_obj_stream (pdf_file_handle pdf_file)
+{
+  struct pdf_obj_stream *os = pdf_file->obj_stream;
+  pdf_obj_handle dict, stream;
+  char *data, *p;
+  size_t first;
+  unsigned int i;
+
+  if (! os)
+    return;
+  pdf_file->obj_stream = NULL;
+
+  /* the objects are preceded by pairs of object number and offset */
+  data = pdf_calloc (1, 2 * 24 * os->count + os->used);
+  p = data;
+  for (i = 0; i < os->count; i++)
+    {
+      p = append_unsigned (p, os->obj_num [i]);
+      *p++ = ' ';
+      p = append_unsigned (p, os->offset [i]);
+      *p++ = ' ';
+    }
+  first = p - data;
+  memcpy (p, os->buf, os->used);
+
+  dict = os->stream->val.stream.stream_dict;
+  pdf_set_dict_entry (dict, "Type", pdf_new_name ("ObjStm"));
+  pdf_set_dict_entry (dict, "N", pdf_new_integer (os->count));
+  pdf_set_dict_entry (dict, "First", pdf_new_integer (first));
+  pdf_pack_stream (os->stream, data, first + os->used);
+  free (data);
+  free (os->buf);
+
+  stream = ref (pdf_new_ind_ref (pdf_file, os->stream));
+  for (i = 0; i < os->count; i++)
+    {
+      pdf_file->xref [os->obj_num [i]].obj_stream = os->stream->obj_num;
+      pdf_file->xref [os->obj_num [i]].offset = i;
+    }
+  pdf_write_ind_obj (pdf_file, stream);
+  unref (stream);
+  free (os->packed.data);
+  free (os);
+}
+
+
+static void pdf_write_obj_stream_member (pdf_file_handle pdf_file,
+					 pdf_obj_handle obj)
+{
+  struct pdf_obj_stream *os = pdf_file->obj_stream;
+
+  if (! os)
+    {
+      os = pdf_calloc (1, sizeof (struct pdf_obj_stream));
+      os->stream = pdf_new_packed_stream (pdf_new_obj (PT_DICTIONARY),
+					  & os->packed);
+      pdf_file->obj_stream = os;
+    }
+
+  os->obj_num [os->count] = obj->obj_num;
+  os->offset [os->count] = os->used;
+  os->count++;
+
+  pdf_swap_output (pdf_file, os);
+  pdf_write_obj (pdf_file, obj);
+  pdf_swap_output (pdf_file, os);
+
+  if (os->count == OBJ_STREAM_OBJECTS)
+    pdf_flush_obj_stream (pdf_file);
+}
+
+
+/* Once it's written, an object can't be changed, and what it holds is
+   freed.  The object stays, for its number, as long as anything refers
+   to it. */
+static void pdf_release_ind_obj (pdf_file_handle pdf_file, pdf_obj_handle obj)
+{
+  obj->immutable = true;
+  pdf_release_contents (obj);
+
+  if (obj->prev)
+    obj->prev->next = obj->next;
+  else
+    pdf_file->first_ind_obj = obj->next;
+  if (obj->next)
+    obj->next->prev = obj->prev;
+  else
+    pdf_file->last_ind_obj = obj->prev;
+  obj->prev = obj->next = NULL;
+
+  unref (obj);
+}
+
+
 void pdf_write_ind_obj (pdf_file_handle pdf_file, pdf_obj_handle ind_obj)
 {
   pdf_obj_handle obj;
@@ -668,51 +1232,421 @@ void pdf_write_ind_obj (pdf_file_handle pdf_file, pdf_obj_handle ind_obj)
   else
     obj = ind_obj;
 
-  obj->file_offset = ftell (pdf_file->f);
-  fprintf (pdf_file->f, "%ld %ld obj\r\n", obj->obj_num, obj->obj_gen);
-  pdf_write_obj (pdf_file, obj);
-  fprintf (pdf_file->f, "endobj\r\n");
+  pdf_assert (! obj->immutable);
+
+  if (pdf_file->object_streams && (obj->type != PT_STREAM))
+    {
+      pdf_write_obj_stream_member (pdf_file, obj);
+      pdf_release_ind_obj (pdf_file, obj);
+      return;
+    }
+
+  pdf_file->xref [obj->obj_num].offset = pdf_output_offset (pdf_file);
+  if (pdf_file->lin)
+    {
+      /* spooled without its header, until its number is known */
+      pdf_lin_note_obj (pdf_file, obj->obj_num);
+      pdf_write_obj (pdf_file, obj);
+    }
+  else
+    {
+      pdf_out_integer (pdf_file, obj->obj_num);
+      pdf_out_char (pdf_file, ' ');
+      pdf_out_integer (pdf_file, obj->obj_gen);
+      pdf_out_string (pdf_file, " obj\r\n");
+      pdf_write_obj (pdf_file, obj);
+      pdf_out_string (pdf_file, "endobj\r\n");
+    }
+
+  /* the length of a stream is known once it's written */
+  if ((obj->type == PT_STREAM) && (obj->val.stream.length->type == PT_IND_REF))
+    pdf_write_ind_obj (pdf_file, obj->val.stream.length);
+
+  pdf_release_ind_obj (pdf_file, obj);
 }
 
 
 void pdf_write_all_ind_obj (pdf_file_handle pdf_file)
 {
-  pdf_obj_handle ind_obj;
-  for (ind_obj = pdf_file->first_ind_obj; ind_obj; ind_obj = ind_obj->next)
-    if (! ind_obj->file_offset)
-      pdf_write_ind_obj (pdf_file, ind_obj);
+  /* each is taken off the list as it's written */
+  while (pdf_file->first_ind_obj)
+    pdf_write_ind_obj (pdf_file, pdf_file->first_ind_obj);
 }
 
 
 unsigned long pdf_write_xref (pdf_file_handle pdf_file)
 {
-  pdf_obj_handle ind_obj;
-  pdf_file->xref_offset = ftell (pdf_file->f);
-  fprintf (pdf_file->f, "xref\r\n");
-  fprintf (pdf_file->f, "0 %ld\r\n", pdf_file->last_ind_obj->obj_num + 1);
-  fprintf (pdf_file->f, "0000000000 65535 f\r\n");
-  for (ind_obj = pdf_file->first_ind_obj; ind_obj; ind_obj = ind_obj->next)
-    fprintf (pdf_file->f, "%010ld 00000 n\r\n", ind_obj->file_offset);
-  return (pdf_file->last_ind_obj->obj_num + 1);
+  unsigned long i;
+
+  pdf_file->xref_offset = pdf_output_offset (pdf_file);
+  pdf_out_string (pdf_file, "xref\r\n0 ");
+  pdf_out_integer (pdf_file, pdf_file->obj_count + 1);
+  pdf_out_string (pdf_file, "\r\n0000000000 65535 f\r\n");
+  for (i = 1; i <= pdf_file->obj_count; i++)
+    pdf_out_xref_entry (pdf_file, pdf_file->xref [i].offset);
+  return (pdf_file->obj_count + 1);
+}
+
+
+/* stores the low bytes of val at p, most significant first */
+static void put_bytes (uint8_t *p, unsigned long val, int bytes)
+{
+  while (bytes--)
+    {
+      p [bytes] = val & 0xff;
+      val >>= 8;
+    }
+}
+
+
+void pdf_write_xref_stream (pdf_file_handle pdf_file)
+{
+  struct pdf_packed_data packed;
+  pdf_obj_handle xref, widths;
+  unsigned long size, i;
+  int offset_bytes, entry_bytes;
+  uint8_t *data;
+
+  pdf_flush_obj_stream (pdf_file);
+
+  /* the trailer dictionary is that of the stream */
+  xref = ref (pdf_new_ind_ref (pdf_file,
+			       pdf_new_packed_stream (pdf_file->trailer_dict, & packed)));
+  size = pdf_file->obj_count + 1;
+  pdf_file->xref_offset = pdf_output_offset (pdf_file);
+  pdf_file->xref [size - 1].offset = pdf_file->xref_offset;
+
+  /* entries are a type byte, an offset or object stream number, and a
+     generation or index within the object stream */
+  for (offset_bytes = 1;
+       (offset_bytes < (int) sizeof (long)) &&
+	 (((unsigned long) pdf_file->xref_offset >> (8 * offset_bytes)) ||
+	  (size >> (8 * offset_bytes)));
+       offset_bytes++)
+    ;
+  entry_bytes = 1 + offset_bytes + 2;
+
+  data = pdf_calloc (size, entry_bytes);
+  put_bytes (data + 1 + offset_bytes, 65535, 2);  /* object 0 is free */
+  for (i = 1; i < size; i++)
+    {
+      struct pdf_xref_entry *entry = & pdf_file->xref [i];
+      uint8_t *p = data + i * entry_bytes;
+
+      if (entry->obj_stream)
+	{
+	  p [0] = 2;
+	  put_bytes (p + 1, entry->obj_stream, offset_bytes);
+	  put_bytes (p + 1 + offset_bytes, entry->offset, 2);
+	}
+      else
+	{
+	  p [0] = 1;
+	  put_bytes (p + 1, entry->offset, offset_bytes);
+	}
+    }
+
+  widths = pdf_new_obj (PT_ARRAY);
+  pdf_add_array_elem (widths, pdf_new_integer (1));
+  pdf_add_array_elem (widths, pdf_new_integer (offset_bytes));
+  pdf_add_array_elem (widths, pdf_new_integer (2));
+  pdf_set_dict_entry (pdf_file->trailer_dict, "Type", pdf_new_name ("XRef"));
+  pdf_set_dict_entry (pdf_file->trailer_dict, "Size", pdf_new_integer (size));
+  pdf_set_dict_entry (pdf_file->trailer_dict, "W", widths);
+  pdf_pack_stream (pdf_deref_ind_obj (xref), (char *) data, size * entry_bytes);
+  free (data);
+
+  pdf_write_ind_obj (pdf_file, xref);
+  unref (xref);
+  free (packed.data);
 }
 
 
 /* this isn't really a PDF primitive data type */
-char pdf_new_XObject (pdf_page_handle pdf_page, pdf_obj_handle ind_ref)
+void pdf_new_XObject (pdf_page_handle pdf_page,
+		      pdf_obj_handle ind_ref,
+		      char *XObject_name)
 {
-  char XObject_name [4] = "Im ";
+  char suffix [XOBJECT_NAME_SIZE - 2];
+  int i = sizeof (suffix);
+  int n;
+
+  /* names are ImA through ImZ, then ImAA, ImAB, and so on */
+  suffix [--i] = '\0';
+  for (n = ++pdf_page->XObject_count; n; n = (n - 1) / 26)
+    suffix [--i] = 'A' + (n - 1) % 26;
+  strcpy (XObject_name, "Im");
+  strcat (XObject_name, & suffix [i]);
 
-  XObject_name [2] = ++pdf_page->last_XObject_name;
-  
   if (! pdf_page->XObject_dict)
     {
       pdf_page->XObject_dict = pdf_new_obj (PT_DICTIONARY);
       pdf_set_dict_entry (pdf_page->resources, "XObject", pdf_page->XObject_dict);
     }
 
-  pdf_set_dict_entry (pdf_page->XObject_dict, & XObject_name [0], ind_ref);
+  pdf_set_dict_entry (pdf_page->XObject_dict, XObject_name, ind_ref);
+}
+
+
+static unsigned long reused_images;
+static unsigned long long reused_image_bytes;
+
+
+unsigned long pdf_reused_image_count (void)
+{
+  return reused_images;
+}
+
+
+unsigned long long pdf_reused_image_bytes (void)
+{
+  return reused_image_bytes;
+}
+
+
+void pdf_image_key_init (struct pdf_image_key *key)
+{
+  memset (key, 0, sizeof (struct pdf_image_key));
+  pdf_sha256_init (& key->sha);
+}
+
+
+void pdf_image_key_add (struct pdf_image_key *key, const void *data, size_t len)
+{
+  pdf_sha256_add (& key->sha, data, len);
+}
+
+
+void pdf_image_key_set_length (struct pdf_image_key *key, uint64_t length)
+{
+  struct pdf_sha256 head = key->sha;
+  uint8_t buf [8];
+  int i;
+
+  for (i = 0; i < 8; i++)
+    buf [i] = length >> (8 * i);
+  pdf_sha256_add (& head, buf, 8);
+  pdf_sha256_final (& head, key->head);
+
+  key->length = length;
+  key->added = 0;
+  key->complete = ! length;
+  if (key->complete)
+    pdf_sha256_final (& key->sha, key->digest);
+}
+
+
+void pdf_image_key_hash (struct pdf_image_key *key, const void *data, size_t len)
+{
+  if (key->complete)
+    {
+      /* more data than expected, which can't be known by the key */
+      key->added += len;
+      return;
+    }
+  pdf_sha256_add (& key->sha, data, len);
+  key->added += len;
+  if (key->added >= key->length)
+    {
+      key->complete = true;
+      pdf_sha256_final (& key->sha, key->digest);
+    }
+}
+
+
+void pdf_image_key_add_data (struct pdf_image_key *key, const void *data, size_t len)
+{
+  pdf_image_key_set_length (key, len);
+  pdf_image_key_hash (key, data, len);
+}
+
+
+#define IMAGE_KEY_BUFFER_SIZE 8192
+
+void pdf_image_key_add_file (struct pdf_image_key *key,
+			     FILE *f,
+			     long offset,
+			     long length)
+{
+  long pos = ftell (f);
+  uint8_t buffer [IMAGE_KEY_BUFFER_SIZE];
+  size_t rlen;
+
+  if ((pos < 0) || fseek (f, offset, SEEK_SET))
+    pdf_fatal ("can't seek in input file\n");
+
+  while (length)
+    {
+      size_t n = IMAGE_KEY_BUFFER_SIZE;
+
+      if ((length > 0) && (length < IMAGE_KEY_BUFFER_SIZE))
+	n = length;
+      rlen = fread (buffer, 1, n, f);
+      if (ferror (f))
+	pdf_fatal ("error on input file\n");
+      if (! rlen)
+	break;
+      pdf_image_key_hash (key, buffer, rlen);
+      if (length > 0)
+	length -= rlen;
+    }
+
+  clearerr (f);
+  if (fseek (f, pos, SEEK_SET))
+    pdf_fatal ("can't seek in input file\n");
+}
+
+
+/* returns the first entry of the key's set, newest first */
+static struct pdf_image_cache_entry *pdf_image_cache_set (pdf_file_handle pdf_file,
+							   struct pdf_image_key *key)
+{
+  uint32_t hash;
+
+  if (! pdf_file->image_cache)
+    pdf_file->image_cache = pdf_calloc (PDF_IMAGE_CACHE_SIZE,
+					sizeof (struct pdf_image_cache_entry));
+  memcpy (& hash, key->head, sizeof (hash));
+  hash %= PDF_IMAGE_CACHE_SIZE / PDF_IMAGE_CACHE_WAYS;
+  return (& pdf_file->image_cache [hash * PDF_IMAGE_CACHE_WAYS]);
+}
+
+
+/* returns the entry for an image written with the same key, or NULL */
+static struct pdf_image_cache_entry *pdf_image_cache_find (pdf_file_handle pdf_file,
+							    struct pdf_image_key *key)
+{
+  struct pdf_image_cache_entry *set = pdf_image_cache_set (pdf_file, key);
+  int i;
+
+  for (i = 0; i < PDF_IMAGE_CACHE_WAYS; i++)
+    if (set [i].image &&
+	! memcmp (set [i].key.head, key->head, PDF_SHA256_SIZE) &&
+	! memcmp (set [i].key.digest, key->digest, PDF_SHA256_SIZE))
+      return (& set [i]);
+  return (NULL);
+}
+
+
+bool pdf_image_key_seen (pdf_file_handle pdf_file, struct pdf_image_key *key)
+{
+  struct pdf_image_cache_entry *set = pdf_image_cache_set (pdf_file, key);
+  int i;
+
+  for (i = 0; i < PDF_IMAGE_CACHE_WAYS; i++)
+    if (set [i].image &&
+	! memcmp (set [i].key.head, key->head, PDF_SHA256_SIZE))
+      return (true);
+  return (false);
+}
+
+
+bool pdf_reuse_XObject (pdf_page_handle pdf_page,
+			struct pdf_image_key *key,
+			char *XObject_name)
+{
+  pdf_file_handle pdf_file = pdf_page->pdf_file;
+  struct pdf_image_cache_entry *entry;
+
+  if (! (key->complete && (key->added == key->length)))
+    return (false);
+  entry = pdf_image_cache_find (pdf_file, key);
+  if (! entry)
+    return (false);
+
+  pdf_new_XObject (pdf_page, pdf_new_ind_ref (pdf_file, entry->image), XObject_name);
+  reused_images++;
+  reused_image_bytes += entry->bytes;
+  return (true);
+}
+
+
+void pdf_write_XObject (pdf_file_handle pdf_file,
+			struct pdf_image_key *key,
+			pdf_obj_handle ind_ref)
+{
+  long start = pdf_output_offset (pdf_file);
+  struct pdf_image_cache_entry *set;
+
+  /* the data is hashed by pdf_stream_write_data as it's written */
+  if (key && ! key->complete)
+    pdf_file->image_key = key;
+  pdf_write_ind_obj (pdf_file, ind_ref);
+  pdf_file->image_key = NULL;
+  if (! (key && key->complete && (key->added == key->length)))
+    return;
+
+  /* only the object itself is kept, with what it held released */
+  set = pdf_image_cache_set (pdf_file, key);
+  if (set [PDF_IMAGE_CACHE_WAYS - 1].image)
+    unref (set [PDF_IMAGE_CACHE_WAYS - 1].image);
+  memmove (& set [1], & set [0],
+	   (PDF_IMAGE_CACHE_WAYS - 1) * sizeof (struct pdf_image_cache_entry));
+  set [0].key = *key;
+  set [0].image = ref (pdf_deref_ind_obj (ind_ref));
+  set [0].bytes = pdf_output_offset (pdf_file) - start;
+}
+
+
+void pdf_free_image_cache (pdf_file_handle pdf_file)
+{
+  int i;
+
+  if (! pdf_file->image_cache)
+    return;
+  for (i = 0; i < PDF_IMAGE_CACHE_SIZE; i++)
+    if (pdf_file->image_cache [i].image)
+      unref (pdf_file->image_cache [i].image);
+  free (pdf_file->image_cache);
+  pdf_file->image_cache = NULL;
+}
+
+
+void pdf_image_matrix (pdf_page_handle pdf_page,
+		       double x,
+		       double y,
+		       double width,
+		       double height,
+		       double *matrix)
+{
+  /* The columns of the image run down the page when it is turned 90
+     degrees clockwise, and up it when turned 270. */
+  switch (pdf_page->image_rotation)
+    {
+    case 90:
+      matrix [0] = 0;       matrix [1] = - height;
+      matrix [2] = width;   matrix [3] = 0;
+      matrix [4] = x;       matrix [5] = y + height;
+      break;
+    case 180:
+      matrix [0] = - width; matrix [1] = 0;
+      matrix [2] = 0;       matrix [3] = - height;
+      matrix [4] = x + width; matrix [5] = y + height;
+      break;
+    case 270:
+      matrix [0] = 0;       matrix [1] = height;
+      matrix [2] = - width; matrix [3] = 0;
+      matrix [4] = x + width; matrix [5] = y;
+      break;
+    default:
+      matrix [0] = width;   matrix [1] = 0;
+      matrix [2] = 0;       matrix [3] = height;
+      matrix [4] = x;       matrix [5] = y;
+      break;
+    }
+}
+
+
+void pdf_write_image_matrix (pdf_file_handle pdf_file,
+			     pdf_obj_handle stream,
+			     double *matrix)
+{
+  int i;
 
-  return (pdf_page->last_XObject_name);
+  pdf_out_string (pdf_file, "q ");
+  for (i = 0; i < 6; i++)
+    pdf_write_real (pdf_file, matrix [i]);
+  pdf_out_string (pdf_file, "cm ");
 }
 
 
@@ -74,11 +74,22 @@ void pdf_add_array_elem (pdf_obj_handle array_obj, pdf_obj_handle val);
 void pdf_add_array_elem_unique (pdf_obj_handle array_obj, pdf_obj_handle val);
 
 
+/* New objects have no references.  Arrays, dictionaries and indirect
+   references hold one on what they contain, and an object is freed
+   when its last reference is dropped.  A handle kept after the object
+   is put in a container should be held with ref(), since the container
+   is freed once it's written. */
+pdf_obj_handle ref (pdf_obj_handle obj);
+void unref (pdf_obj_handle obj);
+
+
 /* Create a new object that will NOT be used indirectly */
 pdf_obj_handle pdf_new_obj (pdf_obj_type type);
 
 pdf_obj_handle pdf_new_bool (bool val);
 
+/* Names are shared: the same name always gives the same object,
+   which can't be made indirect. */
 pdf_obj_handle pdf_new_name (char *name);
 
 pdf_obj_handle pdf_new_string (char *str);
@@ -96,6 +107,9 @@ pdf_obj_handle pdf_new_ind_ref (pdf_file_handle pdf_file, pdf_obj_handle obj);
 /* get the object referenced by an indirect reference */
 pdf_obj_handle pdf_deref_ind_obj (pdf_obj_handle ind_obj);
 
+/* the object number of an indirect object, or of the one referenced */
+unsigned long pdf_obj_num (pdf_obj_handle ind_obj);
+
 
 long pdf_get_integer (pdf_obj_handle obj);
 void pdf_set_integer (pdf_obj_handle obj, long val);
@@ -140,7 +154,8 @@ void pdf_write_obj (pdf_file_handle pdf_file, pdf_obj_handle obj);
 /* Write the indirect object to the file.  For most objects this should
    be done by pdf_write_all_ind_obj() when the file is being closed, but for
    large objects such as streams, it's probably better to do it as soon as the
-   object is complete. */
+   object is complete.  Once written, the object can't be changed, and what
+   it holds is freed. */
 void pdf_write_ind_obj (pdf_file_handle pdf_file, pdf_obj_handle ind_obj);
 
 
@@ -151,13 +166,138 @@ void pdf_write_all_ind_obj (pdf_file_handle pdf_file);
 /* Write the cross reference table, and return the maximum object number */
 unsigned long pdf_write_xref (pdf_file_handle pdf_file);
 
+/* Write any partly filled object stream, then the cross reference
+   table as a stream whose dictionary is the trailer dictionary. */
+void pdf_write_xref_stream (pdf_file_handle pdf_file);
+
 
 /* Write a name, escaping reserved characters */
 void pdf_write_name (pdf_file_handle pdf_file, char *s);
 
+/* Write a real, followed by a space */
+void pdf_write_real (pdf_file_handle pdf_file, double num);
+
+
+/* Everything written to the file goes through an output buffer.  These
+   add to it without any separator; pdf_flush_output() writes it out,
+   and pdf_output_offset() returns the file offset of the next byte. */
+void pdf_out_data (pdf_file_handle pdf_file, const void *data, size_t len);
+void pdf_out_string (pdf_file_handle pdf_file, const char *s);
+void pdf_out_integer (pdf_file_handle pdf_file, long val);
+void pdf_out_real (pdf_file_handle pdf_file, double num);
+
+/* An in-use entry of a cross reference table, for the object at offset */
+void pdf_out_xref_entry (pdf_file_handle pdf_file, long offset);
+
+/* The %PDF-1.x header, for pdf_file->minor_version */
+void pdf_write_header (pdf_file_handle pdf_file);
+
+void pdf_flush_output (pdf_file_handle pdf_file);
+long pdf_output_offset (pdf_file_handle pdf_file);
+
 
 /* this isn't really a PDF primitive data type */
-char pdf_new_XObject (pdf_page_handle pdf_page, pdf_obj_handle ind_ref);
+#define XOBJECT_NAME_SIZE 16
+
+/* Adds ind_ref to the XObject resources of the page, and copies the
+   name it is given into XObject_name, which must have room for
+   XOBJECT_NAME_SIZE characters. */
+void pdf_new_XObject (pdf_page_handle pdf_page,
+		      pdf_obj_handle ind_ref,
+		      char *XObject_name);
+
+
+/* An image that's drawn again, such as a letterhead overlay or a
+   separator sheet, is written only once.  It's known by the SHA-256
+   digest of everything that goes into its XObject: its parameters,
+   added first, and then its data, before it's encoded.
+
+   Data in memory is added all at once.  Data copied from a file is
+   hashed as the XObject is written, so only its length is given
+   beforehand; if pdf_image_key_seen() finds that an image with the
+   same parameters and length has been written, the data is read and
+   added before deciding whether to reuse it. */
+struct pdf_image_key
+{
+  struct pdf_sha256 sha;  /* of what's been added */
+  uint64_t length;  /* of the data */
+  uint64_t added;  /* of the data, so far */
+  bool complete;  /* all of the data has been added */
+  uint8_t head [PDF_SHA256_SIZE];  /* of the parameters and the data length */
+  uint8_t digest [PDF_SHA256_SIZE];  /* of the parameters and the data */
+};
+
+void pdf_image_key_init (struct pdf_image_key *key);
+
+/* parameters, before the data */
+void pdf_image_key_add (struct pdf_image_key *key, const void *data, size_t len);
+
+/* all of the data, when it's in memory */
+void pdf_image_key_add_data (struct pdf_image_key *key, const void *data, size_t len);
+
+/* The length of the data that's still to come, and then the data as
+   it arrives, which completes the key once there's length of it. */
+void pdf_image_key_set_length (struct pdf_image_key *key, uint64_t length);
+void pdf_image_key_hash (struct pdf_image_key *key, const void *data, size_t len);
+
+/* Hashes length bytes of the file from offset, or all of the rest of
+   it if length is negative, and leaves the file position as it was. */
+void pdf_image_key_add_file (struct pdf_image_key *key,
+			     FILE *f,
+			     long offset,
+			     long length);
+
+/* true if an image with the same parameters and data length has been
+   written, so that the data is worth hashing before it's written */
+bool pdf_image_key_seen (pdf_file_handle pdf_file, struct pdf_image_key *key);
+
+/* If an image with the same complete key has been written, adds it to
+   the XObject resources of the page as pdf_new_XObject() does, and
+   returns true. */
+bool pdf_reuse_XObject (pdf_page_handle pdf_page,
+			struct pdf_image_key *key,
+			char *XObject_name);
+
+/* Writes an image XObject, and if key isn't NULL, keeps it for
+   pdf_reuse_XObject().  A key that isn't complete is completed by the
+   data written to the stream. */
+void pdf_write_XObject (pdf_file_handle pdf_file,
+			struct pdf_image_key *key,
+			pdf_obj_handle ind_ref);
+
+void pdf_free_image_cache (pdf_file_handle pdf_file);
+
+
+/* For a linearized file, each object spooled, each reference written,
+   and the pages and Pages nodes are noted as they come; see
+   pdf_linearize.c.  The last two do nothing for other files. */
+void pdf_lin_note_obj (pdf_file_handle pdf_file, unsigned long obj_num);
+void pdf_lin_note_ref (pdf_file_handle pdf_file, unsigned long obj_num);
+void pdf_lin_note_page (pdf_file_handle pdf_file, pdf_obj_handle page_dict);
+void pdf_lin_note_pages (pdf_file_handle pdf_file, pdf_obj_handle pages_dict);
+
+/* Writes the spooled objects in their linearized order, with the
+   hint stream and cross reference tables, through the end of the file.
+   outlines is the object number of the outline dictionary if the file
+   opens showing it, or 0. */
+void pdf_write_linearized (pdf_file_handle pdf_file, unsigned long outlines);
+
+
+/* Computes the matrix that draws an image, which is the unit square,
+   in the box at x, y of the given width and height, turned as set by
+   pdf_set_image_rotation; width and height are those of the box on the
+   page, after the turn. */
+void pdf_image_matrix (pdf_page_handle pdf_page,
+		       double x,
+		       double y,
+		       double width,
+		       double height,
+		       double *matrix);
+
+/* Writes "q <matrix> cm " to a content stream. */
+void pdf_write_image_matrix (pdf_file_handle pdf_file,
+			     pdf_obj_handle stream,
+			     double *matrix);
 
 
 void pdf_page_add_content_stream(pdf_page_handle pdf_page,
@@ -29,8 +29,10 @@ struct pdf_page
   pdf_obj_handle procset;
   pdf_obj_handle resources;
 
-  char last_XObject_name;
+  int XObject_count;
   pdf_obj_handle XObject_dict;
+
+  int image_rotation;  /* see pdf_set_image_rotation */
 };
 
 
@@ -39,20 +41,71 @@ struct pdf_pages
   pdf_obj_handle pages_dict;
   pdf_obj_handle kids;
   pdf_obj_handle count;
+  int kid_count;
+};
+
+
+/* enough for 2^64 pages with the smallest fan-out */
+#define PDF_PAGE_TREE_MAX_LEVELS 64
+
+
+/* where each object was written, by object number */
+struct pdf_xref_entry
+{
+  unsigned long obj_stream;  /* number of the object stream it's in, if any */
+  long int      offset;      /* in the file, or index in the object stream */
 };
 
 
+/* Images that have been written, by key, in sets of PDF_IMAGE_CACHE_WAYS
+   picked by the key's head so that different images with the same
+   parameters and length can be kept; a new image replaces the oldest in
+   its set.  See pdf_reuse_XObject. */
+#define PDF_IMAGE_CACHE_SIZE 1024
+#define PDF_IMAGE_CACHE_WAYS 4
+
+struct pdf_image_cache_entry
+{
+  struct pdf_image_key key;
+  pdf_obj_handle image;  /* the written stream, or NULL */
+  long int bytes;  /* that it took in the file */
+};
+
+
+#define PDF_OUTPUT_BUFFER_SIZE 65536
+
+
 struct pdf_file
 {
   FILE                 *f;
-  pdf_obj_handle       first_ind_obj;
+  char                 *out_buf;  /* see pdf_flush_output */
+  size_t               out_used;
+  size_t               out_size;
+  long int             out_offset;  /* of out_buf in the file */
+  bool                 out_capture;  /* out_buf is an object stream */
+  int                  minor_version;  /* PDF 1.x */
+  pdf_obj_handle       first_ind_obj;  /* not yet written */
   pdf_obj_handle       last_ind_obj;
+  unsigned long        obj_count;
+  struct pdf_xref_entry *xref;
+  unsigned long        xref_alloc;
   long int             xref_offset;
   pdf_obj_handle       catalog;
   pdf_obj_handle       info;
-  struct pdf_pages     *root;
+  struct pdf_pages     *page_tree [PDF_PAGE_TREE_MAX_LEVELS];  /* see pdf_add_page_tree_kid */
+  int                  page_tree_levels;
+  int                  page_tree_fanout;
+  unsigned long        page_count;
   struct pdf_bookmark  *outline_root;
   pdf_obj_handle       trailer_dict;
   struct pdf_name_tree *page_label_tree;
   struct pdf_name_tree *name_tree_list;
+  pdf_obj_handle       blank_image;  /* shared by blank pages */
+  pdf_obj_handle       g4_color_space;  /* of the last colormapped G4 image */
+  char                 g4_color_index [6];
+  struct pdf_image_cache_entry *image_cache;
+  struct pdf_image_key *image_key;  /* of the XObject being written, see pdf_write_XObject */
+  bool                 object_streams;  /* see pdf_use_object_streams */
+  struct pdf_obj_stream *obj_stream;  /* being filled */
+  struct pdf_linearization *lin;  /* see pdf_linearize */
 };
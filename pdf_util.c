@@ -53,6 +53,147 @@ void *pdf_calloc (size_t nmemb, size_t size)
 }
 
 
+#define PDF_POOL_BLOCK_SIZE 65536
+
+
+void *pdf_pool_alloc (struct pdf_pool *pool)
+{
+  void *item;
+
+  if (pool->free_list)
+    {
+      item = pool->free_list;
+      pool->free_list = * (void **) item;
+      memset (item, 0, pool->item_size);
+      return (item);
+    }
+
+  if (pool->next == pool->end)
+    {
+      /* the rest of the last block is too small for an item */
+      size_t count = PDF_POOL_BLOCK_SIZE / pool->item_size;
+
+      pool->next = pdf_calloc (count, pool->item_size);
+      pool->end = pool->next + count * pool->item_size;
+    }
+  item = pool->next;
+  pool->next += pool->item_size;
+  return (item);
+}
+
+
+void pdf_pool_free (struct pdf_pool *pool, void *item)
+{
+  * (void **) item = pool->free_list;
+  pool->free_list = item;
+}
+
+
+static const uint32_t sha256_k [64] =
+  {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+  };
+
+
+#define ROTR(x,n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+
+static void pdf_sha256_block (struct pdf_sha256 *sha, const uint8_t *p)
+{
+  uint32_t w [64];
+  uint32_t a, b, c, d, e, f, g, h;
+  int i;
+
+  for (i = 0; i < 16; i++)
+    w [i] = (((uint32_t) p [4 * i] << 24) | ((uint32_t) p [4 * i + 1] << 16) |
+	     ((uint32_t) p [4 * i + 2] << 8) | p [4 * i + 3]);
+  for (; i < 64; i++)
+    {
+      uint32_t s0 = ROTR (w [i - 15], 7) ^ ROTR (w [i - 15], 18) ^ (w [i - 15] >> 3);
+      uint32_t s1 = ROTR (w [i - 2], 17) ^ ROTR (w [i - 2], 19) ^ (w [i - 2] >> 10);
+
+      w [i] = w [i - 16] + s0 + w [i - 7] + s1;
+    }
+
+  a = sha->state [0]; b = sha->state [1]; c = sha->state [2]; d = sha->state [3];
+  e = sha->state [4]; f = sha->state [5]; g = sha->state [6]; h = sha->state [7];
+  for (i = 0; i < 64; i++)
+    {
+      uint32_t t1 = (h + (ROTR (e, 6) ^ ROTR (e, 11) ^ ROTR (e, 25)) +
+		     ((e & f) ^ (~ e & g)) + sha256_k [i] + w [i]);
+      uint32_t t2 = ((ROTR (a, 2) ^ ROTR (a, 13) ^ ROTR (a, 22)) +
+		     ((a & b) ^ (a & c) ^ (b & c)));
+
+      h = g; g = f; f = e; e = d + t1;
+      d = c; c = b; b = a; a = t1 + t2;
+    }
+  sha->state [0] += a; sha->state [1] += b; sha->state [2] += c; sha->state [3] += d;
+  sha->state [4] += e; sha->state [5] += f; sha->state [6] += g; sha->state [7] += h;
+}
+
+
+void pdf_sha256_init (struct pdf_sha256 *sha)
+{
+  static const uint32_t initial [8] =
+    {
+      0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+      0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+    };
+
+  memcpy (sha->state, initial, sizeof (initial));
+  sha->length = 0;
+}
+
+
+void pdf_sha256_add (struct pdf_sha256 *sha, const void *data, size_t len)
+{
+  const uint8_t *p = data;
+  size_t used = sha->length % 64;
+
+  sha->length += len;
+  if (used)
+    {
+      size_t n = (len < 64 - used) ? len : (64 - used);
+
+      memcpy (sha->block + used, p, n);
+      p += n;
+      len -= n;
+      if (used + n < 64)
+	return;
+      pdf_sha256_block (sha, sha->block);
+    }
+  for (; len >= 64; p += 64, len -= 64)
+    pdf_sha256_block (sha, p);
+  memcpy (sha->block, p, len);
+}
+
+
+void pdf_sha256_final (struct pdf_sha256 *sha, uint8_t *digest)
+{
+  uint64_t bits = sha->length * 8;
+  uint8_t pad [72];
+  size_t pad_len = 64 - ((sha->length + 8) % 64);
+  int i;
+
+  /* a one bit, zeros, and the length in bits */
+  memset (pad, 0, sizeof (pad));
+  pad [0] = 0x80;
+  for (i = 0; i < 8; i++)
+    pad [pad_len + i] = bits >> (56 - 8 * i);
+  pdf_sha256_add (sha, pad, pad_len + 8);
+
+  for (i = 0; i < 32; i++)
+    digest [i] = sha->state [i / 4] >> (24 - 8 * (i % 4));
+}
+
+
 char *pdf_strdup (char *s)
 {
   unsigned long len = strlen (s);
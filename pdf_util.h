@@ -30,6 +30,41 @@ void *pdf_calloc (size_t nmemb, size_t size);
 
 char *pdf_strdup (char *s);
 
+
+/* The small structures of the object graph come from pools, which
+   carve them out of large blocks, so they're allocated cheaply and lie
+   together in memory, and keep them on a free list once released. */
+struct pdf_pool
+{
+  size_t item_size;
+  char *next;  /* unused part of the last block */
+  char *end;
+  void *free_list;
+};
+
+/* items are a multiple of eight bytes, to keep them aligned */
+#define PDF_POOL(item_size) { (((item_size) + 7) & ~ (size_t) 7), NULL, NULL, NULL }
+
+/* returns zeroed memory */
+void *pdf_pool_alloc (struct pdf_pool *pool);
+void pdf_pool_free (struct pdf_pool *pool, void *item);
+
+
+/* SHA-256 (FIPS 180-4) */
+#define PDF_SHA256_SIZE 32
+
+struct pdf_sha256
+{
+  uint32_t state [8];
+  uint64_t length;  /* bytes added */
+  uint8_t block [64];  /* partly filled */
+};
+
+void pdf_sha256_init (struct pdf_sha256 *sha);
+void pdf_sha256_add (struct pdf_sha256 *sha, const void *data, size_t len);
+void pdf_sha256_final (struct pdf_sha256 *sha, uint8_t *digest);
+
+
 #if 1
 #define pdf_assert(cond) assert(cond)
 #else
@@ -47,12 +47,31 @@ typedef struct
 
   bool has_rotation;
   int rotation;
+  bool render_rotation;
 
   bool has_crop;
   crop_t crop;
 
+  bool trim;
+
   bool has_transparency;
   rgb_range_t transparency;
+
+  bool has_threshold;
+  threshold_t threshold;
+
+  bool has_mrc;
+  int mrc_reduction;
+
+  bool has_downsample;
+  downsample_t downsample;
+
+  bool has_morphology;
+  int morphology;
+
+  bool deskew;
+
+  int blank_pages;  /* 0 if not set */
 } input_modifiers_t;
 
 
@@ -201,11 +220,19 @@ void input_set_file (char *name)
   last_input_context->is_blank = (name == NULL);
 };
 
-void input_set_rotation (int rotation)
+void input_set_rotation (int rotation, bool render)
 {
   last_input_context->modifiers.has_rotation = 1;
   last_input_context->modifiers.rotation = rotation;
-  SDBG(("rotation %d\n", rotation));
+  last_input_context->modifiers.render_rotation = render;
+  SDBG(("rotation %d%s\n", rotation, render ? " render" : ""));
+}
+
+void input_set_crop (crop_t crop)
+{
+  last_input_context->modifiers.has_crop = 1;
+  last_input_context->modifiers.crop = crop;
+  SDBG(("crop %f %f %f %f\n", crop.left, crop.right, crop.top, crop.bottom));
 }
 
 void input_set_page_size (page_size_t size)
@@ -221,6 +248,52 @@ void input_set_transparency (rgb_range_t rgb_range)
   last_input_context->modifiers.transparency = rgb_range;
 }
 
+void input_set_threshold (threshold_t threshold)
+{
+  last_input_context->modifiers.has_threshold = 1;
+  last_input_context->modifiers.threshold = threshold;
+  SDBG(("threshold method %d level %d\n", threshold.method, threshold.level));
+}
+
+void input_set_mrc (int reduction)
+{
+  last_input_context->modifiers.has_mrc = 1;
+  last_input_context->modifiers.mrc_reduction = reduction;
+  SDBG(("mrc background reduction %d\n", reduction));
+}
+
+void input_set_downsample (downsample_t downsample)
+{
+  last_input_context->modifiers.has_downsample = 1;
+  last_input_context->modifiers.downsample = downsample;
+  SDBG(("downsample factor %d level %d\n", downsample.factor, downsample.level));
+}
+
+void input_set_morphology (int morphology)
+{
+  last_input_context->modifiers.has_morphology = 1;
+  last_input_context->modifiers.morphology = morphology;
+  SDBG(("morphology %d\n", morphology));
+}
+
+void input_set_deskew (void)
+{
+  last_input_context->modifiers.deskew = 1;
+  SDBG(("deskew\n"));
+}
+
+void input_set_blank_pages (int action)
+{
+  last_input_context->modifiers.blank_pages = action;
+  SDBG(("blank pages %d\n", action));
+}
+
+void input_set_trim (void)
+{
+  last_input_context->modifiers.trim = 1;
+  SDBG(("trim\n"));
+}
+
 static void increment_input_image_count (int count)
 {
   input_context_t *context;
@@ -484,13 +557,15 @@ static char *get_input_filename (input_context_t *context)
 }
 
 static bool get_input_rotation (input_context_t *context,
-				int *rotation)
+				int *rotation,
+				bool *render)
 {
   for (; context; context = context->parent)
     {
       if (context->modifiers.has_rotation)
 	{
 	  * rotation = context->modifiers.rotation;
+	  * render = context->modifiers.render_rotation;
 	  return true;
 	}
     }
@@ -509,6 +584,100 @@ static rgb_range_t *get_input_transparency (input_context_t *context)
   return NULL;  /* default */
 }
 
+static bool get_input_threshold (input_context_t *context,
+				 threshold_t *threshold)
+{
+  for (; context; context = context->parent)
+    {
+      if (context->modifiers.has_threshold)
+	{
+	  * threshold = context->modifiers.threshold;
+	  return true;
+	}
+    }
+  return false;  /* default */
+}
+
+static bool get_input_mrc (input_context_t *context,
+			   int *reduction)
+{
+  for (; context; context = context->parent)
+    {
+      if (context->modifiers.has_mrc)
+	{
+	  * reduction = context->modifiers.mrc_reduction;
+	  return true;
+	}
+    }
+  return false;  /* default */
+}
+
+static bool get_input_downsample (input_context_t *context,
+				  downsample_t *downsample)
+{
+  for (; context; context = context->parent)
+    {
+      if (context->modifiers.has_downsample)
+	{
+	  * downsample = context->modifiers.downsample;
+	  return true;
+	}
+    }
+  return false;  /* default */
+}
+
+static bool get_input_morphology (input_context_t *context,
+				  int *morphology)
+{
+  for (; context; context = context->parent)
+    {
+      if (context->modifiers.has_morphology)
+	{
+	  * morphology = context->modifiers.morphology;
+	  return true;
+	}
+    }
+  return false;  /* default */
+}
+
+static bool get_input_trim (input_context_t *context)
+{
+  for (; context; context = context->parent)
+    if (context->modifiers.trim)
+      return true;
+  return false;  /* default */
+}
+
+static bool get_input_deskew (input_context_t *context)
+{
+  for (; context; context = context->parent)
+    if (context->modifiers.deskew)
+      return true;
+  return false;  /* default */
+}
+
+static int get_input_blank_pages (input_context_t *context)
+{
+  for (; context; context = context->parent)
+    if (context->modifiers.blank_pages)
+      return context->modifiers.blank_pages;
+  return 0;  /* default */
+}
+
+static bool get_input_crop (input_context_t *context,
+			    crop_t *crop)
+{
+  for (; context; context = context->parent)
+    {
+      if (context->modifiers.has_crop)
+	{
+	  * crop = context->modifiers.crop;
+	  return true;
+	}
+    }
+  return false;  /* default */
+}
+
 static bool get_input_page_size (input_context_t *context,
 				 page_size_t *page_size)
 {
@@ -569,13 +738,14 @@ void dump_input_tree (void)
   for (image = first_input_image; image; image = image->next)
     for (i = image->range.first; i <= image->range.last; i++)
       {
-	bool has_rotation, has_page_size;
+	bool has_rotation, has_page_size, render_rotation;
 	int rotation;
 	page_size_t page_size;
 	rgb_range_t *transparency;
 
 	has_rotation = get_input_rotation (image->input_context,
-					   & rotation);
+					   & rotation,
+					   & render_rotation);
 	has_page_size = get_input_page_size (image->input_context,
 					     & page_size);
 	transparency = get_input_transparency (image->input_context);
@@ -585,7 +755,7 @@ void dump_input_tree (void)
 	else
 	  printf ("blank image %d", i);
 	if (has_rotation)
-	  printf (" rotation %d", rotation);
+	  printf (" rotation %d%s", rotation, render_rotation ? " render" : "");
 	if (transparency)
 	  printf (" transparency %d..%d, %d..%d, %d..%d",
 		  transparency->red.first,   transparency->red.last,  
@@ -767,11 +937,33 @@ bool process_controls (void)
 
       input_attributes.rotation = 0;
       input_attributes.has_rotation = get_input_rotation (image->input_context,
-							  & input_attributes.rotation);
+							  & input_attributes.rotation,
+							  & input_attributes.render_rotation);
 
       input_attributes.has_page_size = get_input_page_size (image->input_context,
 							    & input_attributes.page_size);
 
+      input_attributes.has_threshold = get_input_threshold (image->input_context,
+							    & input_attributes.threshold);
+
+      input_attributes.has_mrc = get_input_mrc (image->input_context,
+						& input_attributes.mrc_reduction);
+
+      input_attributes.has_downsample = get_input_downsample (image->input_context,
+							      & input_attributes.downsample);
+
+      input_attributes.has_morphology = get_input_morphology (image->input_context,
+							      & input_attributes.morphology);
+
+      input_attributes.has_crop = get_input_crop (image->input_context,
+						  & input_attributes.crop);
+
+      input_attributes.trim = get_input_trim (image->input_context);
+
+      input_attributes.deskew = get_input_deskew (image->input_context);
+
+      input_attributes.blank_pages = get_input_blank_pages (image->input_context);
+
       input_attributes.transparency = get_input_transparency (image->input_context);
 
       memset (& output_attributes, 0, sizeof (output_attributes));
@@ -86,6 +86,34 @@ typedef struct
   double bottom;
 } crop_t;
 
+/* morphological filtering of bilevel images */
+#define MORPH_ERODE     1
+#define MORPH_DILATE    2
+#define MORPH_OPEN      3
+#define MORPH_CLOSE     4
+#define MORPH_DESPECKLE 5
+
+/* what to do with pages found to be blank */
+#define BLANK_PAGES_DROP    1
+#define BLANK_PAGES_REPLACE 2  /* with an empty page of the same size */
+
+typedef struct
+{
+  int factor;  /* 2 or 4 */
+  int level;   /* black pixels needed for a black result, 0 for half */
+} downsample_t;
+
+/* conversion of grayscale and color images to bilevel */
+#define THRESHOLD_FIXED    1  /* level given */
+#define THRESHOLD_OTSU     2  /* global level chosen from the histogram */
+#define THRESHOLD_ADAPTIVE 3  /* local (Sauvola) level, global in flat areas */
+
+typedef struct
+{
+  int method;
+  int level;  /* 0 .. 255, THRESHOLD_FIXED only */
+} threshold_t;
+
 typedef struct
 {
   char *prefix;
@@ -116,9 +144,17 @@ void yyerror (const char *s);
 void input_push_context (void);
 void input_pop_context (void);
 void input_set_file (char *name);
-void input_set_rotation (int rotation);
+void input_set_rotation (int rotation, bool render);
 void input_set_transparency (rgb_range_t rgb_range);
 void input_set_page_size (page_size_t size);
+void input_set_crop (crop_t crop);
+void input_set_threshold (threshold_t threshold);
+void input_set_mrc (int reduction);
+void input_set_downsample (downsample_t downsample);
+void input_set_morphology (int morphology);
+void input_set_deskew (void);
+void input_set_trim (void);
+void input_set_blank_pages (int action);
 void input_images (range_t range);
 
 /* semantic routines for output statements */
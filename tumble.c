@@ -24,6 +24,7 @@
  */
 
 
+#include <limits.h>
 #include <stdarg.h>
 #include <stdbool.h>
 #include <stdint.h>
@@ -56,6 +57,9 @@ typedef struct output_file_t
 
 
 int verbose, version;
+bool object_streams;
+bool linearize;
+int page_tree_fanout;  /* or 0 for the default */
 
 
 output_file_t *output_files;
@@ -66,6 +70,8 @@ char *progname;
 
 
 bool close_pdf_output_files (void);
+static void flush_dropped_bookmarks (void);
+static void close_last_page (void);
 
 
 #define QMAKESTR(x) #x
@@ -87,10 +93,24 @@ void usage (void)
   fprintf (stderr, "options:\n");
   fprintf (stderr, "    -v        verbose\n");
   fprintf (stderr, "    -b <fmt>  create bookmarks\n");
+  fprintf (stderr, "    -t <thr>  convert grayscale and color TIFF images to black and white\n");
+  fprintf (stderr, "    -m        split grayscale and color TIFF images into black and white\n");
+  fprintf (stderr, "              text over a low resolution JPEG background\n");
+  fprintf (stderr, "    -d        drop blank pages\n");
+  fprintf (stderr, "    -z        compress the PDF structure with object streams (PDF 1.5)\n");
+  fprintf (stderr, "    -l        linearize the PDF file for fast web view\n");
+  fprintf (stderr, "    -f <n>    most kids of a page tree node, at least 2 (default %d)\n",
+	   PDF_PAGE_TREE_FANOUT);
   fprintf (stderr, "    -V        print program version\n");
+  fprintf (stderr, "output file:\n");
+  fprintf (stderr, "    -         standard output, which needn't be seekable\n");
   fprintf (stderr, "bookmark format:\n");
   fprintf (stderr, "    %%F  file name (sans suffix)\n");
   fprintf (stderr, "    %%p  page number\n");
+  fprintf (stderr, "threshold:\n");
+  fprintf (stderr, "    otsu      global level chosen for each image\n");
+  fprintf (stderr, "    adaptive  local level, for uneven illumination\n");
+  fprintf (stderr, "    <n>       fixed level, 0 to 255\n");
 }
 
 
@@ -123,6 +143,8 @@ bool close_pdf_output_files (void)
 {
   output_file_t *o, *n;
 
+  flush_dropped_bookmarks ();
+  close_last_page ();
   for (o = output_files; o; o = n)
     {
       n = o->next;
@@ -142,6 +164,8 @@ bool open_pdf_output_file (char *name,
 
   if (out && (strcmp (name, out->name) == 0))
     return true;
+  flush_dropped_bookmarks ();
+  close_last_page ();
   for (o = output_files; o; o = o->next)
     if (strcmp (name, o->name) == 0)
       {
@@ -163,7 +187,11 @@ bool open_pdf_output_file (char *name,
       return false;
     }
 
-  o->pdf = pdf_create (name);
+  /* "-" is standard output, which may be a pipe */
+  if (strcmp (name, "-") == 0)
+    o->pdf = pdf_create_file (stdout);
+  else
+    o->pdf = pdf_create (name);
   if (! o->pdf)
     {
       fprintf (stderr, "can't open output file '%s'\n", name);
@@ -172,6 +200,13 @@ bool open_pdf_output_file (char *name,
       return false;
     }
 
+  if (page_tree_fanout)
+    pdf_set_page_tree_fanout (o->pdf, page_tree_fanout);
+  if (object_streams)
+    pdf_use_object_streams (o->pdf);
+  if (linearize)
+    pdf_linearize (o->pdf);
+
   if (attributes->author)
     pdf_set_author (o->pdf, attributes->author);
   if (attributes->creator)
@@ -198,6 +233,104 @@ static pdf_bookmark_handle bookmark_vector [MAX_BOOKMARK_LEVEL + 1] = { NULL };
 static pdf_page_handle last_page = NULL;
 static page_size_t last_size;
 
+/* When blank pages are dropped, their bookmarks are moved to the next
+   page that is kept, or failing that to the last page of the file.  The
+   page labels carry on counting through the dropped pages, so a label
+   is added at the next page kept to skip their numbers. */
+static bool last_page_dropped = false;
+static bookmark_t *dropped_bookmarks = NULL;
+static bookmark_t **dropped_bookmarks_tail = & dropped_bookmarks;
+
+static int kept_pages = 0;
+static bool has_label = false;
+static page_label_t label;  /* base is the number of the next page */
+static bool relabel = false;
+
+
+static void add_bookmarks (bookmark_t *bookmarks, pdf_page_handle page)
+{
+  while (bookmarks)
+    {
+      if (bookmarks->level <= MAX_BOOKMARK_LEVEL)
+	{
+	  pdf_bookmark_handle parent = bookmark_vector [bookmarks->level - 1];
+	  bookmark_vector [bookmarks->level] = pdf_new_bookmark (parent,
+								 bookmarks->name,
+								 0,
+								 page);
+	}
+      else
+	{
+	  (void) pdf_new_bookmark (bookmark_vector [MAX_BOOKMARK_LEVEL],
+				   bookmarks->name,
+				   0,
+				   page);
+	}
+      bookmarks = bookmarks->next;
+    }
+}
+
+
+static bool drop_bookmarks (bookmark_t *bookmarks)
+{
+  for (; bookmarks; bookmarks = bookmarks->next)
+    {
+      bookmark_t *b = calloc (1, sizeof (bookmark_t));
+
+      if (! b)
+	{
+	  fprintf (stderr, "can't calloc bookmark\n");
+	  return false;
+	}
+      b->level = bookmarks->level;
+      b->name = strdup (bookmarks->name);
+      if (! b->name)
+	{
+	  fprintf (stderr, "can't strdup bookmark name\n");
+	  free (b);
+	  return false;
+	}
+      *dropped_bookmarks_tail = b;
+      dropped_bookmarks_tail = & b->next;
+    }
+  return true;
+}
+
+
+static void free_dropped_bookmarks (void)
+{
+  bookmark_t *b, *n;
+
+  for (b = dropped_bookmarks; b; b = n)
+    {
+      n = b->next;
+      free (b->name);
+      free (b);
+    }
+  dropped_bookmarks = NULL;
+  dropped_bookmarks_tail = & dropped_bookmarks;
+}
+
+
+static void flush_dropped_bookmarks (void)
+{
+  if (dropped_bookmarks && last_page)
+    add_bookmarks (dropped_bookmarks, last_page);
+  free_dropped_bookmarks ();
+}
+
+
+/* The last page may still be overlaid, or be given the bookmarks of
+   dropped pages, so it's written when the next page is started or its
+   file is left. */
+static void close_last_page (void)
+{
+  if (last_page)
+    pdf_close_page (last_page);
+  last_page = NULL;
+}
+
+
 bool process_page (int image,  /* range 1 .. n */
 		   input_attributes_t input_attributes,
 		   bookmark_t *bookmarks,
@@ -206,16 +339,45 @@ bool process_page (int image,  /* range 1 .. n */
 {
   pdf_page_handle page;
   image_info_t image_info;
+  bool blank = false;
   
   if (! get_image_info (image, input_attributes, & image_info))
     return false;
 
   output_attributes.position.x = 0.0;
   output_attributes.position.y = 0.0;
+
+  if (output_attributes.overlay && last_page_dropped)
+    return true;  // nothing to overlay
+
+  if (input_attributes.blank_pages && ! output_attributes.overlay)
+    blank = is_blank_image (image, input_attributes, & image_info);
+
+  if (page_label)
+    {
+      has_label = true;
+      label = * page_label;
+    }
+
+  if (blank && (input_attributes.blank_pages == BLANK_PAGES_DROP))
+    {
+      if (verbose)
+	fprintf (stderr, "dropping blank image %d\n", image);
+      last_page_dropped = true;
+      label.base++;
+      relabel = has_label;
+      return drop_bookmarks (bookmarks);
+    }
+  last_page_dropped = false;
   
   if (output_attributes.overlay)
     {
       page = last_page;
+      if (! page)
+	{
+	  fprintf (stderr, "no page to overlay\n");
+	  return false;
+	}
 
       if (output_attributes.overlay->imagemask)
 	{
@@ -237,6 +399,7 @@ bool process_page (int image,  /* range 1 .. n */
     }
   else
     {
+      close_last_page ();
       last_page = page = pdf_new_page (out->pdf,
 				       image_info.width_points,
 				       image_info.height_points);
@@ -244,43 +407,40 @@ bool process_page (int image,  /* range 1 .. n */
       last_size.height = image_info.height_points;
     }
 
-  if (! process_image (image,
-		       input_attributes,
-		       & image_info,
-		       page,
-		       output_attributes))
+  if (blank)
+    {
+      if (verbose)
+	fprintf (stderr, "replacing blank image %d\n", image);
+      pdf_write_blank_image (page,
+			     output_attributes.position.x,
+			     output_attributes.position.y,
+			     image_info.width_points,
+			     image_info.height_points);
+    }
+  else if (! process_image (image,
+			    input_attributes,
+			    & image_info,
+			    page,
+			    output_attributes))
     return false;
 
   if (output_attributes.overlay)
     return page != NULL;  // not creating a new page, so no bookmarks or page label
 
-  while (bookmarks)
-    {
-      if (bookmarks->level <= MAX_BOOKMARK_LEVEL)
-	{
-	  pdf_bookmark_handle parent = bookmark_vector [bookmarks->level - 1];
-	  bookmark_vector [bookmarks->level] = pdf_new_bookmark (parent,
-								 bookmarks->name,
-								 0,
-								 page);
-	}
-      else
-	{
-	  (void) pdf_new_bookmark (bookmark_vector [MAX_BOOKMARK_LEVEL],
-				   bookmarks->name,
-				   0,
-				   page);
-	}
-      bookmarks = bookmarks->next;
-    }
+  add_bookmarks (dropped_bookmarks, page);
+  free_dropped_bookmarks ();
+  add_bookmarks (bookmarks, page);
 
-  if (page_label)
+  if (page_label || relabel)
     pdf_new_page_label (out->pdf,
-			page_label->page_index,
-			page_label->base,
-			page_label->count,
-			page_label->style,
-			page_label->prefix);
+			kept_pages,
+			label.base,
+			label.count,
+			label.style,
+			label.prefix);
+  relabel = false;
+  label.base++;
+  kept_pages++;
 
   return page != NULL;
 }
@@ -348,10 +508,34 @@ static void generate_bookmark_name (char *name,
 }
 
 
+static bool parse_threshold (char *arg, threshold_t *threshold)
+{
+  char *end;
+  long level;
+
+  if (strcmp (arg, "otsu") == 0)
+    threshold->method = THRESHOLD_OTSU;
+  else if (strcmp (arg, "adaptive") == 0)
+    threshold->method = THRESHOLD_ADAPTIVE;
+  else
+    {
+      level = strtol (arg, & end, 10);
+      if ((*end) || (end == arg) || (level < 0) || (level > 255))
+	return false;
+      threshold->method = THRESHOLD_FIXED;
+      threshold->level = level;
+    }
+  return true;
+}
+
+
 void main_args (char *out_fn,
 		int inf_count,
 		char **in_fn,
-		char *bookmark_fmt)
+		char *bookmark_fmt,
+		threshold_t *threshold,
+		bool mrc,
+		bool drop_blank)
 {
   int i, ip;
   input_attributes_t input_attributes;
@@ -368,6 +552,15 @@ void main_args (char *out_fn,
   memset (& output_attributes,   0, sizeof (output_attributes));
   memset (& pdf_file_attributes, 0, sizeof (pdf_file_attributes));
 
+  if (threshold)
+    {
+      input_attributes.has_threshold = true;
+      input_attributes.threshold = * threshold;
+    }
+  input_attributes.has_mrc = mrc;
+  if (drop_blank)
+    input_attributes.blank_pages = BLANK_PAGES_DROP;
+
   if (! open_pdf_output_file (out_fn, & pdf_file_attributes))
     fatal (3, "error opening output file \"%s\"\n", out_fn);
   for (i = 0; i < inf_count; i++)
@@ -420,6 +613,10 @@ int main (int argc, char *argv[])
 #endif
   char *out_fn = NULL;
   char *bookmark_fmt = NULL;
+  threshold_t threshold;
+  bool has_threshold = false;
+  bool mrc = false;
+  bool drop_blank = false;
   int inf_count = 0;
   char *in_fn [MAX_INPUT_FILES];
 
@@ -431,6 +628,7 @@ int main (int argc, char *argv[])
   init_jpeg_handler ();
   init_pbm_handler ();
   init_png_handler ();
+  init_jp2_handler ();
 
   while (--argc)
     {
@@ -478,6 +676,44 @@ int main (int argc, char *argv[])
 	      else
 		fatal (1, "missing format string after \"-b\" option\n");
 	    }
+	  else if (strcmp (argv [1], "-t") == 0)
+	    {
+	      if (argc)
+		{
+		  argc--;
+		  argv++;
+		  if (! parse_threshold (argv [1], & threshold))
+		    fatal (1, "invalid threshold \"%s\"\n", argv [1]);
+		  has_threshold = true;
+		}
+	      else
+		fatal (1, "missing threshold after \"-t\" option\n");
+	    }
+	  else if (strcmp (argv [1], "-m") == 0)
+	    mrc = true;
+	  else if (strcmp (argv [1], "-d") == 0)
+	    drop_blank = true;
+	  else if (strcmp (argv [1], "-z") == 0)
+	    object_streams = true;
+	  else if (strcmp (argv [1], "-l") == 0)
+	    linearize = true;
+	  else if (strcmp (argv [1], "-f") == 0)
+	    {
+	      if (argc)
+		{
+		  char *end;
+		  long fanout;
+
+		  argc--;
+		  argv++;
+		  fanout = strtol (argv [1], & end, 10);
+		  if ((*end) || (end == argv [1]) || (fanout < 2) || (fanout > INT_MAX))
+		    fatal (1, "invalid page tree fan-out \"%s\"\n", argv [1]);
+		  page_tree_fanout = fanout;
+		}
+	      else
+		fatal (1, "missing fan-out after \"-f\" option\n");
+	    }
 	  else
 	    fatal (1, "unrecognized option \"%s\"\n", argv [1]);
 	}
@@ -507,16 +743,28 @@ int main (int argc, char *argv[])
   if (out_fn && ! inf_count)
     fatal (1, "no input files specified\n");
 
+  if (object_streams && linearize)
+    fatal (1, "the \"-l\" and \"-z\" options can't be used together\n");
+
 #ifdef CTL_LANG
   if (control_fn)
     main_control (control_fn);
   else
-    main_args (out_fn, inf_count, in_fn, bookmark_fmt);
+    main_args (out_fn, inf_count, in_fn, bookmark_fmt,
+	       has_threshold ? & threshold : NULL, mrc, drop_blank);
 #else
-  main_args (out_fn, inf_count, in_fn, bookmark_fmt);
+  main_args (out_fn, inf_count, in_fn, bookmark_fmt,
+	       has_threshold ? & threshold : NULL, mrc, drop_blank);
 #endif
   
   close_input_file ();
   close_pdf_output_files ();
+  if (verbose)
+    {
+      fprintf (stderr, "at most %lu PDF objects were in memory\n",
+	       pdf_peak_object_count ());
+      fprintf (stderr, "%lu images were reused rather than written again, saving %llu bytes\n",
+	       pdf_reused_image_count (), pdf_reused_image_bytes ());
+    }
   exit (0);
 }
@@ -36,10 +36,30 @@ typedef struct
 
   bool has_rotation;
   int rotation;
+  bool render_rotation;  /* by the placement matrix, even if the samples
+			    could be turned */
 
   bool has_crop;
   crop_t crop;
 
+  bool trim;
+
+  bool has_threshold;
+  threshold_t threshold;
+
+  bool has_mrc;
+  int mrc_reduction;  /* of the background, 0 for the default */
+
+  bool has_downsample;
+  downsample_t downsample;
+
+  bool has_morphology;
+  int morphology;
+
+  bool deskew;
+
+  int blank_pages;  /* BLANK_PAGES_DROP or _REPLACE, 0 to keep them */
+
   rgb_range_t *transparency;
 } input_attributes_t;
 
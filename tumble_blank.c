@@ -26,6 +26,7 @@
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 
 
 #include "semantics.h"
@@ -130,6 +131,7 @@ static bool process_blank_image (int image,  /* range 1 .. n */
 								      & pdf_write_blank_content_callback,
 								      page));
       pdf_page_add_content_stream(pdf_page, content_stream);
+      free (page);
     }
   return true;
 }
@@ -142,5 +144,7 @@ input_handler_t blank_handler =
     close_blank_input_file,
     last_blank_input_page,
     get_blank_image_info,
-    process_blank_image
+    process_blank_image,
+    NULL,
+    true  /* there's nothing to crop */
   };
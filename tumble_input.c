@@ -156,6 +156,11 @@ bool get_image_info (int image,
 {
   if (! current_input_handler)
     return false;
+  if (input_attributes.has_crop && ! current_input_handler->crop)
+    {
+      fprintf (stderr, "cropping is only supported for JPEG images\n");
+      return false;
+    }
   return current_input_handler->get_image_info (image,
 						input_attributes,
 						image_info);
@@ -169,9 +174,104 @@ bool process_image (int image,
 {
   if (! current_input_handler)
     return false;
+  /* handlers that turn the samples themselves set this back to 0 */
+  pdf_set_image_rotation (page, input_attributes.rotation);
   return current_input_handler->process_image (image,
 					       input_attributes,
 					       image_info,
 					       page,
 					       output_attributes);
 }
+
+
+void rotate_image_size (image_info_t *image_info, int rotation)
+{
+  double temp;
+
+  if ((rotation == 90) || (rotation == 270))
+    {
+      temp = image_info->width_points;
+      image_info->width_points = image_info->height_points;
+      image_info->height_points = temp;
+    }
+}
+
+
+bool is_blank_image (int image,
+		     input_attributes_t input_attributes,
+		     image_info_t *image_info)
+{
+  if (! (current_input_handler && current_input_handler->is_blank_image))
+    return false;
+  return current_input_handler->is_blank_image (image,
+						input_attributes,
+						image_info);
+}
+
+
+bool inked_band (uint64_t black, uint32_t width, uint32_t rows)
+{
+  return black * BLANK_INK_FRACTION > (uint64_t) width * rows;
+}
+
+
+bool filter_input_bitmap (Bitmap *bitmap,
+			  input_attributes_t input_attributes)
+{
+  if (input_attributes.trim)
+    {
+      Rect content;
+
+      if (! trim_borders (bitmap, & content))
+	return false;
+      if (verbose)
+	fprintf (stderr, "trimmed borders: left %d, right %d, top %d, bottom %d\n",
+		 content.min.x - bitmap->rect.min.x,
+		 bitmap->rect.max.x - content.max.x,
+		 content.min.y - bitmap->rect.min.y,
+		 bitmap->rect.max.y - content.max.y);
+    }
+
+  if (input_attributes.has_morphology)
+    {
+      uint64_t transitions = verbose ? count_transitions (bitmap) : 0;
+      bool result;
+
+      switch (input_attributes.morphology)
+	{
+	case MORPH_ERODE:  result = erode_bitmap (bitmap); break;
+	case MORPH_DILATE: result = dilate_bitmap (bitmap); break;
+	case MORPH_OPEN:   result = open_bitmap (bitmap); break;
+	case MORPH_CLOSE:  result = close_bitmap (bitmap); break;
+	default:           result = despeckle_bitmap (bitmap); break;
+	}
+      if (! result)
+	return false;
+
+      if (verbose)
+	{
+	  uint64_t filtered = count_transitions (bitmap);
+	  fprintf (stderr, "morphology reduced transitions from %llu to %llu (%.1f%%)\n",
+		   (unsigned long long) transitions,
+		   (unsigned long long) filtered,
+		   transitions ? (100.0 * ((double) transitions - (double) filtered) / transitions) : 0.0);
+	}
+    }
+
+  if (input_attributes.deskew)
+    {
+      double skew;
+
+      if (! deskew_bitmap (bitmap, & skew))
+	return false;
+      if (verbose)
+	fprintf (stderr, "skew %.2f degrees\n", skew);
+    }
+
+  if (input_attributes.has_downsample)
+    return reduce_bitmap (bitmap,
+			  input_attributes.downsample.factor,
+			  input_attributes.downsample.level);
+
+  return true;
+}
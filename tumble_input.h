@@ -47,6 +47,11 @@ typedef struct
 			 pdf_page_handle page,
 			 output_attributes_t output_attributes
 			 );
+  /* may be NULL if blank images can't be detected */
+  bool (*is_blank_image) (int image,
+			  input_attributes_t input_attributes,
+			  image_info_t *image_info);
+  bool crop;  /* honors input_attributes.crop */
 } input_handler_t;
 
 
@@ -65,11 +70,36 @@ bool process_image (int image,
 		    image_info_t *image_info,
 		    pdf_page_handle page,
 		    output_attributes_t output_attributes);
+/* For images whose samples are only turned by the matrix that places
+   them: swaps the width and height in points if the rotation is 90 or
+   270, leaving those in samples as stored. */
+void rotate_image_size (image_info_t *image_info, int rotation);
+
+bool is_blank_image (int image,
+		     input_attributes_t input_attributes,
+		     image_info_t *image_info);
+
+
+/* Blank images are detected a band of BLANK_BAND_ROWS rows at a time,
+   stopping at the first band that has more than 1 / BLANK_INK_FRACTION
+   of its pixels black, so only blank images are read completely. */
+#define BLANK_BAND_ROWS 64
+#define BLANK_INK_FRACTION 512
+
+bool inked_band (uint64_t black, uint32_t width, uint32_t rows);
+
+
+/* Border trimming, morphological filtering, deskewing, and
+   downsampling of a bilevel image, as specified by the input
+   attributes, to be done before rotation. */
+bool filter_input_bitmap (Bitmap *bitmap,
+			  input_attributes_t input_attributes);
 
 
 void init_tiff_handler (void);
 void init_jpeg_handler (void);
 void init_pbm_handler  (void);
 void init_png_handler  (void);
+void init_jp2_handler  (void);
 
 extern input_handler_t blank_handler;
@@ -0,0 +1,408 @@
+/*
+ * tumble: build a PDF file from image files
+ *
+ * JPEG 2000 (JP2) input handler
+ *
+ * Derived from tumble_jpeg.c written 2003 by Eric Smith <spacewar@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.  Note that permission is
+ * not granted to redistribute this program under the terms of any
+ * other version of the General Public License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111 USA
+ */
+
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>  /* strcasecmp() is a BSDism */
+
+
+#include "semantics.h"
+#include "tumble.h"
+#include "bitblt.h"
+#include "pdf.h"
+#include "tumble_input.h"
+
+
+/* The image is never decoded; only the JP2 boxes needed to describe the
+   image are parsed, and the contiguous codestream box is later copied
+   as-is into a JPXDecode stream. */
+
+
+#define BOX_TYPE(a,b,c,d) (((a) << 24) | ((b) << 16) | ((c) << 8) | (d))
+
+#define BOX_JP2H BOX_TYPE ('j', 'p', '2', 'h')
+#define BOX_IHDR BOX_TYPE ('i', 'h', 'd', 'r')
+#define BOX_COLR BOX_TYPE ('c', 'o', 'l', 'r')
+#define BOX_RES  BOX_TYPE ('r', 'e', 's', ' ')
+#define BOX_RESC BOX_TYPE ('r', 'e', 's', 'c')
+#define BOX_RESD BOX_TYPE ('r', 'e', 's', 'd')
+#define BOX_JP2C BOX_TYPE ('j', 'p', '2', 'c')
+
+/* enumerated color spaces from the colr box */
+#define JP2_ECS_SRGB      16
+#define JP2_ECS_GRAYSCALE 17
+
+#define BENUM(p) (((p)[0]<<24)+((p)[1]<<16)+((p)[2]<<8)+(p)[3])
+#define BENUM16(p) (((p)[0]<<8)+(p)[1])
+
+
+static FILE *jp2_f;
+
+static struct {
+  bool seen_ihdr;
+  bool seen_colr;
+  bool seen_jp2c;
+  uint32_t width;
+  uint32_t height;
+  uint16_t components;
+  uint8_t bpc;
+  uint8_t colr_method;
+  uint32_t enum_cs;
+  double x_ppm, y_ppm;  /* pixels per meter, 0 if unknown */
+  bool display_resolution;
+  long codestream_offset;
+  long codestream_length;
+} cinfo;
+
+
+static bool match_jp2_suffix (char *suffix)
+{
+  return ((strcasecmp (suffix, ".jp2") == 0) ||
+	  (strcasecmp (suffix, ".jpx") == 0));
+}
+
+static bool close_jp2_input_file (void)
+{
+  return true;
+}
+
+
+static bool open_jp2_input_file (FILE *f, char *name)
+{
+  const uint8_t sig [12] = { 0x00, 0x00, 0x00, 0x0c, 'j', 'P', ' ', ' ',
+			     0x0d, 0x0a, 0x87, 0x0a };
+  uint8_t buf [12];
+  size_t l;
+
+  l = fread (& buf [0], 1, sizeof (buf), f);
+  rewind (f);
+  if ((l != sizeof (sig)) || memcmp (buf, sig, sizeof (sig)))
+    return false;
+
+  jp2_f = f;
+
+  return true;
+}
+
+
+static bool last_jp2_input_page (void)
+{
+  return true;
+}
+
+
+/* Reads a box header at the current file position.  On return the file
+   is positioned at the start of the box contents. */
+static bool read_jp2_box_header (long limit,
+				 uint32_t *type,
+				 long *content_offset,
+				 long *content_length)
+{
+  uint8_t buf [8];
+  long box_offset = ftell (jp2_f);
+  uint64_t length;
+  int header_length = 8;
+
+  if (fread (buf, 1, 8, jp2_f) != 8)
+    return false;
+  length = BENUM (buf);
+  *type = BENUM (buf + 4);
+
+  if (length == 1)
+    {
+      /* extended length */
+      if (fread (buf, 1, 8, jp2_f) != 8)
+	return false;
+      length = (((uint64_t) BENUM (buf)) << 32) | (uint32_t) BENUM (buf + 4);
+      header_length = 16;
+    }
+  else if (length == 0)
+    {
+      /* box extends to end of the enclosing box or file */
+      length = limit - box_offset;
+    }
+
+  if ((length < header_length) || (box_offset + length > limit))
+    return false;
+
+  *content_offset = box_offset + header_length;
+  *content_length = length - header_length;
+  return true;
+}
+
+
+static bool parse_jp2_resolution (long length, bool display)
+{
+  uint8_t buf [10];
+  int vr_n, vr_d, hr_n, hr_d;
+  int8_t vr_e, hr_e;
+  double x_ppm, y_ppm;
+  int i;
+
+  if ((length != 10) || (fread (buf, 1, 10, jp2_f) != 10))
+    return false;
+
+  /* capture resolution is only used if there is no display resolution */
+  if (cinfo.display_resolution && ! display)
+    return true;
+
+  vr_n = BENUM16 (buf);
+  vr_d = BENUM16 (buf + 2);
+  hr_n = BENUM16 (buf + 4);
+  hr_d = BENUM16 (buf + 6);
+  vr_e = (int8_t) buf [8];
+  hr_e = (int8_t) buf [9];
+  if (! (vr_n && vr_d && hr_n && hr_d))
+    return true;
+
+  y_ppm = (double) vr_n / vr_d;
+  for (i = 0; i < vr_e; i++)
+    y_ppm *= 10.0;
+  for (i = 0; i > vr_e; i--)
+    y_ppm /= 10.0;
+
+  x_ppm = (double) hr_n / hr_d;
+  for (i = 0; i < hr_e; i++)
+    x_ppm *= 10.0;
+  for (i = 0; i > hr_e; i--)
+    x_ppm /= 10.0;
+
+  cinfo.x_ppm = x_ppm;
+  cinfo.y_ppm = y_ppm;
+  cinfo.display_resolution = display;
+  return true;
+}
+
+
+/* Walks the boxes between the current position and limit, descending
+   into the superboxes that are of interest. */
+static bool parse_jp2_boxes (long limit)
+{
+  uint32_t type;
+  long offset, length;
+  uint8_t buf [14];
+
+  while (ftell (jp2_f) < limit)
+    {
+      if (! read_jp2_box_header (limit, & type, & offset, & length))
+	{
+	  fprintf (stderr, "malformed JP2 box\n");
+	  return false;
+	}
+      switch (type)
+	{
+	case BOX_JP2H:
+	case BOX_RES:
+	  if (! parse_jp2_boxes (offset + length))
+	    return false;
+	  break;
+	case BOX_IHDR:
+	  if (cinfo.seen_ihdr || (length != 14) ||
+	      (fread (buf, 1, 14, jp2_f) != 14))
+	    {
+	      fprintf (stderr, "malformed JP2 image header box\n");
+	      return false;
+	    }
+	  cinfo.seen_ihdr = true;
+	  cinfo.height = BENUM (buf);
+	  cinfo.width = BENUM (buf + 4);
+	  cinfo.components = BENUM16 (buf + 8);
+	  cinfo.bpc = buf [10];
+	  break;
+	case BOX_COLR:
+	  /* only the first colr box is significant */
+	  if (cinfo.seen_colr)
+	    break;
+	  if ((length < 3) || (fread (buf, 1, 3, jp2_f) != 3))
+	    {
+	      fprintf (stderr, "malformed JP2 color specification box\n");
+	      return false;
+	    }
+	  cinfo.seen_colr = true;
+	  cinfo.colr_method = buf [0];
+	  if (cinfo.colr_method == 1)
+	    {
+	      if ((length < 7) || (fread (buf, 1, 4, jp2_f) != 4))
+		{
+		  fprintf (stderr, "malformed JP2 color specification box\n");
+		  return false;
+		}
+	      cinfo.enum_cs = BENUM (buf);
+	    }
+	  break;
+	case BOX_RESC:
+	case BOX_RESD:
+	  if (! parse_jp2_resolution (length, type == BOX_RESD))
+	    {
+	      fprintf (stderr, "malformed JP2 resolution box\n");
+	      return false;
+	    }
+	  break;
+	case BOX_JP2C:
+	  /* only the first codestream is used */
+	  if (! cinfo.seen_jp2c)
+	    {
+	      cinfo.seen_jp2c = true;
+	      cinfo.codestream_offset = offset;
+	      cinfo.codestream_length = length;
+	    }
+	  break;
+	default:
+	  break;
+	}
+      if (fseek (jp2_f, offset + length, SEEK_SET))
+	return false;
+    }
+  return true;
+}
+
+
+static bool get_jp2_image_info (int image,
+				input_attributes_t input_attributes,
+				image_info_t *image_info)
+{
+  long file_length;
+
+  memset (& cinfo, 0, sizeof (cinfo));
+
+  if (fseek (jp2_f, 0, SEEK_END))
+    return false;
+  file_length = ftell (jp2_f);
+  rewind (jp2_f);
+
+  if (! parse_jp2_boxes (file_length))
+    return false;
+  rewind (jp2_f);
+
+#ifdef DEBUG_JPEG
+  printf ("components: %d\n", cinfo.components);
+  printf ("bits per component: %d\n", cinfo.bpc);
+  printf ("color method: %d\n", cinfo.colr_method);
+  printf ("enumerated color space: %d\n", cinfo.enum_cs);
+  printf ("x density: %g\n", cinfo.x_ppm);
+  printf ("y density: %g\n", cinfo.y_ppm);
+  printf ("width: %d\n", cinfo.width);
+  printf ("height: %d\n", cinfo.height);
+#endif
+
+  if (! (cinfo.seen_ihdr && cinfo.seen_colr && cinfo.seen_jp2c))
+    {
+      fprintf (stderr, "JP2 file is missing a required box\n");
+      return false;
+    }
+
+  if ((cinfo.bpc == 0xff) || (cinfo.bpc & 0x80))
+    {
+      fprintf (stderr, "JP2 images with signed or varying bit depth not supported\n");
+      return false;
+    }
+
+  switch (cinfo.components)
+    {
+    case 1:
+      image_info->color = 0;
+      break;
+    case 3:
+      image_info->color = 1;
+      break;
+    default:
+      fprintf (stderr, "JP2 image has %d components, should have 1 or 3\n",
+	       cinfo.components);
+      return false;
+    }
+
+  /* Enumerated color spaces other than sRGB and grayscale (e.g., sYCC)
+     would need conversion.  An ICC profile is assumed to describe an
+     RGB or gray space consistent with the component count. */
+  if ((cinfo.colr_method == 1) &&
+      (cinfo.enum_cs != (image_info->color ? JP2_ECS_SRGB : JP2_ECS_GRAYSCALE)))
+    {
+      fprintf (stderr, "JP2 color space %d not supported\n", cinfo.enum_cs);
+      return false;
+    }
+
+  image_info->width_samples = cinfo.width;
+  image_info->height_samples = cinfo.height;
+
+  if (cinfo.x_ppm && cinfo.y_ppm)
+    {
+      image_info->width_points = ((image_info->width_samples * POINTS_PER_INCH) /
+				  (cinfo.x_ppm * 0.0254));
+      image_info->height_points = ((image_info->height_samples * POINTS_PER_INCH) /
+				   (cinfo.y_ppm * 0.0254));
+    }
+  else
+    {
+      /* assume 300 DPI - not great, but what else can we do? */
+      image_info->width_points = (image_info->width_samples * POINTS_PER_INCH) / 300.0;
+      image_info->height_points = (image_info->height_samples * POINTS_PER_INCH) / 300.0;
+    }
+
+  rotate_image_size (image_info, input_attributes.rotation);
+
+  return true;
+}
+
+
+static bool process_jp2_image (int image,  /* range 1 .. n */
+			       input_attributes_t input_attributes,
+			       image_info_t *image_info,
+			       pdf_page_handle page,
+			       output_attributes_t output_attributes)
+{
+  pdf_write_jp2_image (page,
+		       output_attributes.position.x, output_attributes.position.y,
+		       image_info->width_points,
+		       image_info->height_points,
+		       image_info->color,
+		       image_info->width_samples,
+		       image_info->height_samples,
+		       input_attributes.transparency,
+		       jp2_f,
+		       cinfo.codestream_offset,
+		       cinfo.codestream_length);
+
+  return true;
+}
+
+
+input_handler_t jp2_handler =
+  {
+    match_jp2_suffix,
+    open_jp2_input_file,
+    close_jp2_input_file,
+    last_jp2_input_page,
+    get_jp2_image_info,
+    process_jp2_image,
+    NULL,
+    false
+  };
+
+
+void init_jp2_handler (void)
+{
+  install_input_handler (& jp2_handler);
+}
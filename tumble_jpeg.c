@@ -25,6 +25,8 @@
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <strings.h>  /* strcasecmp() is a BSDism */
 #include <jpeglib.h>
 
@@ -42,6 +44,35 @@ static struct jpeg_decompress_struct cinfo;
 static struct jpeg_error_mgr jerr;
 
 
+/* Rotation (unless it is to be done by the matrix that places the
+   image) and cropping are done losslessly, on the DCT coefficients, as
+   jpegtran does.  The coefficients of each block are transposed and
+   have their signs changed, and the blocks are moved; no samples are
+   decoded.  Cropping is by whole MCUs (the smallest group of blocks of
+   all of the components), keeping any part MCU at the edges.  An MCU
+   that is only part in the image would come to the top or left edge
+   when turned, so is trimmed off, losing at most 15 rows or columns. */
+static struct
+{
+  bool transform;
+  int rotation;  /* of the blocks, 0 if only cropping */
+  uint32_t x, y;  /* of the area kept, in the image as stored */
+  uint32_t width, height;
+} jpeg_transform;
+
+
+#define SWAP(type,a,b) do { type temp; temp = a; a = b; b = temp; } while (0)
+
+
+/* Blank pages are found from the DC coefficients alone, by decoding the
+   luminance at 1/8 scale, so that each sample is the average of an 8x8
+   block.  A block is ink if it is darker than the brightest block seen
+   so far, taken to be the paper, by at least BLANK_BLOCK_CONTRAST; a thin
+   stroke only darkens its block a little. */
+#define BLANK_SCALE 8
+#define BLANK_BLOCK_CONTRAST 24
+
+
 static bool match_jpeg_suffix (char *suffix)
 {
   return ((strcasecmp (suffix, ".jpg") == 0) ||
@@ -89,11 +120,69 @@ static bool last_jpeg_input_page (void)
 }
 
 
+/* Works out the area of the image to keep, in whole MCUs except at the
+   right and bottom edges. */
+static bool plan_jpeg_transform (input_attributes_t input_attributes,
+				 double x_resolution,
+				 double y_resolution)
+{
+  uint32_t mcu_width = DCTSIZE * cinfo.max_h_samp_factor;
+  uint32_t mcu_height = DCTSIZE * cinfo.max_v_samp_factor;
+  uint32_t x0 = 0, y0 = 0;
+  uint32_t x1 = cinfo.image_width, y1 = cinfo.image_height;
+  int rotation = 0;
+
+  if (! input_attributes.render_rotation)
+    rotation = input_attributes.rotation;
+
+  if (input_attributes.has_crop)
+    {
+      double left = input_attributes.crop.left * x_resolution;
+      double right = input_attributes.crop.right * x_resolution;
+      double top = input_attributes.crop.top * y_resolution;
+      double bottom = input_attributes.crop.bottom * y_resolution;
+
+      if ((left + right >= cinfo.image_width) ||
+	  (top + bottom >= cinfo.image_height))
+	{
+	  fprintf (stderr, "JPEG image cropped away entirely\n");
+	  return false;
+	}
+      /* the kept area is rounded out to MCU boundaries */
+      x0 = ((uint32_t) left / mcu_width) * mcu_width;
+      y0 = ((uint32_t) top / mcu_height) * mcu_height;
+      x1 = cinfo.image_width - (uint32_t) right;
+      y1 = cinfo.image_height - (uint32_t) bottom;
+      x1 = ((x1 + mcu_width - 1) / mcu_width) * mcu_width;
+      y1 = ((y1 + mcu_height - 1) / mcu_height) * mcu_height;
+      if (x1 > cinfo.image_width)
+	x1 = cinfo.image_width;
+      if (y1 > cinfo.image_height)
+	y1 = cinfo.image_height;
+    }
+
+  /* the part MCUs that would come to the top or left */
+  if (((rotation == 90) || (rotation == 180)) && ((y1 - y0) > mcu_height))
+    y1 = y0 + ((y1 - y0) / mcu_height) * mcu_height;
+  if (((rotation == 180) || (rotation == 270)) && ((x1 - x0) > mcu_width))
+    x1 = x0 + ((x1 - x0) / mcu_width) * mcu_width;
+
+  jpeg_transform.transform = (rotation || input_attributes.has_crop);
+  jpeg_transform.rotation = rotation;
+  jpeg_transform.x = x0;
+  jpeg_transform.y = y0;
+  jpeg_transform.width = x1 - x0;
+  jpeg_transform.height = y1 - y0;
+  return true;
+}
+
+
 static bool get_jpeg_image_info (int image,
 				 input_attributes_t input_attributes,
 				 image_info_t *image_info)
 {
   double unit;
+  double x_resolution, y_resolution;
 
 #ifdef DEBUG_JPEG
   printf ("color space: %d\n", cinfo.jpeg_color_space);
@@ -130,8 +219,6 @@ static bool get_jpeg_image_info (int image,
       fprintf (stderr, "JPEG color space %d not supported\n", cinfo.jpeg_color_space);
       return false;
     }
-  image_info->width_samples = cinfo.image_width;
-  image_info->height_samples = cinfo.image_height;
 
   if (cinfo.saw_JFIF_marker & cinfo.density_unit)
     {
@@ -147,28 +234,248 @@ static bool get_jpeg_image_info (int image,
 	  fprintf (stderr, "JFIF density unit %d not supported\n", cinfo.density_unit);
 	  return false;
 	}
-      image_info->width_points = ((image_info->width_samples * POINTS_PER_INCH) /
-				  (cinfo.X_density * unit));
-      image_info->height_points = ((image_info->height_samples * POINTS_PER_INCH) /
-				   (cinfo.Y_density * unit));
+      x_resolution = cinfo.X_density * unit;
+      y_resolution = cinfo.Y_density * unit;
     }
   else
     {
       /* assume 300 DPI - not great, but what else can we do? */
-      image_info->width_points = (image_info->width_samples * POINTS_PER_INCH) / 300.0;
-      image_info->height_points = (image_info->height_samples * POINTS_PER_INCH) / 300.0;
+      x_resolution = 300.0;
+      y_resolution = 300.0;
+    }
+
+  if (! plan_jpeg_transform (input_attributes, x_resolution, y_resolution))
+    return false;
+
+  image_info->width_samples = jpeg_transform.width;
+  image_info->height_samples = jpeg_transform.height;
+  if ((jpeg_transform.rotation == 90) || (jpeg_transform.rotation == 270))
+    {
+      SWAP (uint32_t, image_info->width_samples, image_info->height_samples);
+      SWAP (double, x_resolution, y_resolution);
     }
 
+  image_info->width_points = (image_info->width_samples * POINTS_PER_INCH) / x_resolution;
+  image_info->height_points = (image_info->height_samples * POINTS_PER_INCH) / y_resolution;
+
+  if (! jpeg_transform.rotation)
+    rotate_image_size (image_info, input_attributes.rotation);
+
   return true;
 }
 
 
+/* Moves the coefficients of one block, turned by rotation; u and v are
+   the horizontal and vertical frequencies.  Transposing a block swaps
+   them, and mirroring it changes the sign of the odd ones across the
+   mirror. */
+static void transform_jpeg_block (JCOEFPTR dest, JCOEFPTR src, int rotation)
+{
+  int u, v;
+
+  for (v = 0; v < DCTSIZE; v++)
+    for (u = 0; u < DCTSIZE; u++)
+      switch (rotation)
+	{
+	case 90:   /* transpose, then mirror left to right */
+	  dest [v * DCTSIZE + u] = (u & 1) ? - src [u * DCTSIZE + v] : src [u * DCTSIZE + v];
+	  break;
+	case 180:  /* mirror both ways */
+	  dest [v * DCTSIZE + u] = ((u + v) & 1) ? - src [v * DCTSIZE + u] : src [v * DCTSIZE + u];
+	  break;
+	case 270:  /* transpose, then mirror top to bottom */
+	  dest [v * DCTSIZE + u] = (v & 1) ? - src [u * DCTSIZE + v] : src [u * DCTSIZE + v];
+	  break;
+	default:
+	  dest [v * DCTSIZE + u] = src [v * DCTSIZE + u];
+	  break;
+	}
+}
+
+
+/* Fills the blocks of one component of the destination from the kept
+   area of the source.  The blocks past the edges that pad out the last
+   MCUs are left zero if there is no source block for them. */
+static void transform_jpeg_component (j_decompress_ptr src,
+				      jpeg_component_info *src_comp,
+				      jvirt_barray_ptr src_blocks,
+				      jvirt_barray_ptr dest_blocks,
+				      uint32_t dest_columns,
+				      uint32_t dest_rows,
+				      int dest_v_samp_factor)
+{
+  /* the kept area, in blocks of this component */
+  int32_t x0 = (jpeg_transform.x / (DCTSIZE * src->max_h_samp_factor)) * src_comp->h_samp_factor;
+  int32_t y0 = (jpeg_transform.y / (DCTSIZE * src->max_v_samp_factor)) * src_comp->v_samp_factor;
+  int32_t columns = ((jpeg_transform.width * src_comp->h_samp_factor +
+		      DCTSIZE * src->max_h_samp_factor - 1) /
+		     (DCTSIZE * src->max_h_samp_factor));
+  int32_t rows = ((jpeg_transform.height * src_comp->v_samp_factor +
+		   DCTSIZE * src->max_v_samp_factor - 1) /
+		  (DCTSIZE * src->max_v_samp_factor));
+  int32_t src_columns = src_comp->width_in_blocks;
+  int32_t src_rows = src_comp->height_in_blocks;
+  int32_t dx, dy, sx, sy;
+  int32_t k;
+
+  for (dy = 0; dy < (int32_t) dest_rows; dy += dest_v_samp_factor)
+    {
+      JBLOCKARRAY dest = (* src->mem->access_virt_barray) ((j_common_ptr) src,
+							   dest_blocks,
+							   dy,
+							   dest_v_samp_factor,
+							   TRUE);
+
+      for (k = 0; k < dest_v_samp_factor; k++)
+	for (dx = 0; dx < (int32_t) dest_columns; dx++)
+	  {
+	    JBLOCKARRAY row;
+
+	    switch (jpeg_transform.rotation)
+	      {
+	      case 90:   sx = dy + k;               sy = rows - 1 - dx;        break;
+	      case 180:  sx = columns - 1 - dx;     sy = rows - 1 - (dy + k);  break;
+	      case 270:  sx = columns - 1 - (dy + k); sy = dx;                 break;
+	      default:   sx = dx;                   sy = dy + k;               break;
+	      }
+	    sx += x0;
+	    sy += y0;
+	    if ((sx < x0) || (sy < y0) || (sx >= src_columns) || (sy >= src_rows))
+	      {
+		memset (dest [k][dx], 0, sizeof (JBLOCK));
+		continue;
+	      }
+	    row = (* src->mem->access_virt_barray) ((j_common_ptr) src,
+						    src_blocks,
+						    sy,
+						    1,
+						    FALSE);
+	    transform_jpeg_block (dest [k][dx], row [0][sx], jpeg_transform.rotation);
+	  }
+    }
+}
+
+
+/* Writes the turned and cropped image to a temporary file, to be copied
+   into the PDF file like any other. */
+static FILE *transform_jpeg_image (void)
+{
+  struct jpeg_decompress_struct src;
+  struct jpeg_compress_struct dest;
+  struct jpeg_error_mgr src_err, dest_err;
+  jvirt_barray_ptr *src_blocks;
+  jvirt_barray_ptr dest_blocks [MAX_COMPONENTS];
+  uint32_t dest_columns [MAX_COMPONENTS], dest_rows [MAX_COMPONENTS];
+  bool transpose = ((jpeg_transform.rotation == 90) ||
+		    (jpeg_transform.rotation == 270));
+  uint32_t dest_width = transpose ? jpeg_transform.height : jpeg_transform.width;
+  uint32_t dest_height = transpose ? jpeg_transform.width : jpeg_transform.height;
+  int dest_max_h, dest_max_v;
+  FILE *f;
+  int ci, i;
+
+  f = tmpfile ();
+  if (! f)
+    {
+      fprintf (stderr, "can't create temporary file for JPEG image\n");
+      return NULL;
+    }
+
+  src.err = jpeg_std_error (& src_err);
+  jpeg_create_decompress (& src);
+  jpeg_stdio_src (& src, jpeg_f);
+  jpeg_read_header (& src, TRUE);
+
+  /* The destination blocks are requested before the coefficients are
+     read, so that they are allocated along with the source blocks. */
+  dest_max_h = transpose ? src.max_v_samp_factor : src.max_h_samp_factor;
+  dest_max_v = transpose ? src.max_h_samp_factor : src.max_v_samp_factor;
+  for (ci = 0; ci < src.num_components; ci++)
+    {
+      jpeg_component_info *comp = src.comp_info + ci;
+      int h = transpose ? comp->v_samp_factor : comp->h_samp_factor;
+      int v = transpose ? comp->h_samp_factor : comp->v_samp_factor;
+
+      dest_columns [ci] = ((dest_width * h + DCTSIZE * dest_max_h - 1) /
+			   (DCTSIZE * dest_max_h));
+      dest_rows [ci] = ((dest_height * v + DCTSIZE * dest_max_v - 1) /
+			(DCTSIZE * dest_max_v));
+      /* the last MCU is padded out with whole blocks */
+      dest_columns [ci] = ((dest_columns [ci] + h - 1) / h) * h;
+      dest_rows [ci] = ((dest_rows [ci] + v - 1) / v) * v;
+      dest_blocks [ci] = (* src.mem->request_virt_barray) ((j_common_ptr) & src,
+							   JPOOL_IMAGE,
+							   FALSE,
+							   dest_columns [ci],
+							   dest_rows [ci],
+							   v);
+    }
+
+  src_blocks = jpeg_read_coefficients (& src);
+
+  dest.err = jpeg_std_error (& dest_err);
+  jpeg_create_compress (& dest);
+  jpeg_copy_critical_parameters (& src, & dest);
+  dest.image_width = dest_width;
+  dest.image_height = dest_height;
+  if (transpose)
+    {
+      for (ci = 0; ci < dest.num_components; ci++)
+	SWAP (int, dest.comp_info [ci].h_samp_factor, dest.comp_info [ci].v_samp_factor);
+      for (i = 0; i < NUM_QUANT_TBLS; i++)
+	{
+	  JQUANT_TBL *table = dest.quant_tbl_ptrs [i];
+	  int u, v;
+
+	  if (table)
+	    for (v = 0; v < DCTSIZE; v++)
+	      for (u = 0; u < v; u++)
+		SWAP (UINT16,
+		      table->quantval [v * DCTSIZE + u],
+		      table->quantval [u * DCTSIZE + v]);
+	}
+    }
+
+  for (ci = 0; ci < src.num_components; ci++)
+    transform_jpeg_component (& src,
+			      src.comp_info + ci,
+			      src_blocks [ci],
+			      dest_blocks [ci],
+			      dest_columns [ci],
+			      dest_rows [ci],
+			      dest.comp_info [ci].v_samp_factor);
+
+  jpeg_stdio_dest (& dest, f);
+  jpeg_write_coefficients (& dest, dest_blocks);
+  jpeg_finish_compress (& dest);
+  jpeg_destroy_compress (& dest);
+
+  jpeg_finish_decompress (& src);
+  jpeg_destroy_decompress (& src);
+
+  rewind (jpeg_f);
+  rewind (f);
+  return f;
+}
+
+
 static bool process_jpeg_image (int image,  /* range 1 .. n */
 				input_attributes_t input_attributes,
 				image_info_t *image_info,
 				pdf_page_handle page,
 				output_attributes_t output_attributes)
 {
+  FILE *f = jpeg_f;
+
+  if (jpeg_transform.transform)
+    {
+      f = transform_jpeg_image ();
+      if (! f)
+	return false;
+      if (jpeg_transform.rotation)
+	pdf_set_image_rotation (page, 0);
+    }
+
   pdf_write_jpeg_image (page,
 			output_attributes.position.x, output_attributes.position.y,
 			image_info->width_points,
@@ -177,12 +484,79 @@ static bool process_jpeg_image (int image,  /* range 1 .. n */
 			image_info->width_samples,
 			image_info->height_samples,
 			input_attributes.transparency,
-			jpeg_f);
+			f);
 
+  if (f != jpeg_f)
+    fclose (f);
   return true;
 }
 
 
+static bool is_blank_jpeg_image (int image,
+				 input_attributes_t input_attributes,
+				 image_info_t *image_info)
+{
+  struct jpeg_decompress_struct dc;
+  struct jpeg_error_mgr dc_err;
+  uint32_t band_rows = BLANK_BAND_ROWS / BLANK_SCALE;
+  JSAMPROW rows = NULL;
+  JSAMPROW row;
+  bool blank = false;
+  int paper = 0;
+  uint32_t black = 0;
+  uint32_t band_row = 0;
+  uint32_t x;
+
+  dc.err = jpeg_std_error (& dc_err);
+  jpeg_create_decompress (& dc);
+  jpeg_stdio_src (& dc, jpeg_f);
+  jpeg_read_header (& dc, TRUE);
+
+  if ((dc.jpeg_color_space != JCS_GRAYSCALE) &&
+      (dc.jpeg_color_space != JCS_YCbCr))
+    goto done;
+
+  dc.scale_num = 1;
+  dc.scale_denom = BLANK_SCALE;
+  dc.out_color_space = JCS_GRAYSCALE;
+  dc.dct_method = JDCT_IFAST;
+  jpeg_start_decompress (& dc);
+
+  rows = malloc (dc.output_width * band_rows);
+  if (! rows)
+    goto done;
+
+  while (dc.output_scanline < dc.output_height)
+    {
+      row = rows + band_row * dc.output_width;
+      jpeg_read_scanlines (& dc, & row, 1);
+      for (x = 0; x < dc.output_width; x++)
+	if (row [x] > paper)
+	  paper = row [x];
+      if ((++band_row < band_rows) &&
+	  (dc.output_scanline < dc.output_height))
+	continue;
+
+      /* the paper may only have been found late in the band */
+      for (row = rows; row < rows + band_row * dc.output_width; row++)
+	if (*row + BLANK_BLOCK_CONTRAST <= paper)
+	  black++;
+      if (inked_band (black, dc.output_width, band_row))
+	goto done;
+      black = 0;
+      band_row = 0;
+    }
+  blank = true;
+
+ done:
+  free (rows);
+  jpeg_abort_decompress (& dc);
+  jpeg_destroy_decompress (& dc);
+  rewind (jpeg_f);
+  return blank;
+}
+
+
 input_handler_t jpeg_handler =
   {
     match_jpeg_suffix,
@@ -190,7 +564,9 @@ input_handler_t jpeg_handler =
     close_jpeg_input_file,
     last_jpeg_input_page,
     get_jpeg_image_info,
-    process_jpeg_image
+    process_jpeg_image,
+    is_blank_jpeg_image,
+    true
   };
 
 
@@ -52,6 +52,7 @@ typedef struct
   int rows;
   int cols;
   int format;
+  long data_offset;
 } pbm_info_t;
 
 static pbm_info_t pbm;
@@ -91,6 +92,7 @@ static bool open_pbm_input_file (FILE *f, char *name)
   pbm.f = f;
 
   pbm_readpbminit (f, & pbm.cols, & pbm.rows, & pbm.format);
+  pbm.data_offset = ftell (f);
 
   return true;
 }
@@ -139,7 +141,7 @@ static bool get_pbm_image_info (int image,
   if ((image_info->height_points > PAGE_MAX_POINTS) || 
       (image_info->width_points > PAGE_MAX_POINTS))
     {
-      fprintf (stdout, "image too large (max %d inches on a side\n", PAGE_MAX_INCHES);
+      fprintf (stderr, "image too large (max %d inches on a side)\n", PAGE_MAX_INCHES);
       return false;
     }
 
@@ -207,7 +209,14 @@ static bool process_pbm_image (int image,  /* range 1 .. n */
 			    input_attributes);
 #endif
 
-  rotate_bitmap (bitmap, input_attributes.rotation);
+  if (! filter_input_bitmap (bitmap, input_attributes))
+    goto fail;
+
+  if (! input_attributes.render_rotation)
+    {
+      rotate_bitmap (bitmap, input_attributes.rotation);
+      pdf_set_image_rotation (page, 0);
+    }
 
   pdf_write_g4_fax_image (page,
 			  output_attributes.position.x, output_attributes.position.y,
@@ -227,6 +236,51 @@ static bool process_pbm_image (int image,  /* range 1 .. n */
 }
 
 
+/* The rows read are put back, for process_pbm_image to read again. */
+static bool is_blank_pbm_image (int image,
+				input_attributes_t input_attributes,
+				image_info_t *image_info)
+{
+  bool blank = false;
+  Rect rect;
+  Bitmap *band;
+  int row, rows, y;
+
+  if (pbm.data_offset < 0)
+    return false;
+
+  rect.min.x = 0;
+  rect.min.y = 0;
+  rect.max.x = pbm.cols;
+  rect.max.y = BLANK_BAND_ROWS;
+  band = create_bitmap (& rect);
+  if (! band)
+    return false;
+
+  for (row = 0; row < pbm.rows; row += rows)
+    {
+      rows = ((pbm.rows - row) < BLANK_BAND_ROWS) ? (pbm.rows - row) : BLANK_BAND_ROWS;
+      for (y = 0; y < rows; y++)
+	pbm_readpbmrow_packed (pbm.f,
+			       (unsigned char *) (band->bits + y * band->row_words),
+			       pbm.cols,
+			       pbm.format);
+#ifdef PBM_REVERSE_BITS
+      reverse_bits ((uint8_t *) band->bits,
+		    rows * band->row_words * sizeof (word_t));
+#endif /* PBM_REVERSE_BITS */
+      if (inked_band (count_black_pixels (band, rows), pbm.cols, rows))
+	goto done;
+    }
+  blank = true;
+
+ done:
+  free_bitmap (band);
+  fseek (pbm.f, pbm.data_offset, SEEK_SET);
+  return blank;
+}
+
+
 input_handler_t pbm_handler =
   {
     match_pbm_suffix,
@@ -234,7 +288,9 @@ input_handler_t pbm_handler =
     close_pbm_input_file,
     last_pbm_input_page,
     get_pbm_image_info,
-    process_pbm_image
+    process_pbm_image,
+    is_blank_pbm_image,
+    false
   };
 
 
@@ -27,8 +27,10 @@
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <strings.h>  /* strcasecmp() is a BSDism */
+#include <zlib.h>
 
 
 #include "semantics.h"
@@ -44,6 +46,7 @@ static struct {
   uint32_t palent;
   uint8_t bpp;
   uint8_t color;
+  uint8_t interlace;
   char pal[256*3];
 } cinfo;
 
@@ -121,7 +124,8 @@ static bool get_png_image_info (int image,
       height=BENUM(buf+4);
       cinfo.bpp=buf[8];
       cinfo.color=buf[9];
-      if(buf[8]>8 || buf[10] || buf[11] || buf[12])
+      cinfo.interlace=buf[12];
+      if(buf[8]>16 || buf[10] || buf[11] || buf[12]>1)
 	return 0;
       continue;
     }
@@ -176,6 +180,11 @@ static bool get_png_image_info (int image,
     case 3:
       image_info->color = 1;
       break;
+    case 4:
+    case 6:
+      /* alpha is written as a soft mask */
+      image_info->color = (cinfo.color == 6);
+      break;
     default:
       fprintf (stderr, "PNG color type %d not supported\n", cinfo.color);
       return false;
@@ -196,23 +205,342 @@ static bool get_png_image_info (int image,
       fprintf (stderr, "PNG pHYs unit %d not supported\n", unit);
   }
 
+  rotate_image_size (image_info, input_attributes.rotation);
+
   return 1;
 }
 
 
+/* Interlaced images can't be copied, since PDF has no equivalent of
+   Adam7, and neither can images with an alpha channel, which PDF needs
+   as a separate soft mask image.  These are decoded and handed to the
+   Flate encoder in bands of rows.  For interlaced images, passes 1 to 6
+   only cover the even rows, and pass 7 consists of complete odd rows, so
+   only the even rows are held in memory; each odd row is emitted as soon
+   as it is decoded. */
+
+#define PNG_BUFFER_SIZE 8192
+#define PNG_BAND_ROWS 16
+
+static const struct {
+  uint8_t x0, y0, dx, dy;
+} adam7 [7] = {
+  { 0, 0, 8, 8 },
+  { 4, 0, 8, 8 },
+  { 0, 4, 4, 8 },
+  { 2, 0, 4, 4 },
+  { 0, 2, 2, 4 },
+  { 1, 0, 2, 2 },
+  { 0, 1, 1, 2 }
+};
+
+static struct {
+  z_stream zs;
+  uint32_t chunk_remaining;  /* IDAT bytes not yet read from the file */
+  uint32_t width, height;
+  int pixel_bits;
+  uint32_t row_bytes;
+  uint32_t row;  /* next row to be returned */
+  uint8_t *even_rows;  /* interlaced only */
+  uint8_t *band;
+  uint8_t *prev;
+  uint8_t in [PNG_BUFFER_SIZE];
+} dec;
+
+
+/* Reads len bytes of the inflated image data, which may span any number
+   of IDAT chunks. */
+static bool read_png_data (uint8_t *buf, uint32_t len)
+{
+  uint8_t hdr [8];
+  size_t l;
+  int ret;
+
+  dec.zs.next_out = buf;
+  dec.zs.avail_out = len;
+  while (dec.zs.avail_out)
+    {
+      if (! dec.zs.avail_in)
+	{
+	  while (! dec.chunk_remaining)
+	    {
+	      if ((fread (hdr, 1, 8, png_f) != 8) || memcmp (hdr + 4, "IDAT", 4))
+		{
+		  fprintf (stderr, "PNG image data truncated\n");
+		  return false;
+		}
+	      dec.chunk_remaining = BENUM (hdr);
+	      if (! dec.chunk_remaining)
+		fseek (png_f, 4, SEEK_CUR);
+	    }
+	  l = fread (dec.in, 1,
+		     (dec.chunk_remaining < PNG_BUFFER_SIZE) ? dec.chunk_remaining : PNG_BUFFER_SIZE,
+		     png_f);
+	  if (! l)
+	    {
+	      fprintf (stderr, "unexpected EOF on PNG input file\n");
+	      return false;
+	    }
+	  dec.chunk_remaining -= l;
+	  if (! dec.chunk_remaining)
+	    fseek (png_f, 4, SEEK_CUR);  /* CRC */
+	  dec.zs.next_in = dec.in;
+	  dec.zs.avail_in = l;
+	}
+      ret = inflate (& dec.zs, Z_NO_FLUSH);
+      if ((ret == Z_STREAM_END) && dec.zs.avail_out)
+	{
+	  fprintf (stderr, "PNG image data truncated\n");
+	  return false;
+	}
+      if ((ret != Z_OK) && (ret != Z_STREAM_END))
+	{
+	  fprintf (stderr, "PNG image data corrupt\n");
+	  return false;
+	}
+    }
+  return true;
+}
+
+
+static int png_paeth (int a, int b, int c)
+{
+  int pa = abs (b - c);
+  int pb = abs (a - c);
+  int pc = abs (a + b - 2 * c);
+
+  if ((pa <= pb) && (pa <= pc))
+    return a;
+  if (pb <= pc)
+    return b;
+  return c;
+}
+
+
+/* Reads and unfilters one row of row_bytes bytes, given the previous
+   row of the same pass, which is all zero for the first row. */
+static bool read_png_row (uint8_t *row, uint8_t *prev, uint32_t row_bytes)
+{
+  int bpp = (dec.pixel_bits + 7) / 8;
+  uint8_t filter;
+  uint32_t i;
+
+  if (! (read_png_data (& filter, 1) && read_png_data (row, row_bytes)))
+    return false;
+
+  switch (filter)
+    {
+    case 0:  /* None */
+      break;
+    case 1:  /* Sub */
+      for (i = bpp; i < row_bytes; i++)
+	row [i] += row [i - bpp];
+      break;
+    case 2:  /* Up */
+      for (i = 0; i < row_bytes; i++)
+	row [i] += prev [i];
+      break;
+    case 3:  /* Average */
+      for (i = 0; i < row_bytes; i++)
+	row [i] += ((i < bpp ? 0 : row [i - bpp]) + prev [i]) >> 1;
+      break;
+    case 4:  /* Paeth */
+      for (i = 0; i < row_bytes; i++)
+	row [i] += png_paeth (i < bpp ? 0 : row [i - bpp],
+			      prev [i],
+			      i < bpp ? 0 : prev [i - bpp]);
+      break;
+    default:
+      fprintf (stderr, "PNG filter type %d invalid\n", filter);
+      return false;
+    }
+  return true;
+}
+
+
+/* Decodes Adam7 passes 1 to 6 into the even rows. */
+static bool read_png_even_passes (void)
+{
+  int pass;
+
+  for (pass = 0; pass < 6; pass++)
+    {
+      uint32_t pass_width, pass_height, pass_row_bytes;
+      uint32_t r, i;
+
+      if ((dec.width <= adam7 [pass].x0) || (dec.height <= adam7 [pass].y0))
+	continue;  /* empty passes have no filter bytes */
+      pass_width = (dec.width - adam7 [pass].x0 + adam7 [pass].dx - 1) / adam7 [pass].dx;
+      pass_height = (dec.height - adam7 [pass].y0 + adam7 [pass].dy - 1) / adam7 [pass].dy;
+      pass_row_bytes = (pass_width * dec.pixel_bits + 7) / 8;
+
+      memset (dec.prev, 0, dec.row_bytes);
+      for (r = 0; r < pass_height; r++)
+	{
+	  uint32_t y = adam7 [pass].y0 + r * adam7 [pass].dy;
+	  uint8_t *dest = dec.even_rows + (y / 2) * dec.row_bytes;
+
+	  if (! read_png_row (dec.band, dec.prev, pass_row_bytes))
+	    return false;
+
+	  for (i = 0; i < pass_width; i++)
+	    {
+	      uint32_t x = adam7 [pass].x0 + i * adam7 [pass].dx;
+
+	      if (dec.pixel_bits >= 8)
+		memcpy (dest + x * (dec.pixel_bits / 8),
+			dec.band + i * (dec.pixel_bits / 8),
+			dec.pixel_bits / 8);
+	      else
+		{
+		  /* samples are packed MSB first; each pixel of the
+		     destination is written exactly once */
+		  uint32_t src_bit = i * dec.pixel_bits;
+		  uint32_t dest_bit = x * dec.pixel_bits;
+		  int v = ((dec.band [src_bit / 8] >> (8 - dec.pixel_bits - src_bit % 8)) &
+			   ((1 << dec.pixel_bits) - 1));
+		  dest [dest_bit / 8] |= v << (8 - dec.pixel_bits - dest_bit % 8);
+		}
+	    }
+	  memcpy (dec.prev, dec.band, pass_row_bytes);
+	}
+    }
+  return true;
+}
+
+
+static uint8_t *read_png_band (void *app_data, uint32_t *row_count)
+{
+  uint32_t i;
+
+  if (dec.row >= dec.height)
+    return NULL;
+
+  if (! cinfo.interlace)
+    {
+      *row_count = dec.height - dec.row;
+      if (*row_count > PNG_BAND_ROWS)
+	*row_count = PNG_BAND_ROWS;
+      for (i = 0; i < *row_count; i++)
+	{
+	  uint8_t *rp = dec.band + i * dec.row_bytes;
+
+	  if (! read_png_row (rp, i ? (rp - dec.row_bytes) : dec.prev, dec.row_bytes))
+	    return NULL;
+	}
+      memcpy (dec.prev, dec.band + (*row_count - 1) * dec.row_bytes, dec.row_bytes);
+      dec.row += *row_count;
+      return dec.band;
+    }
+
+  if (! dec.row)
+    {
+      if (! read_png_even_passes ())
+	return NULL;
+      memset (dec.prev, 0, dec.row_bytes);
+    }
+
+  memcpy (dec.band, dec.even_rows + (dec.row / 2) * dec.row_bytes, dec.row_bytes);
+  *row_count = 1;
+  if (dec.row + 1 < dec.height)
+    {
+      uint8_t *odd_row = dec.band + dec.row_bytes;
+
+      if (! read_png_row (odd_row, dec.prev, dec.row_bytes))
+	return NULL;
+      memcpy (dec.prev, odd_row, dec.row_bytes);
+      *row_count = 2;
+    }
+  dec.row += *row_count;
+  return dec.band;
+}
+
+
+static bool process_png_decoded_image (input_attributes_t input_attributes,
+				       image_info_t *image_info,
+				       pdf_page_handle page,
+				       output_attributes_t output_attributes)
+{
+  bool result = false;
+  int channels;
+
+  switch (cinfo.color)
+    {
+    case 2:  channels = 3; break;
+    case 4:  channels = 2; break;
+    case 6:  channels = 4; break;
+    default: channels = 1; break;
+    }
+
+  memset (& dec.zs, 0, sizeof (dec.zs));
+  if (inflateInit (& dec.zs) != Z_OK)
+    {
+      fprintf (stderr, "can't initialize inflate\n");
+      return false;
+    }
+  dec.chunk_remaining = 0;
+  dec.width = image_info->width_samples;
+  dec.height = image_info->height_samples;
+  dec.pixel_bits = channels * cinfo.bpp;
+  dec.row_bytes = (dec.width * dec.pixel_bits + 7) / 8;
+  dec.row = 0;
+  dec.even_rows = NULL;
+  if (cinfo.interlace)
+    dec.even_rows = calloc ((dec.height + 1) / 2, dec.row_bytes);
+  dec.band = malloc ((cinfo.interlace ? 2 : PNG_BAND_ROWS) * dec.row_bytes);
+  dec.prev = calloc (1, dec.row_bytes);
+  if ((cinfo.interlace && ! dec.even_rows) || ! (dec.band && dec.prev))
+    {
+      fprintf (stderr, "can't allocate PNG image buffer\n");
+      goto fail;
+    }
+
+  pdf_write_flate_image (page,
+			 output_attributes.position.x, output_attributes.position.y,
+			 image_info->width_points,
+			 image_info->height_points,
+			 image_info->color,
+			 false,
+			 cinfo.color==3?cinfo.pal:NULL,
+			 cinfo.color==3?cinfo.palent:0,
+			 cinfo.bpp,
+			 image_info->width_samples,
+			 image_info->height_samples,
+			 input_attributes.transparency,
+			 (cinfo.color & 4) != 0,
+			 read_png_band,
+			 NULL);
+  result = true;
+
+ fail:
+  inflateEnd (& dec.zs);
+  free (dec.even_rows);
+  free (dec.band);
+  free (dec.prev);
+  return result;
+}
+
+
 static bool process_png_image (int image,  /* range 1 .. n */
 			       input_attributes_t input_attributes,
 			       image_info_t *image_info,
 			       pdf_page_handle page,
 			       output_attributes_t output_attributes)
 {
+  if (cinfo.interlace || (cinfo.color & 4))
+    return process_png_decoded_image (input_attributes,
+				      image_info,
+				      page,
+				      output_attributes);
+
+  /* otherwise the image data can be copied without decoding */
   pdf_write_png_image (page,
 		       output_attributes.position.x, output_attributes.position.y,
 		       image_info->width_points,
 		       image_info->height_points,
 		       cinfo.color,
 		       cinfo.color==3?cinfo.pal:NULL,
-		       cinfo.palent,
+		       cinfo.color==3?cinfo.palent:0,
 		       cinfo.bpp,
 		       image_info->width_samples,
 		       image_info->height_samples,
@@ -230,7 +558,9 @@ input_handler_t png_handler =
     close_png_input_file,
     last_png_input_page,
     get_png_image_info,
-    process_png_image
+    process_png_image,
+    NULL,
+    false
   };
 
 
@@ -26,6 +26,7 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <strings.h>  /* strcasecmp() is a BSDism */
 
 // Sadly libtiff doesn't accept C streams as input sources, so we have to
@@ -52,6 +53,44 @@
 TIFF *tiff_in;
 
 
+/* Bilevel images are G4 encoded from a bitmap.  JPEG compressed images,
+   and Flate or LZW compressed images in a form PDF can decode, have
+   their strips copied without decoding.  Everything else is streamed a
+   strip at a time into a Flate encoded image, or if a threshold is
+   given, into a bitmap to be G4 encoded.  In mixed raster content mode
+   the thresholded bitmap becomes a mask, over a background that is read
+   from the strips once more. */
+static struct
+{
+  bool bilevel;
+  bool passthrough;
+  bool threshold;
+  uint16_t compression;
+  uint16_t predictor;  /* Flate and LZW only */
+  bool color_transform;  /* JPEG only, data is YCbCr */
+  bool negative;  /* grayscale only */
+  uint16_t bits_per_sample;
+  uint32_t rows_per_strip;
+  int palent;
+  char palette [256 * 3];
+  int threshold_radius;  /* adaptive threshold only */
+  int mrc_reduction;  /* of the background, mixed raster content only */
+} tiff_info;
+
+
+/* shortest strip of a multi-strip Flate or LZW image to copy as-is */
+#define MIN_PASSTHROUGH_STRIP_ROWS 64
+
+/* adaptive threshold window radius, in samples per inch of resolution */
+#define THRESHOLD_RADIUS_DIVISOR 20
+#define MIN_THRESHOLD_RADIUS 4
+
+/* default mixed raster content background resolution, in samples per
+   inch, and the greatest reduction */
+#define MRC_BACKGROUND_RESOLUTION 100
+#define MAX_MRC_REDUCTION 16
+
+
 #define SWAP(type,a,b) do { type temp; temp = a; a = b; b = temp; } while (0)
 
 
@@ -142,6 +181,7 @@ static bool get_tiff_image_info (int image,
   uint16_t bits_per_sample;
   uint16_t photometric_interpretation;
   uint16_t planar_config;
+  uint16_t compression;
 
   uint16_t resolution_unit;
   float x_resolution, y_resolution;
@@ -188,6 +228,9 @@ static bool get_tiff_image_info (int image,
       return false;
     }
 
+  if (1 != TIFFGetField (tiff_in, TIFFTAG_COMPRESSION, & compression))
+    compression = COMPRESSION_NONE;
+
   if (1 != TIFFGetField (tiff_in, TIFFTAG_PHOTOMETRIC, & photometric_interpretation))
     {
       fprintf(stderr, "warning: photometric interpretation not specified, assuming min-is-white\n");
@@ -195,7 +238,11 @@ static bool get_tiff_image_info (int image,
     }
 
   else if ((photometric_interpretation != PHOTOMETRIC_MINISWHITE) &&
-	   (photometric_interpretation != PHOTOMETRIC_MINISBLACK))
+	   (photometric_interpretation != PHOTOMETRIC_MINISBLACK) &&
+	   (photometric_interpretation != PHOTOMETRIC_RGB) &&
+	   (photometric_interpretation != PHOTOMETRIC_PALETTE) &&
+	   ! ((photometric_interpretation == PHOTOMETRIC_YCBCR) &&
+	      (compression == COMPRESSION_JPEG)))
     {
       fprintf(stderr, "photometric interpretation value %u is invalid\n", photometric_interpretation);
       return false;
@@ -211,12 +258,6 @@ static bool get_tiff_image_info (int image,
   if (1 != TIFFGetField (tiff_in, TIFFTAG_YRESOLUTION, & y_resolution))
     y_resolution = 300;
 
-  if (samples_per_pixel != 1)
-    {
-      fprintf (stderr, "samples per pixel %u, must be 1\n", samples_per_pixel);
-      return false;
-    }
-
 #ifdef CHECK_DEPTH
   if (image_depth != 1)
     {
@@ -225,11 +266,116 @@ static bool get_tiff_image_info (int image,
     }
 #endif
 
-  if (bits_per_sample != 1)
+  memset (& tiff_info, 0, sizeof (tiff_info));
+  tiff_info.bits_per_sample = bits_per_sample;
+
+  switch (photometric_interpretation)
     {
-      fprintf (stderr, "bits per sample %u, must be 1\n", bits_per_sample);
-      return false;
+    case PHOTOMETRIC_MINISWHITE:
+    case PHOTOMETRIC_MINISBLACK:
+      if (samples_per_pixel != 1)
+	{
+	  fprintf (stderr, "samples per pixel %u, must be 1\n", samples_per_pixel);
+	  return false;
+	}
+      if ((bits_per_sample != 1) && (bits_per_sample != 2) &&
+	  (bits_per_sample != 4) && (bits_per_sample != 8))
+	{
+	  fprintf (stderr, "bits per sample %u, must be 1, 2, 4, or 8\n", bits_per_sample);
+	  return false;
+	}
+      tiff_info.bilevel = (bits_per_sample == 1);
+      tiff_info.negative = (photometric_interpretation == PHOTOMETRIC_MINISWHITE);
+      image_info->color = false;
+      break;
+    case PHOTOMETRIC_RGB:
+    case PHOTOMETRIC_YCBCR:
+      if (samples_per_pixel != 3)
+	{
+	  fprintf (stderr, "samples per pixel %u, must be 3 for RGB\n", samples_per_pixel);
+	  return false;
+	}
+      if (bits_per_sample != 8)
+	{
+	  fprintf (stderr, "bits per sample %u, must be 8 for RGB\n", bits_per_sample);
+	  return false;
+	}
+      image_info->color = true;
+      break;
+    case PHOTOMETRIC_PALETTE:
+      {
+	uint16_t *red, *green, *blue;
+	int i;
+
+	if (samples_per_pixel != 1)
+	  {
+	    fprintf (stderr, "samples per pixel %u, must be 1\n", samples_per_pixel);
+	    return false;
+	  }
+	if ((bits_per_sample != 1) && (bits_per_sample != 2) &&
+	    (bits_per_sample != 4) && (bits_per_sample != 8))
+	  {
+	    fprintf (stderr, "bits per sample %u, must be 1, 2, 4, or 8\n", bits_per_sample);
+	    return false;
+	  }
+	if (1 != TIFFGetField (tiff_in, TIFFTAG_COLORMAP, & red, & green, & blue))
+	  {
+	    fprintf (stderr, "can't get color map\n");
+	    return false;
+	  }
+	tiff_info.palent = 1 << bits_per_sample;
+	for (i = 0; i < tiff_info.palent; i++)
+	  {
+	    tiff_info.palette [i * 3]     = red   [i] >> 8;
+	    tiff_info.palette [i * 3 + 1] = green [i] >> 8;
+	    tiff_info.palette [i * 3 + 2] = blue  [i] >> 8;
+	  }
+	image_info->color = true;
+      }
+      break;
+    }
+
+  /* New-style JPEG compression only; the strips can be passed through to
+     DCTDecode, which doesn't support inverted grayscale or palettes. */
+  if (compression == COMPRESSION_JPEG)
+    {
+      if ((bits_per_sample != 8) ||
+	  (photometric_interpretation == PHOTOMETRIC_MINISWHITE) ||
+	  (photometric_interpretation == PHOTOMETRIC_PALETTE))
+	{
+	  fprintf (stderr, "JPEG compressed TIFF images must be 8-bit grayscale or color\n");
+	  return false;
+	}
+      tiff_info.passthrough = true;
+      tiff_info.color_transform = (photometric_interpretation == PHOTOMETRIC_YCBCR);
     }
+  else if ((! tiff_info.bilevel) &&
+	   ((compression == COMPRESSION_ADOBE_DEFLATE) ||
+	    (compression == COMPRESSION_DEFLATE) ||
+	    (compression == COMPRESSION_LZW)))
+    {
+      uint16_t fill_order;
+      uint8_t code [2];
+
+      if (1 != TIFFGetFieldDefaulted (tiff_in, TIFFTAG_PREDICTOR, & tiff_info.predictor))
+	tiff_info.predictor = PREDICTOR_NONE;
+      if (1 != TIFFGetFieldDefaulted (tiff_in, TIFFTAG_FILLORDER, & fill_order))
+	fill_order = FILLORDER_MSB2LSB;
+
+      /* PDF has the TIFF horizontal predictor, but not the floating
+	 point one, and doesn't reverse the bits of compressed data */
+      tiff_info.passthrough = (((tiff_info.predictor == PREDICTOR_NONE) ||
+				(tiff_info.predictor == PREDICTOR_HORIZONTAL)) &&
+			       (fill_order == FILLORDER_MSB2LSB));
+
+      /* Old-style TIFF LZW codes are packed LSB first, and can be
+	 recognized by the initial clear code.  PDF only decodes the
+	 new style, which starts with 0x80. */
+      if ((compression == COMPRESSION_LZW) && tiff_info.passthrough)
+	tiff_info.passthrough = ((TIFFReadRawStrip (tiff_in, 0, code, 2) == 2) &&
+				 (code [0] == 0x80));
+    }
+  tiff_info.compression = compression;
 
   if (planar_config != 1)
     {
@@ -243,6 +389,69 @@ static bool get_tiff_image_info (int image,
       y_resolution = input_attributes.y_resolution;
     }
 
+  /* A thresholded image is decoded, even if it could be copied, and
+     becomes a bitmap that can be rotated like any other. */
+  if ((! tiff_info.bilevel) &&
+      (input_attributes.has_threshold || input_attributes.has_mrc))
+    {
+      tiff_info.threshold = true;
+      tiff_info.passthrough = false;
+      if (input_attributes.threshold.method == THRESHOLD_ADAPTIVE)
+	{
+	  tiff_info.threshold_radius = x_resolution / THRESHOLD_RADIUS_DIVISOR;
+	  if (tiff_info.threshold_radius < MIN_THRESHOLD_RADIUS)
+	    tiff_info.threshold_radius = MIN_THRESHOLD_RADIUS;
+	}
+      /* have libtiff convert JPEG compressed YCbCr data to RGB */
+      if (photometric_interpretation == PHOTOMETRIC_YCBCR)
+	TIFFSetField (tiff_in, TIFFTAG_JPEGCOLORMODE, JPEGCOLORMODE_RGB);
+    }
+
+  if ((! tiff_info.bilevel) && input_attributes.has_mrc)
+    {
+      /* the background isn't deskewed with the mask */
+      if (input_attributes.deskew)
+	{
+	  fprintf (stderr, "deskewing of mixed raster content images not supported\n");
+	  return false;
+	}
+      tiff_info.mrc_reduction = input_attributes.mrc_reduction;
+      if (! tiff_info.mrc_reduction)
+	{
+	  tiff_info.mrc_reduction = (x_resolution + MRC_BACKGROUND_RESOLUTION / 2) / MRC_BACKGROUND_RESOLUTION;
+	  if (tiff_info.mrc_reduction < 1)
+	    tiff_info.mrc_reduction = 1;
+	}
+      if ((tiff_info.mrc_reduction < 1) || (tiff_info.mrc_reduction > MAX_MRC_REDUCTION))
+	{
+	  fprintf (stderr, "mixed raster content background reduction %d, must be 1 to %d\n",
+		   tiff_info.mrc_reduction, MAX_MRC_REDUCTION);
+	  return false;
+	}
+    }
+
+  if (! tiff_info.bilevel)
+    {
+      if (TIFFIsTiled (tiff_in))
+	{
+	  fprintf (stderr, "tiled grayscale and color TIFF images not supported\n");
+	  return false;
+	}
+      if (1 != TIFFGetFieldDefaulted (tiff_in, TIFFTAG_ROWSPERSTRIP, & tiff_info.rows_per_strip))
+	tiff_info.rows_per_strip = image_height;
+      if (tiff_info.rows_per_strip > image_height)
+	tiff_info.rows_per_strip = image_height;
+
+      /* Every strip that is copied becomes a separate image.  Short
+	 strips would cost more in per-image overhead than re-encoding
+	 does, so are only tolerated for JPEG, which can't be decoded. */
+      if (tiff_info.passthrough &&
+	  (compression != COMPRESSION_JPEG) &&
+	  (tiff_info.rows_per_strip < image_height) &&
+	  (tiff_info.rows_per_strip < MIN_PASSTHROUGH_STRIP_ROWS))
+	tiff_info.passthrough = false;
+    }
+
   if ((input_attributes.rotation == 90) || (input_attributes.rotation == 270))
     {
       image_info->width_samples  = image_height;
@@ -265,11 +474,19 @@ static bool get_tiff_image_info (int image,
   if ((image_info->height_points > PAGE_MAX_POINTS) || 
       (image_info->width_points > PAGE_MAX_POINTS))
     {
-      fprintf (stdout, "image too large (max %d inches on a side\n", PAGE_MAX_INCHES);
+      fprintf (stderr, "image too large (max %d inches on a side)\n", PAGE_MAX_INCHES);
       return false;
     }
 
-  image_info->negative = (photometric_interpretation == PHOTOMETRIC_MINISBLACK);
+  /* grayscale and color images are only turned by the matrix that
+     places them, so their samples are described as stored */
+  if ((! (tiff_info.bilevel || tiff_info.threshold)) &&
+      ((input_attributes.rotation == 90) || (input_attributes.rotation == 270)))
+    SWAP (uint32_t, image_info->width_samples, image_info->height_samples);
+
+  image_info->negative = (tiff_info.bilevel &&
+			  (photometric_interpretation == PHOTOMETRIC_MINISBLACK));
+
 
   return true;
 }
@@ -277,6 +494,492 @@ static bool get_tiff_image_info (int image,
 
 
 
+struct tiff_strip_reader
+{
+  uint8_t *buffer;
+  uint32_t strip;
+  uint32_t strip_count;
+  tmsize_t strip_size;
+};
+
+
+static uint8_t *read_tiff_strip (void *app_data, uint32_t *row_count)
+{
+  struct tiff_strip_reader *reader = app_data;
+
+  if (reader->strip >= reader->strip_count)
+    return NULL;
+  if (TIFFReadEncodedStrip (tiff_in,
+			    reader->strip,
+			    reader->buffer,
+			    reader->strip_size) < 0)
+    {
+      fprintf (stderr, "can't read TIFF strip %u\n", reader->strip);
+      return NULL;
+    }
+  reader->strip++;
+  *row_count = tiff_info.rows_per_strip;
+  return reader->buffer;
+}
+
+
+static bool process_tiff_flate_image (input_attributes_t input_attributes,
+				      image_info_t *image_info,
+				      pdf_page_handle page,
+				      output_attributes_t output_attributes)
+{
+  struct tiff_strip_reader reader;
+
+  reader.strip = 0;
+  reader.strip_count = TIFFNumberOfStrips (tiff_in);
+  reader.strip_size = TIFFStripSize (tiff_in);
+  reader.buffer = malloc (reader.strip_size);
+  if (! reader.buffer)
+    {
+      fprintf (stderr, "can't allocate strip buffer\n");
+      return false;
+    }
+
+  pdf_write_flate_image (page,
+			 output_attributes.position.x, output_attributes.position.y,
+			 image_info->width_points, image_info->height_points,
+			 image_info->color,
+			 tiff_info.negative,
+			 tiff_info.palette,
+			 tiff_info.palent,
+			 tiff_info.bits_per_sample,
+			 image_info->width_samples,
+			 image_info->height_samples,
+			 input_attributes.transparency,
+			 false,
+			 read_tiff_strip,
+			 & reader);
+
+  free (reader.buffer);
+  return true;
+}
+
+
+/* Gray level, with 0 black, of each sample value of a grayscale or
+   palette image */
+static void tiff_gray_map (uint8_t *map)
+{
+  int count = 1 << tiff_info.bits_per_sample;
+  int i;
+
+  for (i = 0; i < count; i++)
+    if (tiff_info.palent)
+      map [i] = (77  * (uint8_t) tiff_info.palette [i * 3] +
+		 150 * (uint8_t) tiff_info.palette [i * 3 + 1] +
+		 29  * (uint8_t) tiff_info.palette [i * 3 + 2] + 128) >> 8;
+    else if (tiff_info.negative)
+      map [i] = 255 - (i * 255) / (count - 1);
+    else
+      map [i] = (i * 255) / (count - 1);
+}
+
+
+static void tiff_gray_rows (const uint8_t *restrict src,
+			    uint8_t *restrict gray,
+			    uint32_t width,
+			    uint32_t rows,
+			    bool rgb,
+			    const uint8_t *map)
+{
+  int bps = tiff_info.bits_per_sample;
+  uint32_t row_bytes = rgb ? (width * 3) : ((width * bps + 7) / 8);
+  uint32_t row, x;
+
+  for (row = 0; row < rows; row++)
+    {
+      if (rgb)
+	for (x = 0; x < width; x++)
+	  gray [x] = (77  * src [x * 3] +
+		      150 * src [x * 3 + 1] +
+		      29  * src [x * 3 + 2] + 128) >> 8;
+      else if (bps == 8)
+	for (x = 0; x < width; x++)
+	  gray [x] = map [src [x]];
+      else
+	for (x = 0; x < width; x++)
+	  {
+	    uint32_t bit = x * bps;
+	    int shift = 8 - bps - (bit & 7);
+	    gray [x] = map [(src [bit >> 3] >> shift) & ((1 << bps) - 1)];
+	  }
+      src += row_bytes;
+      gray += width;
+    }
+}
+
+
+/* Grayscale and color images to be thresholded are converted to gray
+   a strip at a time.  Otsu's level depends on the histogram of the
+   whole image, so unless the level is given the strips are read
+   twice. */
+static bool read_tiff_thresholded (input_attributes_t input_attributes,
+				   image_info_t *image_info,
+				   Bitmap *bitmap)
+{
+  bool result = false;
+  uint32_t width = rect_width (& bitmap->rect);
+  uint32_t height = rect_height (& bitmap->rect);
+  bool rgb = image_info->color && ! tiff_info.palent;
+  struct tiff_strip_reader reader;
+  Thresholder *thresholder = NULL;
+  uint32_t histogram [256];
+  uint8_t map [256];
+  uint8_t *gray;
+  int level;
+  int pass;
+
+  reader.strip_count = TIFFNumberOfStrips (tiff_in);
+  reader.strip_size = TIFFStripSize (tiff_in);
+  reader.buffer = malloc (reader.strip_size);
+  gray = malloc ((size_t) width * tiff_info.rows_per_strip);
+  if (! (reader.buffer && gray))
+    {
+      fprintf (stderr, "can't allocate strip buffer\n");
+      goto fail;
+    }
+
+  tiff_gray_map (map);
+  memset (histogram, 0, sizeof (histogram));
+  level = input_attributes.threshold.level;
+
+  for (pass = (input_attributes.threshold.method == THRESHOLD_FIXED); pass < 2; pass++)
+    {
+      uint32_t row, rows;
+
+      if (pass)
+	{
+	  if (input_attributes.threshold.method != THRESHOLD_FIXED)
+	    level = otsu_threshold (histogram);
+	  if (verbose)
+	    fprintf (stderr, "threshold level %d\n", level);
+	  thresholder = create_thresholder (bitmap, level, tiff_info.threshold_radius);
+	  if (! thresholder)
+	    {
+	      fprintf (stderr, "can't allocate threshold buffers\n");
+	      goto fail;
+	    }
+	}
+
+      reader.strip = 0;
+      for (row = 0; row < height; row += rows)
+	{
+	  uint8_t *data = read_tiff_strip (& reader, & rows);
+
+	  if (! data)
+	    goto fail;
+	  if (rows > height - row)
+	    rows = height - row;
+	  tiff_gray_rows (data, gray, width, rows, rgb, map);
+	  if (pass)
+	    threshold_rows (thresholder, gray, rows);
+	  else
+	    gray_histogram (histogram, gray, width * rows);
+	}
+    }
+
+  result = true;
+
+ fail:
+  if (thresholder)
+    free_thresholder (thresholder);
+  free (gray);
+  free (reader.buffer);
+  return result;
+}
+
+
+/* RGB samples of each pixel of a palette image */
+static void tiff_palette_rows (const uint8_t *restrict src,
+			       uint8_t *restrict rgb,
+			       uint32_t width,
+			       uint32_t rows)
+{
+  int bps = tiff_info.bits_per_sample;
+  uint32_t row_bytes = (width * bps + 7) / 8;
+  uint32_t row, x;
+
+  for (row = 0; row < rows; row++)
+    {
+      for (x = 0; x < width; x++)
+	{
+	  uint32_t bit = x * bps;
+	  int shift = 8 - bps - (bit & 7);
+	  int i = (src [bit >> 3] >> shift) & ((1 << bps) - 1);
+
+	  memcpy (rgb + x * 3, tiff_info.palette + i * 3, 3);
+	}
+      src += row_bytes;
+      rgb += width * 3;
+    }
+}
+
+
+/* The background of a mixed raster content image is read from the
+   strips after the mask is complete, in gray or RGB. */
+static Background *read_tiff_background (image_info_t *image_info,
+					 Bitmap *mask)
+{
+  uint32_t width = rect_width (& mask->rect);
+  uint32_t height = rect_height (& mask->rect);
+  int components = image_info->color ? 3 : 1;
+  struct tiff_strip_reader reader;
+  Background *bg;
+  uint8_t map [256];
+  uint8_t *samples;
+  uint32_t row, rows;
+  uint32_t pictures;
+
+  pictures = clear_mask_pictures (mask);
+  if (verbose)
+    fprintf (stderr, "%u blocks of pictures moved to the background\n", pictures);
+
+  reader.strip = 0;
+  reader.strip_count = TIFFNumberOfStrips (tiff_in);
+  reader.strip_size = TIFFStripSize (tiff_in);
+  reader.buffer = malloc (reader.strip_size);
+  samples = malloc ((size_t) width * components * tiff_info.rows_per_strip);
+  bg = create_background (mask, components, tiff_info.mrc_reduction);
+  if (! (reader.buffer && samples && bg))
+    {
+      fprintf (stderr, "can't allocate background buffers\n");
+      goto fail;
+    }
+
+  tiff_gray_map (map);
+  for (row = 0; row < height; row += rows)
+    {
+      uint8_t *data = read_tiff_strip (& reader, & rows);
+
+      if (! data)
+	goto fail;
+      if (rows > height - row)
+	rows = height - row;
+      if (! image_info->color)
+	tiff_gray_rows (data, samples, width, rows, false, map);
+      else if (tiff_info.palent)
+	tiff_palette_rows (data, samples, width, rows);
+      else
+	memcpy (samples, data, (size_t) width * 3 * rows);
+      background_rows (bg, samples, rows);
+    }
+
+  free (samples);
+  free (reader.buffer);
+  return bg;
+
+ fail:
+  if (bg)
+    free_background (bg);
+  free (samples);
+  free (reader.buffer);
+  return NULL;
+}
+
+
+static void write_tiff_mrc_image (image_info_t *image_info,
+				  Bitmap *mask,
+				  Background *bg,
+				  pdf_page_handle page,
+				  output_attributes_t output_attributes)
+{
+  uint32_t bg_width, bg_height;
+  uint8_t *samples = background_samples (bg, & bg_width, & bg_height);
+  uint8_t ink [3];
+  rgb_t foreground;
+
+  foreground_color (bg, ink);
+  foreground.red = ink [0];
+  foreground.green = image_info->color ? ink [1] : ink [0];
+  foreground.blue = image_info->color ? ink [2] : ink [0];
+  if (verbose)
+    fprintf (stderr, "background %ux%u, ink (%d %d %d)\n", bg_width, bg_height,
+	     foreground.red, foreground.green, foreground.blue);
+
+  pdf_write_mrc_image (page,
+		       output_attributes.position.x, output_attributes.position.y,
+		       image_info->width_points, image_info->height_points,
+		       mask,
+		       foreground,
+		       image_info->color,
+		       bg_width,
+		       bg_height,
+		       samples);
+}
+
+
+/* Compressed strips are copied as separate images, since they can't be
+   joined without decoding, and are stacked on the page.  Each strip of
+   a JPEG compressed TIFF is an abbreviated JPEG stream, which is made
+   into a complete one by prefixing the tables shared by all strips. */
+/* The box on the page of the strip that starts at row, with the
+   image turned by rotation. */
+static void tiff_strip_box (int rotation,
+			    image_info_t *image_info,
+			    output_attributes_t output_attributes,
+			    uint32_t row,
+			    uint32_t rows,
+			    position_t *position,
+			    page_size_t *size)
+{
+  double across = (double) rows / image_info->height_samples;
+  double before = (double) row / image_info->height_samples;
+
+  *position = output_attributes.position;
+  size->width = image_info->width_points;
+  size->height = image_info->height_points;
+
+  /* rows are counted from the top, PDF coordinates from the bottom */
+  switch (rotation)
+    {
+    case 90:  /* the top row is at the right */
+      size->width *= across;
+      position->x += image_info->width_points * (1.0 - before) - size->width;
+      break;
+    case 180:
+      size->height *= across;
+      position->y += image_info->height_points * before;
+      break;
+    case 270:
+      size->width *= across;
+      position->x += image_info->width_points * before;
+      break;
+    default:
+      size->height *= across;
+      position->y += image_info->height_points * (1.0 - before) - size->height;
+      break;
+    }
+}
+
+
+static bool process_tiff_raw_image (input_attributes_t input_attributes,
+				    image_info_t *image_info,
+				    pdf_page_handle page,
+				    output_attributes_t output_attributes)
+{
+  bool result = false;
+  uint32_t tables_length;
+  uint8_t *tables = NULL;
+  uint8_t *data = NULL;
+  uint32_t data_size = 0;
+  uint32_t strip_count;
+  uint32_t strip;
+  uint32_t row = 0;
+  position_t position;
+  page_size_t size;
+
+  if ((tiff_info.compression == COMPRESSION_JPEG) &&
+      (1 == TIFFGetField (tiff_in, TIFFTAG_JPEGTABLES, & tables_length, & tables)))
+    {
+      /* the tables are bracketed by SOI and EOI markers */
+      if ((tables_length < 4) ||
+	  (tables [0] != 0xff) || (tables [1] != 0xd8) ||
+	  (tables [tables_length - 2] != 0xff) ||
+	  (tables [tables_length - 1] != 0xd9))
+	{
+	  fprintf (stderr, "malformed TIFF JPEG tables\n");
+	  return false;
+	}
+      tables_length -= 2;
+    }
+  else
+    tables_length = 0;
+
+  strip_count = TIFFNumberOfStrips (tiff_in);
+
+  for (strip = 0; (strip < strip_count) && (row < image_info->height_samples); strip++)
+    {
+      tmsize_t strip_length = TIFFRawStripSize (tiff_in, strip);
+      uint32_t data_length;
+      uint32_t rows;
+      uint8_t *sp;
+
+      if (strip_length < 2)
+	{
+	  fprintf (stderr, "malformed TIFF strip %u\n", strip);
+	  goto fail;
+	}
+
+      /* the SOI marker of the strip is overwritten by the tables, which
+	 start with their own */
+      data_length = tables_length ? (tables_length - 2 + strip_length) : strip_length;
+      if (data_length > data_size)
+	{
+	  free (data);
+	  data_size = data_length;
+	  data = malloc (data_size);
+	  if (! data)
+	    {
+	      fprintf (stderr, "can't allocate strip buffer\n");
+	      goto fail;
+	    }
+	}
+
+      sp = data + data_length - strip_length;
+      if (TIFFReadRawStrip (tiff_in, strip, sp, strip_length) != strip_length)
+	{
+	  fprintf (stderr, "can't read TIFF strip %u\n", strip);
+	  goto fail;
+	}
+
+      if (tables_length)
+	{
+	  if ((sp [0] != 0xff) || (sp [1] != 0xd8))
+	    {
+	      fprintf (stderr, "malformed TIFF JPEG strip %u\n", strip);
+	      goto fail;
+	    }
+	  memcpy (data, tables, tables_length);
+	}
+
+      rows = tiff_info.rows_per_strip;
+      if (rows > image_info->height_samples - row)
+	rows = image_info->height_samples - row;
+      tiff_strip_box (input_attributes.rotation, image_info, output_attributes,
+		      row, rows, & position, & size);
+      row += rows;
+
+      if (tiff_info.compression == COMPRESSION_JPEG)
+	pdf_write_jpeg_image_data (page,
+				   position.x, position.y,
+				   size.width, size.height,
+				   image_info->color,
+				   tiff_info.color_transform,
+				   image_info->width_samples,
+				   rows,
+				   input_attributes.transparency,
+				   data,
+				   data_length);
+      else
+	pdf_write_flate_image_data (page,
+				    position.x, position.y,
+				    size.width, size.height,
+				    image_info->color,
+				    tiff_info.negative,
+				    tiff_info.palette,
+				    tiff_info.palent,
+				    tiff_info.bits_per_sample,
+				    image_info->width_samples,
+				    rows,
+				    input_attributes.transparency,
+				    tiff_info.compression == COMPRESSION_LZW,
+				    tiff_info.predictor,
+				    data,
+				    data_length);
+    }
+
+  result = true;
+
+ fail:
+  free (data);
+  return result;
+}
+
+
 static bool process_tiff_image (int image,  /* range 1 .. n */
 				input_attributes_t input_attributes,
 				image_info_t *image_info,
@@ -286,9 +989,22 @@ static bool process_tiff_image (int image,  /* range 1 .. n */
   bool result = 0;
   Rect rect;
   Bitmap *bitmap = NULL;
+  Background *background = NULL;
 
   int row;
 
+  if (tiff_info.passthrough)
+    return process_tiff_raw_image (input_attributes,
+				   image_info,
+				   page,
+				   output_attributes);
+
+  if (! (tiff_info.bilevel || tiff_info.threshold))
+    return process_tiff_flate_image (input_attributes,
+				     image_info,
+				     page,
+				     output_attributes);
+
   rect.min.x = 0;
   rect.min.y = 0;
 
@@ -312,20 +1028,30 @@ static bool process_tiff_image (int image,  /* range 1 .. n */
       goto fail;
     }
 
-  for (row = 0; row < rect.max.y; row++)
-    if (1 != TIFFReadScanline (tiff_in,
-			       bitmap->bits + row * bitmap->row_words,
-			       row,
-			       0))
-      {
-	fprintf (stderr, "can't read TIFF scanline\n");
+  if (tiff_info.threshold)
+    {
+      if (! input_attributes.has_threshold)
+	input_attributes.threshold.method = THRESHOLD_OTSU;
+      if (! read_tiff_thresholded (input_attributes, image_info, bitmap))
 	goto fail;
-      }
+    }
+  else
+    {
+      for (row = 0; row < rect.max.y; row++)
+	if (1 != TIFFReadScanline (tiff_in,
+				   bitmap->bits + row * bitmap->row_words,
+				   row,
+				   0))
+	  {
+	    fprintf (stderr, "can't read TIFF scanline\n");
+	    goto fail;
+	  }
 
 #ifdef TIFF_REVERSE_BITS
-  reverse_bits ((uint8_t *) bitmap->bits,
-		rect.max.y * bitmap->row_words * sizeof (word_t));
+      reverse_bits ((uint8_t *) bitmap->bits,
+		    rect.max.y * bitmap->row_words * sizeof (word_t));
 #endif /* TIFF_REVERSE_BITS */
+    }
 
 #if 0
   if (input_attributes.has_page_size)
@@ -334,26 +1060,110 @@ static bool process_tiff_image (int image,  /* range 1 .. n */
 			    input_attributes.page_size.height * y_resolution);
 #endif
 
-  rotate_bitmap (bitmap, input_attributes.rotation);
+  if (tiff_info.mrc_reduction)
+    {
+      background = read_tiff_background (image_info, bitmap);
+      if (! background)
+	goto fail;
+    }
+
+  if (! filter_input_bitmap (bitmap, input_attributes))
+    goto fail;
+
+  /* the background can't be turned, so the mask isn't either */
+  if (! (input_attributes.render_rotation || background))
+    {
+      rotate_bitmap (bitmap, input_attributes.rotation);
+      pdf_set_image_rotation (page, 0);
+    }
 
-  pdf_write_g4_fax_image (page,
-			  output_attributes.position.x, output_attributes.position.y,
-			  image_info->width_points, image_info->height_points,
-			  image_info->negative,
-			  bitmap,
-			  output_attributes.overlay,
-			  output_attributes.colormap,
-			  input_attributes.transparency);
+  if (background)
+    write_tiff_mrc_image (image_info, bitmap, background, page, output_attributes);
+  else
+    pdf_write_g4_fax_image (page,
+			    output_attributes.position.x, output_attributes.position.y,
+			    image_info->width_points, image_info->height_points,
+			    image_info->negative,
+			    bitmap,
+			    output_attributes.overlay,
+			    output_attributes.colormap,
+			    input_attributes.transparency);
 
   result = 1;
 
  fail:
+  if (background)
+    free_background (background);
   if (bitmap)
     free_bitmap (bitmap);
   return result;
 }
 
 
+/* Only bilevel images are checked, since their rows can be counted as
+   they are read. */
+static bool is_blank_tiff_image (int image,
+				 input_attributes_t input_attributes,
+				 image_info_t *image_info)
+{
+  bool blank = false;
+  Rect rect;
+  Bitmap *band;
+  uint32_t width, height;
+  uint32_t row, rows;
+  uint64_t black;
+
+  if (! (tiff_info.bilevel && ! tiff_info.passthrough))
+    return false;
+
+  if ((input_attributes.rotation == 90) || (input_attributes.rotation == 270))
+    {
+      width = image_info->height_samples;
+      height = image_info->width_samples;
+    }
+  else
+    {
+      width = image_info->width_samples;
+      height = image_info->height_samples;
+    }
+
+  rect.min.x = 0;
+  rect.min.y = 0;
+  rect.max.x = width;
+  rect.max.y = BLANK_BAND_ROWS;
+  band = create_bitmap (& rect);
+  if (! band)
+    return false;
+
+  for (row = 0; row < height; row += rows)
+    {
+      uint32_t y;
+
+      rows = ((height - row) < BLANK_BAND_ROWS) ? (height - row) : BLANK_BAND_ROWS;
+      for (y = 0; y < rows; y++)
+	if (1 != TIFFReadScanline (tiff_in,
+				   band->bits + y * band->row_words,
+				   row + y,
+				   0))
+	  goto done;
+#ifdef TIFF_REVERSE_BITS
+      reverse_bits ((uint8_t *) band->bits,
+		    rows * band->row_words * sizeof (word_t));
+#endif /* TIFF_REVERSE_BITS */
+      black = count_black_pixels (band, rows);
+      if (image_info->negative)
+	black = (uint64_t) width * rows - black;
+      if (inked_band (black, width, rows))
+	goto done;
+    }
+  blank = true;
+
+ done:
+  free_bitmap (band);
+  return blank;
+}
+
+
 input_handler_t tiff_handler =
   {
     match_tiff_suffix,
@@ -361,7 +1171,9 @@ input_handler_t tiff_handler =
     close_tiff_input_file,
     last_tiff_input_page,
     get_tiff_image_info,
-    process_tiff_image
+    process_tiff_image,
+    is_blank_tiff_image,
+    false
   };
 
 